@@ -0,0 +1,43 @@
+"""Plot cluster distributions from the file written by depfetAnalyze --clusters
+
+usage: python clusters.py CLUSTERFILE [CLUSTERFILE ...]
+"""
+import sys
+import numpy as np
+import matplotlib
+matplotlib.use("Agg")
+from matplotlib import pyplot as pl
+from matplotlib.backends.backend_pdf import PdfPages
+
+record = np.dtype([("event", "<u4"), ("module", "<u2"), ("frame", "<u2"), ("charge", "<f4"),
+                   ("seed", "<f4"), ("col", "<f4"), ("row", "<f4"), ("size", "<u4")])
+
+def read_clusters(filename):
+    """Return all clusters of a file as numpy record array"""
+    datafile = open(filename, "rb")
+    magic = datafile.read(8)
+    version, size = np.fromfile(datafile, dtype="<u4", count=2)
+    if magic != b"DEPFETCL" or version != 1 or size != record.itemsize:
+        raise ValueError("%s is not a DEPFET cluster file" % filename)
+    return np.fromfile(datafile, dtype=record)
+
+pp = PdfPages("clusters.pdf")
+for filename in sys.argv[1:]:
+    clusters = read_clusters(filename)
+    print("%s: %d clusters, mean size %.2f, mean charge %.1f" % (
+        filename, len(clusters), clusters["size"].mean(), clusters["charge"].mean()))
+
+    fig = pl.figure(figsize=(12, 4))
+    ax = fig.add_subplot(131)
+    ax.hist(clusters["charge"], bins=100)
+    ax.set_xlabel("cluster charge")
+    ax = fig.add_subplot(132)
+    ax.hist(clusters["size"], bins=np.arange(0.5, 20.5))
+    ax.set_xlabel("cluster size")
+    ax = fig.add_subplot(133)
+    ax.hist2d(clusters["col"], clusters["row"], bins=(64, 128))
+    ax.set_xlabel("column")
+    ax.set_ylabel("row")
+    fig.suptitle(filename)
+    pp.savefig(fig)
+pp.close()
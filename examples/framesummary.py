@@ -0,0 +1,67 @@
+"""Plot the per frame summaries written by depfetAnalyze --summary and list
+frames which look bad
+
+usage: python framesummary.py [--cut N] SUMMARYFILE [SUMMARYFILE ...]
+
+A frame is listed if its mean, RMS, occupancy or common mode range is more
+than N (default 5) median absolute deviations away from the median of its
+module. The listed "event module frame" lines can be used as veto list.
+"""
+import sys
+import numpy as np
+import matplotlib
+matplotlib.use("Agg")
+from matplotlib import pyplot as pl
+from matplotlib.backends.backend_pdf import PdfPages
+
+record = np.dtype([("event", "<u4"), ("module", "<u2"), ("frame", "<u2"), ("startGate", "<i4"),
+                   ("temperature", "<f4"), ("mean", "<f4"), ("rms", "<f4"), ("occupancy", "<f4"),
+                   ("minCommonMode", "<f4"), ("maxCommonMode", "<f4")])
+
+def read_summary(filename):
+    """Return all frame summaries of a file as numpy record array"""
+    datafile = open(filename, "rb")
+    magic = datafile.read(8)
+    version, size = np.fromfile(datafile, dtype="<u4", count=2)
+    if magic != b"DEPFETDQ" or version != 1 or size != record.itemsize:
+        raise ValueError("%s is not a DEPFET frame summary file" % filename)
+    return np.fromfile(datafile, dtype=record)
+
+def outliers(values, cut):
+    """Return a mask of all values more than cut median absolute deviations away from the median"""
+    median = np.median(values)
+    mad = np.median(np.abs(values - median))
+    return np.abs(values - median) > cut * max(mad, 1e-6)
+
+cut = 5.0
+args = sys.argv[1:]
+if len(args) > 1 and args[0] == "--cut":
+    cut = float(args[1])
+    args = args[2:]
+
+pp = PdfPages("framesummary.pdf")
+for filename in args:
+    summary = read_summary(filename)
+    for module in np.unique(summary["module"]):
+        frames = summary[summary["module"] == module]
+        cmRange = frames["maxCommonMode"] - frames["minCommonMode"]
+        bad = outliers(frames["mean"], cut) | outliers(frames["rms"], cut) | \
+            outliers(frames["occupancy"], cut) | outliers(cmRange, cut)
+        print("%s, module %d: %d frames, %d bad" % (filename, module, len(frames), bad.sum()))
+        for frame in frames[bad]:
+            print("%d %d %d" % (frame["event"], frame["module"], frame["frame"]))
+
+        fig = pl.figure(figsize=(12, 8))
+        for i, (name, values) in enumerate([("mean", frames["mean"]), ("rms", frames["rms"]),
+                                            ("occupancy", frames["occupancy"]),
+                                            ("common mode range", cmRange),
+                                            ("start gate", frames["startGate"]),
+                                            ("temperature", frames["temperature"])]):
+            ax = fig.add_subplot(2, 3, i + 1)
+            ax.plot(values, ",")
+            ax.plot(np.nonzero(bad)[0], values[bad], "rx")
+            ax.set_xlabel("frame")
+            ax.set_ylabel(name)
+        fig.suptitle("%s, module %d" % (filename, module))
+        pp.savefig(fig)
+pp.close()
@@ -0,0 +1,68 @@
+"""Show the history of single pixels from the raw sample file written by
+depfetCalibration --raw-samples
+
+usage: python pixelsamples.py SAMPLEFILE COL ROW [COL ROW ...]
+
+For each pixel the raw values over time, their distribution (random
+telegraph noise shows up as several peaks) and the autocorrelation of the
+pedestal fluctuations are plotted.
+"""
+import sys
+import numpy as np
+import matplotlib
+matplotlib.use("Agg")
+from matplotlib import pyplot as pl
+from matplotlib.backends.backend_pdf import PdfPages
+
+header = np.dtype([("magic", "S8"), ("version", "<u4"), ("sizeX", "<u4"), ("sizeY", "<u4"), ("blockFrames", "<u4")])
+blockheader = np.dtype([("firstFrame", "<u8"), ("frames", "<u4"), ("padding", "<u4")])
+
+class SampleFile:
+    """Access the samples of single pixels without reading the whole file"""
+    def __init__(self, filename):
+        self.data = np.memmap(filename, dtype="u1", mode="r")
+        head = self.data[:header.itemsize].view(header)[0]
+        if head["magic"] != b"DEPFETRS" or head["version"] != 1:
+            raise ValueError("%s is not a DEPFET sample file" % filename)
+        self.sizeX, self.sizeY = int(head["sizeX"]), int(head["sizeY"])
+        pixels = self.sizeX * self.sizeY
+        #Offset and number of frames of each block
+        self.blocks = []
+        offset = header.itemsize
+        while offset + blockheader.itemsize <= len(self.data):
+            frames = int(self.data[offset:offset + blockheader.itemsize].view(blockheader)[0]["frames"])
+            offset += blockheader.itemsize
+            self.blocks.append((offset, frames))
+            offset += pixels * frames * 2
+
+    def pixel(self, col, row):
+        """Return all samples of one pixel"""
+        index = col * self.sizeY + row
+        return np.concatenate([self.data[offset + index * frames * 2:offset + (index + 1) * frames * 2].view("<i2")
+                               for offset, frames in self.blocks])
+
+def autocorrelation(values, maxLag=200):
+    values = values - values.mean()
+    norm = np.dot(values, values)
+    return np.array([np.dot(values[:len(values) - lag], values[lag:]) / norm for lag in range(min(maxLag, len(values)))])
+
+samples = SampleFile(sys.argv[1])
+pp = PdfPages("pixelsamples.pdf")
+for col, row in zip(sys.argv[2::2], sys.argv[3::2]):
+    values = samples.pixel(int(col), int(row))
+    print("pixel %s/%s: %d frames, mean %.2f, rms %.2f" % (col, row, len(values), values.mean(), values.std()))
+    fig = pl.figure(figsize=(12, 4))
+    ax = fig.add_subplot(131)
+    ax.plot(values, ",")
+    ax.set_xlabel("frame")
+    ax.set_ylabel("raw adc value")
+    ax = fig.add_subplot(132)
+    ax.hist(values, bins=np.arange(values.min() - 0.5, values.max() + 1.5))
+    ax.set_xlabel("raw adc value")
+    ax = fig.add_subplot(133)
+    ax.plot(autocorrelation(values.astype(float)))
+    ax.set_xlabel("lag [frames]")
+    ax.set_ylabel("autocorrelation")
+    fig.suptitle("pixel %s/%s" % (col, row))
+    pp.savefig(fig)
+pp.close()
@@ -0,0 +1,63 @@
+"""Show the hitmap published by depfetAnalyze --shm NAME
+
+usage: python sharedhitmap.py NAME [interval]
+
+Reads the shared memory segment /dev/shm/NAME every interval seconds and
+updates the plot. The layout is described in include/SharedHitmap.h
+"""
+import sys
+import time
+import mmap
+import struct
+import numpy as np
+from matplotlib import pyplot as pl
+
+HEADER = struct.Struct("=8sIIIIIIQQQQQQd")
+SUMMARY = ("events", "frames", "lasthits", "maxhits", "hits", "signal")
+
+class SharedHitmap(object):
+    def __init__(self, name):
+        shmfile = open("/dev/shm/" + name.lstrip("/"), "rb")
+        self.memory = mmap.mmap(shmfile.fileno(), 0, access=mmap.ACCESS_READ)
+        shmfile.close()
+        header = HEADER.unpack_from(self.memory, 0)
+        if header[0] != b"DEPFETSM" or header[1] != 1:
+            raise ValueError("%s is not a DEPFET hitmap" % name)
+        self.headersize, self.module, self.cols, self.rows = header[2:6]
+        #View of the hitmap directly in shared memory
+        self.data = np.frombuffer(self.memory, dtype=np.float64, count=self.cols*self.rows,
+                                  offset=self.headersize).reshape(self.cols, self.rows)
+
+    def read(self):
+        """Return a consistent copy of the hitmap and the statistics"""
+        while True:
+            sequence = HEADER.unpack_from(self.memory, 0)[7]
+            if sequence % 2 == 1:
+                #writer is updating the segment
+                time.sleep(0.001)
+                continue
+            data = self.data.copy()
+            header = HEADER.unpack_from(self.memory, 0)
+            if header[7] == sequence:
+                return np.ma.masked_less(data, 0), dict(zip(SUMMARY, header[8:]))
+
+name = sys.argv[1]
+interval = float(sys.argv[2]) if len(sys.argv) > 2 else 1.0
+hitmap = SharedHitmap(name)
+
+pl.ion()
+fig = pl.figure()
+ax = fig.add_subplot(111)
+data, summary = hitmap.read()
+img = ax.imshow(data.T, interpolation="nearest", origin="lower", aspect="auto", vmin=0)
+ax.set_xlabel("column")
+ax.set_ylabel("row")
+fig.colorbar(img)
+while pl.fignum_exists(fig.number):
+    data, summary = hitmap.read()
+    frames = max(summary["frames"], 1)
+    img.set_data(data.T)
+    img.autoscale()
+    ax.set_title("module %d: %d events, %.1f hits/frame, last %d, max %d" % (
+        hitmap.module, summary["events"], summary["hits"] / float(frames), summary["lasthits"], summary["maxhits"]))
+    pl.pause(interval)
@@ -0,0 +1,53 @@
+"""Make a movie from the frame stack written by depfetHitmap --slice-stack
+
+usage: python stackmovie.py STACKFILE
+
+The stack is mapped into memory, so only the image being drawn is read and
+the memory usage does not depend on the number of images. For plain
+grayscale movies no python is needed: write the slices with --slice-images
+movie/%06d.pgm and run ffmpeg -i movie/%06d.pgm movie.mp4
+"""
+import sys
+import os
+import numpy as np
+import subprocess
+import matplotlib
+matplotlib.use("Agg")
+from matplotlib import pyplot as pl
+
+filename = sys.argv[1]
+basename = os.path.splitext(filename)[0]
+
+header = np.fromfile(filename, dtype=[("magic", "S8"), ("version", "<u4"), ("cols", "<u4"),
+                                      ("rows", "<u4"), ("padding", "<u4")], count=1)[0]
+if header["magic"] != b"DEPFETFS":
+    raise ValueError("%s is not a DEPFET frame stack" % filename)
+cols, rows = int(header["cols"]), int(header["rows"])
+record = np.dtype([("event", "<u8"), ("events", "<u4"), ("padding", "<u4"),
+                   ("data", "<f4", (cols, rows))])
+stack = np.memmap(filename, dtype=record, mode="r", offset=header.dtype.itemsize)
+
+#Common color scale for all images, computed one image at a time
+maxADC = 0
+for image in stack:
+    maxADC = max(maxADC, image["data"].max())
+print("%d images, max value is %g" % (len(stack), maxADC))
+
+subprocess.call(["mkdir", "-p", basename])
+cmap = matplotlib.cm.get_cmap("binary")
+
+for i, image in enumerate(stack):
+    data = np.ma.masked_less(image["data"], 0)
+    fig = pl.figure(figsize=(15, 6))
+    ax = fig.add_axes((0.05, 0.1, 1.0, 0.85))
+    img = ax.imshow(data.T, interpolation="nearest", origin="lower",
+                    aspect="auto", vmin=0, vmax=maxADC, cmap=cmap)
+    ax.set_xlabel("column")
+    ax.set_ylabel("row")
+    ax.set_title("Events %d-%d" % (image["event"], image["event"] + image["events"] - 1))
+    fig.colorbar(img, fraction=0.13, pad=0.01)
+    fig.savefig(basename+"/%06d.png" % i, dpi=90)
+    pl.close(fig)
+
+subprocess.call(["ffmpeg", "-y", "-r", "10", "-qscale", "3",
+                 "-i", basename+"/%06d.png", basename+".mp4"])
@@ -1,8 +1,11 @@
 #ifndef DEPFET_ADCVALUES_H
 #define DEPFET_ADCVALUES_H
 
+#include <vector>
 #include <stdexcept>
 
+#include <DEPFETReader/DataView.h>
+
 namespace DEPFET {
   /** Class to represent a matrix of values.
    * Offers flat or 2D access to the values and to add and substract other matrices */
@@ -41,6 +44,12 @@ namespace DEPFET {
     }
     /** return value of an element of the flat array, no boundary check */
     value_type operator[](size_t index) const { return m_data[index]; }
+    /** return pointer to the flat array, only valid for matrices with nonzero size */
+    const value_type* getData() const { return &m_data.front(); }
+    /** return a readonly view of the matrix, only valid as long as the matrix is not resized */
+    DataView<T, T> getView() const {
+      return DataView<T, T>(m_data.empty() ? 0 : &m_data.front(), m_data.size(), m_sizeX, m_sizeY);
+    }
 
     /** return reference to a given position, no boundary check */
     value_type& operator()(size_t x, size_t y) { return m_data[x * m_sizeY + y]; }
@@ -53,24 +62,24 @@ namespace DEPFET {
       return m_data[x * m_sizeY + y];
     }
 
-    /** substract another matrix */
-    template<class T2> void substract(const ValueMatrix<T2>& other, double scale = 1) {
+    /** substract another matrix or DataView */
+    template<class MATRIX> void substract(const MATRIX& other, double scale = 1) {
       if (other.getSizeX() != m_sizeX || other.getSizeY() != m_sizeY) {
         throw std::runtime_error("Dimensions do not match");
       }
       for (size_t i = 0; i < m_data.size(); ++i) m_data[i] -= scale * (value_type) other[i];
     }
 
-    /** add another matrix */
-    template<class T2> void add(const ValueMatrix<T2>& other, double scale = 1) {
+    /** add another matrix or DataView */
+    template<class MATRIX> void add(const MATRIX& other, double scale = 1) {
       if (other.getSizeX() != m_sizeX || other.getSizeY() != m_sizeY) {
         throw std::runtime_error("Dimensions do not match");
       }
       for (size_t i = 0; i < m_data.size(); ++i) m_data[i] += scale * (value_type) other[i];
     }
 
-    /** set matrix from given matrix */
-    template<class T2> void set(const ValueMatrix<T2>& other, double scale = 1) {
+    /** set matrix from given matrix or DataView */
+    template<class MATRIX> void set(const MATRIX& other, double scale = 1) {
       if (other.getSizeX() != m_sizeX || other.getSizeY() != m_sizeY) {
         throw std::runtime_error("Dimensions do not match");
       }
@@ -91,12 +100,16 @@ namespace DEPFET {
   typedef ValueMatrix<unsigned char> PixelMask;
   /** Typedef used for the pixel noise map */
   typedef ValueMatrix<double> PixelNoise;
+  /** Typedef used for a readonly pixel mask, e.g. from a mapped calibration file */
+  typedef DataView<unsigned char, unsigned char> MaskView;
+  /** Typedef used for readonly pixel values like pedestals or noise */
+  typedef DataView<double, double> ValueView;
 
   /** Class for adc values from a matrix, including some additional information */
   class ADCValues: public ValueMatrix<double> {
   public:
     /** default constructor */
-    ADCValues(): ValueMatrix<double>(), m_moduleNr(0), m_triggerNr(0), m_startGate(-1) {}
+    ADCValues(): ValueMatrix<double>(), m_moduleNr(0), m_triggerNr(0), m_startGate(-1), m_frameNr(0), m_temperature(0) {}
     /** get the number of the module */
     int getModuleNr() const { return m_moduleNr; }
     /** get the trigger number */
@@ -105,6 +118,8 @@ namespace DEPFET {
     int getStartGate() const { return m_startGate; }
     /** get the frame number. 0 for the normal frame, 1..n for trailing frames */
     int getFrameNr() const { return m_frameNr; }
+    /** get the module temperature in degree celsius */
+    float getTemperature() const { return m_temperature; }
     /** set the number of the module */
     void setModuleNr(int moduleNr) { m_moduleNr = moduleNr; }
     /** set the trigger number */
@@ -113,6 +128,8 @@ namespace DEPFET {
     void setStartGate(int startGate) { m_startGate = startGate; }
     /** set the frame number */
     void setFrameNr(int frameNr) { m_frameNr = frameNr; }
+    /** set the module temperature */
+    void setTemperature(float temperature) { m_temperature = temperature; }
   protected:
     /** module number */
     int m_moduleNr;
@@ -122,6 +139,8 @@ namespace DEPFET {
     int m_startGate;
     /** frame number,  0 for the normal frame, 1..n for trailing frames */
     int m_frameNr;
+    /** module temperature in degree celsius */
+    float m_temperature;
   };
 
 }
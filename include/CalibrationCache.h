@@ -0,0 +1,64 @@
+#ifndef DEPFET_CALIBRATIONCACHE_H
+#define DEPFET_CALIBRATIONCACHE_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Class to cache calibration results in a directory.
+   *
+   * The cache key is built from the identity of all input files and from
+   * all parameters which influence the result. A file is identified by its
+   * size, its modification time and a hash of its first record headers,
+   * which is cheap to compute even for very large files. Each cache entry
+   * is a directory named after the hash of the key, containing a copy of
+   * all result files and the full key to protect against hash collisions.
+   */
+  class CalibrationCache {
+  public:
+    /** Create a cache using the given directory */
+    CalibrationCache(const std::string& directory): m_directory(directory) {}
+
+    /** Add the identity of a raw data file to the key */
+    void addFile(const std::string& filename);
+    /** Add the identity of a small file like a mask file to the key, hashing its full content.
+     * A missing file is added as missing */
+    void addSmallFile(const std::string& filename);
+    /** Add a parameter to the key. Floating point values are written with
+     * full precision so nearby values give different keys */
+    template<class T> void addParameter(const std::string& name, const T& value) {
+      std::ostringstream entry;
+      entry << std::setprecision(17) << "parameter " << name << " " << value << "\n";
+      m_key += entry.str();
+    }
+
+    /** Return the full key */
+    const std::string& getKey() const { return m_key; }
+    /** Return the hash of the key as hex string, used as name of the cache entry */
+    std::string getHash() const;
+
+    /** Copy the cached results to the given filenames.
+     * @return false if there is no complete cache entry for the key */
+    bool fetch(const std::vector<std::string>& filenames) const;
+    /** Copy the given result files into the cache */
+    void store(const std::vector<std::string>& filenames) const;
+
+    /** Calculate a 64bit FNV-1a hash of a block of data, continuing from a previous hash */
+    static uint64_t hash(const void* data, size_t size, uint64_t previous = 14695981039346656037ULL);
+
+  protected:
+    /** Return the directory of the cache entry */
+    std::string getEntryDirectory() const { return m_directory + "/" + getHash(); }
+
+    /** Directory containing the cache */
+    std::string m_directory;
+    /** Key describing inputs and parameters */
+    std::string m_key;
+  };
+
+}
+#endif
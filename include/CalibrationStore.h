@@ -0,0 +1,188 @@
+#ifndef DEPFET_CALIBRATIONSTORE_H
+#define DEPFET_CALIBRATIONSTORE_H
+
+#include <DEPFETReader/ADCValues.h>
+#include <DEPFETReader/DataView.h>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Mask, pedestals and noise of one module */
+  struct ModuleCalibration {
+    /** default constructor */
+    ModuleCalibration(int moduleNr = 0): moduleNr(moduleNr) {}
+    /** module number */
+    int moduleNr;
+    /** masked pixels */
+    PixelMask mask;
+    /** pedestal of each pixel */
+    ValueMatrix<double> pedestals;
+    /** noise of each pixel */
+    PixelNoise noise;
+  };
+
+  /** Class to access a binary calibration file containing mask, pedestals
+   * and noise for any number of modules.
+   *
+   * The file is memory mapped read only, so all processes on a machine
+   * using the same calibration share the same pages. The layout is a
+   * FileHeader, followed by one ModuleEntry per module and the data blocks
+   * of all modules. Each data block contains the pedestals and the noise as
+   * doubles followed by the mask as bytes, all in the same order as the
+   * flat array of ValueMatrix.
+   */
+  class CalibrationStore {
+  public:
+    /** Current version of the file format */
+    enum { VERSION = 1 };
+
+    /** Header at the beginning of the file */
+    struct FileHeader {
+      /** magic bytes to identify the file */
+      char magic[8];
+      /** version of the file format */
+      uint32_t version;
+      /** number of modules in the file */
+      uint32_t nModules;
+    };
+
+    /** Description of one module in the file */
+    struct ModuleEntry {
+      /** module number */
+      int32_t moduleNr;
+      /** size in X */
+      uint32_t sizeX;
+      /** size in Y */
+      uint32_t sizeY;
+      /** unused, keeps the offset aligned */
+      uint32_t reserved;
+      /** offset of the data block from the start of the file */
+      uint64_t offset;
+    };
+
+    /** Create an unopened store */
+    CalibrationStore(): m_data(0), m_size(0) {}
+    /** Create a store and open the given file */
+    CalibrationStore(const std::string& filename): m_data(0), m_size(0) { open(filename); }
+    /** Unmap the file */
+    ~CalibrationStore() { close(); }
+
+    /** Map a binary calibration file, throws an Exception on error */
+    void open(const std::string& filename);
+    /** Unmap the file */
+    void close();
+
+    /** Return the numbers of all modules in the file */
+    std::vector<int> getModules() const;
+    /** Check if there is a calibration for the given module */
+    bool hasModule(int moduleNr) const { return findModule(moduleNr) != 0; }
+    /** Return the name of the mapped file, empty if no file is mapped */
+    const std::string& getFilename() const { return m_filename; }
+    /** Return a view of the pixel mask of a module, valid until the file is unmapped */
+    MaskView getMask(int moduleNr) const;
+    /** Return a view of the pedestals of a module, valid until the file is unmapped */
+    ValueView getPedestals(int moduleNr) const;
+    /** Return a view of the noise of a module, valid until the file is unmapped */
+    ValueView getNoise(int moduleNr) const;
+    /** Throw an Exception if the calibration of a module does not have the given size */
+    void checkSize(int moduleNr, size_t sizeX, size_t sizeY) const;
+    /** Copy the calibration of a module into the given matrices. Empty
+     * matrices get the size of the calibration, throws an Exception if the
+     * size of the others does not match */
+    void read(int moduleNr, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise) const;
+
+    /** Check if a file is a binary calibration file */
+    static bool isBinary(const std::string& filename);
+    /** Write a binary calibration file containing the given modules */
+    static void write(const std::string& filename, const std::vector<ModuleCalibration>& modules);
+    /** Read a calibration text file with one "col row mask pedestal noise"
+     * line per pixel. If the matrices are empty, their size is determined
+     * from the largest column and row in the file */
+    static void readText(const std::string& filename, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise);
+    /** Copy the calibration of a module from either a binary or a text
+     * file into the given matrices. Text files contain only one module so
+     * the module number is ignored. To correct frames use CalibrationView,
+     * which does not copy binary calibrations */
+    static void load(const std::string& filename, int moduleNr, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise);
+
+  protected:
+    /** Return the entry for a given module or 0 if there is none */
+    const ModuleEntry* findModule(int moduleNr) const;
+    /** Return the entry for a given module, throws an Exception if there is none */
+    const ModuleEntry& getModule(int moduleNr) const;
+
+    /** Pointer to the mapped file */
+    const char* m_data;
+    /** Size of the mapped file */
+    size_t m_size;
+    /** Name of the mapped file */
+    std::string m_filename;
+
+  private:
+    /** No copying of mapped files */
+    CalibrationStore(const CalibrationStore&);
+    /** No assignment of mapped files */
+    CalibrationStore& operator=(const CalibrationStore&);
+  };
+
+  /** Calibration of one module as used to correct its frames.
+   *
+   * For binary calibration files the views point directly into the file
+   * mapped by a CalibrationStore, so the calibration is not copied and all
+   * processes using it share the same pages. Only values which are changed
+   * during the run have to be copied to private matrices with copyMask()
+   * or copyPedestals() before their views are used, e.g. the mask when
+   * masking hot pixels or the pedestals when tracking them. Text files have
+   * no mapping and are always read into private matrices.
+   *
+   * The views returned stay valid as long as the CalibrationStore stays
+   * open and no other calibration is loaded.
+   */
+  class CalibrationView {
+  public:
+    /** Create a view without calibration */
+    CalibrationView(): m_privateMask(false), m_privatePedestals(false), m_privateNoise(false) {}
+
+    /** Load the calibration of a module for frames of the given size.
+     * Binary files are opened in store if it does not map them yet and
+     * store has to stay open while the calibration is used. Throws an
+     * Exception if there is no calibration for the module or its size does
+     * not match the frame size */
+    void load(CalibrationStore& store, const std::string& filename, int moduleNr, size_t sizeX, size_t sizeY);
+    /** Use an empty calibration for frames of the given size: nothing masked, zero pedestals and noise */
+    void clear(size_t sizeX, size_t sizeY);
+
+    /** Return the pixel mask */
+    MaskView getMask() const { return m_privateMask ? m_calibration.mask.getView() : m_mask; }
+    /** Return the pedestals */
+    ValueView getPedestals() const { return m_privatePedestals ? m_calibration.pedestals.getView() : m_pedestals; }
+    /** Return the noise */
+    ValueView getNoise() const { return m_privateNoise ? m_calibration.noise.getView() : m_noise; }
+
+    /** Copy the mask to a private matrix if needed and return it for modification */
+    PixelMask& copyMask();
+    /** Copy the pedestals to a private matrix if needed and return them for modification */
+    ValueMatrix<double>& copyPedestals();
+
+  protected:
+    /** Private copies of the calibration */
+    ModuleCalibration m_calibration;
+    /** Mask in the mapped file */
+    MaskView m_mask;
+    /** Pedestals in the mapped file */
+    ValueView m_pedestals;
+    /** Noise in the mapped file */
+    ValueView m_noise;
+    /** Whether the private mask is used */
+    bool m_privateMask;
+    /** Whether the private pedestals are used */
+    bool m_privatePedestals;
+    /** Whether the private noise is used */
+    bool m_privateNoise;
+  };
+
+}
+#endif
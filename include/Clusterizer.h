@@ -0,0 +1,91 @@
+#ifndef DEPFET_CLUSTERIZER_H
+#define DEPFET_CLUSTERIZER_H
+
+#include <DEPFETReader/ADCValues.h>
+
+#include <vector>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** One pixel above threshold */
+  struct Hit {
+    /** column of the pixel */
+    uint16_t col;
+    /** row of the pixel */
+    uint16_t row;
+    /** signal of the pixel */
+    float signal;
+  };
+
+  /** Group of neighbouring hits */
+  struct Cluster {
+    /** sum of the signal of all hits */
+    float charge;
+    /** largest signal of one hit */
+    float seed;
+    /** signal weighted mean column */
+    float col;
+    /** signal weighted mean row */
+    float row;
+    /** number of hits */
+    uint32_t size;
+  };
+
+  /** Class to group the hits of a frame into clusters of neighbouring pixels.
+   *
+   * The hits of a frame are collected in column major order, the order in
+   * which ValueMatrix stores the pixels. Because of this order all
+   * neighbours of a hit which were already visited are either the previous
+   * hit in the same column or in the previous column, so the clusters are
+   * found in a single pass over the sparse hit list, joining touching hits
+   * with union-find. Pixels touching at the corners are neighbours.
+   */
+  class Clusterizer {
+  public:
+    /** Create a clusterizer using the given sigma cut for hits */
+    Clusterizer(double sigmaCut = 5.0): m_sigmaCut(sigmaCut) {}
+
+    /** Find the clusters of a pedestal substracted and common mode corrected
+     * frame. Pixels are hits if they are not masked and above sigmaCut times
+     * their noise. Returns the clusters, valid until the next call */
+    const std::vector<Cluster>& findClusters(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    /** Find the clusters of a list of hits sorted by column and then by row.
+     * Returns the clusters, valid until the next call */
+    const std::vector<Cluster>& findClusters(const std::vector<Hit>& hits);
+    /** Return the hits of the last frame */
+    const std::vector<Hit>& getHits() const { return m_hits; }
+
+  protected:
+    /** Find the clusters of the hits in m_hits */
+    const std::vector<Cluster>& clusterHits();
+    /** Return the root of the group of a hit, shortening the path on the way */
+    int find(int index) {
+      while (m_parent[index] != index) {
+        m_parent[index] = m_parent[m_parent[index]];
+        index = m_parent[index];
+      }
+      return index;
+    }
+    /** Join the groups of two hits, the smaller root becomes the root of both */
+    void join(int a, int b) {
+      a = find(a);
+      b = find(b);
+      if (a < b) m_parent[b] = a;
+      else if (b < a) m_parent[a] = b;
+    }
+
+    /** Sigma cut for hits */
+    double m_sigmaCut;
+    /** Hits of the last frame */
+    std::vector<Hit> m_hits;
+    /** Union-find parent of each hit */
+    std::vector<int> m_parent;
+    /** Cluster index of each root hit */
+    std::vector<int> m_clusterIndex;
+    /** Clusters of the last frame */
+    std::vector<Cluster> m_clusters;
+  };
+
+}
+#endif
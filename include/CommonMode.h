@@ -28,7 +28,7 @@ namespace DEPFET {
      */
     CommonMode(int nRows = 1, int nCols = 1, int divRows = 1, int divCols = 1):
       m_nRows(nRows), m_nCols(nCols), m_divRows(divRows), m_divCols(divCols),
-      m_mask(0), m_noise(0), m_cutvalue(0) {};
+      m_cutvalue(0) {};
     /** Apply common mode corrections to raw data */
     void apply(ADCValues& data);
     /** Return the calculated column wise corrections */
@@ -36,12 +36,12 @@ namespace DEPFET {
     /** Return the calculated row wise corrections */
     const std::vector<double>& getCommonModesCol() const { return m_commonModeCol; }
     /** Set the mask to be used. All pixels which have a nonzero value in mask will be ignored */
-    void setMask(const PixelMask* mask) {
+    void setMask(const MaskView& mask) {
       m_mask = mask;
     }
     /** Set noise map and the cut value. All pixels which are more than
      * cutvalue*noise away from 0 are ignored for common mode correction */
-    void setNoise(double cutvalue, const PixelNoise* noise) {
+    void setNoise(double cutvalue, const ValueView& noise) {
       m_cutvalue = cutvalue;
       m_noise = noise;
     }
@@ -62,9 +62,9 @@ namespace DEPFET {
     /** Caluclated column wise corrections */
     std::vector<double> m_commonModeCol;
     /** Matrix containing masked pixels */
-    const PixelMask* m_mask;
+    MaskView m_mask;
     /** Matrix containing the pixel noise */
-    const PixelNoise* m_noise;
+    ValueView m_noise;
     /** Cut value for ignoring high signal values during common mode correction */
     double m_cutvalue;
   };
@@ -77,11 +77,11 @@ namespace DEPFET {
     //Collect pixel data
     for (int x = startCol; x < startCol + nCols; ++x) {
       for (int y = startRow; y < startRow + nRows; ++y) {
-        if (m_mask && (*m_mask)(x, y) != 0) {
+        if (!m_mask.empty() && m_mask(x, y) != 0) {
           data(x, y) = 0;
           continue;
         }
-        if (m_noise && data(x, y) > m_cutvalue * (*m_noise)(x, y)) continue;
+        if (!m_noise.empty() && data(x, y) > m_cutvalue * m_noise(x, y)) continue;
         pixelValues.push_back(data(x, y));
       }
     }
@@ -94,7 +94,7 @@ namespace DEPFET {
     //Apply correction to data
     for (int x = startCol; x < startCol + nCols; ++x) {
       for (int y = startRow; y < startRow + nRows; ++y) {
-        if (m_mask && (*m_mask)(x, y) != 0) data(x, y) = 0;
+        if (!m_mask.empty() && m_mask(x, y) != 0) data(x, y) = 0;
         else data(x, y) -= *middle;
       }
     }
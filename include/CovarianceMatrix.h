@@ -0,0 +1,117 @@
+#ifndef DEPFET_COVARIANCEMATRIX_H
+#define DEPFET_COVARIANCEMATRIX_H
+
+#include <DEPFETReader/ADCValues.h>
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Class to accumulate the covariance of the values of all pixel pairs
+   * over many frames, e.g. to find out which pixels share noise.
+   *
+   * Frames are collected in batches. Each full batch is added to the sums
+   * of products as one rank-k update, done tile by tile so the part of the
+   * sums being updated stays in the cache while all frames of the batch
+   * are added. The tiles are distributed over several threads.
+   *
+   * Only the upper triangle of the symmetric matrix is kept. If a band is
+   * given, only pairs of pixels whose columns differ by at most band are
+   * needed and tiles containing no such pair are neither stored nor updated.
+   */
+  class CovarianceMatrix {
+  public:
+    /** Constructor
+     * @param sizeX number of columns of the frames
+     * @param sizeY number of rows of the frames
+     * @param band largest column distance of pixel pairs, -1 for all pairs
+     * @param batchFrames number of frames per rank-k update
+     * @param nThreads number of threads for the update
+     */
+    CovarianceMatrix(size_t sizeX, size_t sizeY, int band = -1, size_t batchFrames = 256, int nThreads = 1);
+
+    /** Add one frame, updating the sums if the batch is full */
+    void add(const ValueMatrix<double>& data);
+    /** Add the frames remaining in the current batch to the sums */
+    void flush();
+
+    /** Return the number of frames added to the sums */
+    uint64_t getFrames() const { return m_frames; }
+    /** Return the number of pixels */
+    size_t getPixels() const { return m_pixels; }
+    /** Return the number of values stored for the sums of products */
+    size_t getStoredValues() const { return m_sums.size(); }
+    /** Check if the covariance of two pixels, given by their index in ValueMatrix, is available */
+    bool isComputed(size_t p, size_t q) const {
+      if (p > q) std::swap(p, q);
+      return m_band < 0 || (int)(q / m_sizeY - p / m_sizeY) <= m_band;
+    }
+    /** Return the mean value of a pixel */
+    double getMean(size_t p) const { return m_frames ? m_sum[p] / m_frames : 0; }
+    /** Return the covariance of two pixels, 0 if it is not computed */
+    double getCovariance(size_t p, size_t q) const {
+      if (p > q) std::swap(p, q);
+      if (m_frames == 0 || !isComputed(p, q)) return 0;
+      return getSum(p, q) / m_frames - getMean(p) * getMean(q);
+    }
+    /** Return the correlation coefficient of two pixels, NaN if one of them has no variance */
+    double getCorrelation(size_t p, size_t q) const {
+      if (m_scale[p] == 0 || m_scale[q] == 0) return std::numeric_limits<double>::quiet_NaN();
+      return getCovariance(p, q) * m_scale[p] * m_scale[q];
+    }
+
+  protected:
+    /** Tile of the upper triangle of the matrix */
+    struct Tile {
+      /** first pixel of the rows of the tile */
+      size_t row;
+      /** first pixel of the columns of the tile */
+      size_t col;
+      /** offset of the tile in m_sums */
+      size_t offset;
+    };
+    /** Add the current batch to every nth tile starting at first */
+    void updateTiles(size_t first, size_t step);
+    /** Return the sum of products of two pixels with p <= q */
+    double getSum(size_t p, size_t q) const {
+      const size_t offset = m_tileOffset[(p / TILE) * m_nTiles + q / TILE];
+      return m_sums[offset + (p % TILE) * TILE + q % TILE];
+    }
+
+    /** Number of pixels per tile side */
+    enum { TILE = 64 };
+    /** number of rows of the frames */
+    size_t m_sizeY;
+    /** number of pixels */
+    size_t m_pixels;
+    /** largest column distance of pixel pairs, -1 for all pairs */
+    int m_band;
+    /** number of frames per batch */
+    size_t m_batchFrames;
+    /** number of threads */
+    int m_nThreads;
+    /** number of tiles per matrix side */
+    size_t m_nTiles;
+    /** tiles of the upper triangle which are computed */
+    std::vector<Tile> m_tiles;
+    /** offset in m_sums for each pair of tiles, only valid for computed tiles */
+    std::vector<size_t> m_tileOffset;
+    /** sums of products of all computed pixel pairs, stored tile after tile */
+    std::vector<double> m_sums;
+    /** sum of the values of each pixel */
+    std::vector<double> m_sum;
+    /** inverse standard deviation of each pixel, 0 if it has no variance */
+    std::vector<double> m_scale;
+    /** values of the current batch, frame after frame */
+    std::vector<double> m_batch;
+    /** number of frames in the current batch */
+    size_t m_batchSize;
+    /** number of frames added to the sums */
+    uint64_t m_frames;
+  };
+
+}
+#endif
@@ -7,12 +7,20 @@
 namespace DEPFET {
 
   struct DCDConverter2Fold {
+    /** Size of the converted frame */
+    enum { SIZEX = 64, SIZEY = 32 };
+    /** Size of one raw frame in units of RawData::value_type */
+    enum { FRAME_WORDS = SIZEX * SIZEY * sizeof(signed char) / sizeof(RawData::value_type) };
     DCDConverter2Fold(bool useDCDMapping): m_useDCDMapping(useDCDMapping) {}
     bool m_useDCDMapping;
     size_t operator()(const RawData& rawData, ADCValues& adcValues);
   };
 
   struct DCDConverter4Fold {
+    /** Size of the converted frame */
+    enum { SIZEX = 32, SIZEY = 64 };
+    /** Size of one raw frame in units of RawData::value_type */
+    enum { FRAME_WORDS = SIZEX * SIZEY * sizeof(signed char) / sizeof(RawData::value_type) };
     DCDConverter4Fold(bool useDCDMapping): m_useDCDMapping(useDCDMapping) {}
     bool m_useDCDMapping;
     size_t operator()(const RawData& rawData, ADCValues& adcValues);
@@ -0,0 +1,168 @@
+#ifndef DEPFET_DATAGENERATOR_H
+#define DEPFET_DATAGENERATOR_H
+
+#include <DEPFETReader/RawData.h>
+#include <DEPFETReader/CalibrationStore.h>
+
+#include <ostream>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Class to write synthetic raw data in the binary DEPFET format.
+   *
+   * Each frame is created from pedestal and noise maps per module, a
+   * common mode offset per row, a number of hits per frame and a
+   * temperature which can drift during the run and shift the pedestals.
+   *
+   * To guarantee that the written data is decoded exactly like real data,
+   * the position of each pixel in the raw data is not hardcoded but
+   * determined by feeding marked raw frames through the same converters
+   * DataReader uses, once for each start gate.
+   */
+  class DataGenerator {
+  public:
+    /** Create a generator for a given device type
+     * @param deviceType one of DEVICETYPE_DEPFET (S3A), DEVICETYPE_DEPFET_128 (S3B) or DEVICETYPE_DEPFET_DCD
+     * @param fold readout fold, 2 or 4
+     * @param useDCDBMapping wether DCDB mapping is used, only relevant for DCD readout
+     * @param seed seed for the random number generator
+     */
+    DataGenerator(int deviceType, int fold = 2, bool useDCDBMapping = true, unsigned int seed = 1);
+
+    /** Add a module with random pedestals and noise. Throws an Exception
+     * if the module number does not fit in the header
+     * @param moduleNr module number, 0-15
+     * @param pedestal mean pedestal
+     * @param pedestalSpread sigma of the pedestals between pixels
+     * @param noise mean noise
+     * @param noiseSpread sigma of the noise between pixels
+     */
+    void addModule(int moduleNr, double pedestal, double pedestalSpread, double noise, double noiseSpread);
+    /** Add a module with given pedestal and noise maps. The mask is ignored.
+     * Throws an Exception if the module number does not fit in the header */
+    void addModule(const ModuleCalibration& calibration);
+
+    /** Set the number of trailing frames written after each frame */
+    void setTrailingFrames(int nFrames) { m_trailingFrames = nFrames; }
+    /** Set the sigma of the common mode offset applied to each row */
+    void setCommonMode(double sigma) { m_commonMode = sigma; }
+    /** Set the mean number of hits per frame and the mean seed signal of a hit */
+    void setHits(double hitsPerFrame, double signal) { m_hitsPerFrame = hitsPerFrame; m_signal = signal; }
+    /** Set the temperature at start of the run, its change per event and
+     * the pedestal shift per degree */
+    void setTemperature(double temperature, double drift, double pedestalShift) {
+      m_temperature = temperature;
+      m_startTemperature = temperature;
+      m_temperatureDrift = drift;
+      m_pedestalShift = pedestalShift;
+    }
+    /** Set wether the start gate changes randomly from event to event */
+    void setRotateStartGate(bool rotate) { m_rotateStartGate = rotate; }
+    /** Set the run number */
+    void setRunNumber(int runNumber) { m_runNumber = runNumber; }
+
+    /** Return the number of columns of one frame */
+    size_t getSizeX() const { return m_sizeX; }
+    /** Return the number of rows of one frame */
+    size_t getSizeY() const { return m_sizeY; }
+    /** Return the number of different start gates */
+    int getGates() const { return m_gates; }
+    /** Return the size of one event in units of RawData::value_type,
+     * including the headers. writeEvent throws an Exception if it exceeds
+     * RawData::MAX_EVENT_SIZE */
+    size_t getEventSize() const;
+    /** Return the pedestal and noise maps of all modules */
+    const std::vector<ModuleCalibration>& getModules() const { return m_modules; }
+    /** Return the number of events written */
+    int getEvents() const { return m_events; }
+
+    /** Write the run header containing the run number */
+    void writeRunHeader(std::ostream& output);
+    /** Write one event containing one frame plus trailing frames for each module */
+    void writeEvent(std::ostream& output);
+    /** Write the run end record */
+    void writeRunTrailer(std::ostream& output);
+
+  protected:
+    /** Fast random number generator (xorshift64*) */
+    uint64_t random() {
+      m_random ^= m_random >> 12;
+      m_random ^= m_random << 25;
+      m_random ^= m_random >> 27;
+      return m_random * 2685821657736338717ULL;
+    }
+    /** Uniform random number in [0,1) */
+    double uniform() { return (random() >> 11) * (1.0 / 9007199254740992.0); }
+    /** Gaussian random number with mean 0 and sigma 1, taken from a precomputed table */
+    double gauss() { return m_gaussTable[random() >> 48]; }
+    /** Poisson distributed random number */
+    int poisson(double mean);
+
+    /** Throw an Exception if a module number does not fit in the header */
+    static void checkModuleNr(int moduleNr);
+    /** Return the position in the raw data for each pixel for a given start gate */
+    const std::vector<int>& getMapping(int startGate);
+    /** Feed a raw frame with the given elements through the converter */
+    void convert(const std::vector<unsigned char>& elements, int startGate, ADCValues& adcValues, size_t& frameWords);
+    /** Fill the values of one frame */
+    void fillFrame(const ModuleCalibration& module, bool addHits);
+    /** Append one frame to the record buffer */
+    void encodeFrame(int startGate);
+
+    /** Device type */
+    int m_deviceType;
+    /** Readout fold */
+    int m_fold;
+    /** Wether DCDB mapping is used */
+    bool m_useDCDBMapping;
+    /** Frame size in X */
+    size_t m_sizeX;
+    /** Frame size in Y */
+    size_t m_sizeY;
+    /** Size of one frame in units of RawData::value_type */
+    size_t m_frameWords;
+    /** Size of one pixel value in the raw data in bytes */
+    size_t m_elementSize;
+    /** Number of different start gates */
+    int m_gates;
+    /** Modules to generate */
+    std::vector<ModuleCalibration> m_modules;
+    /** Mapping from raw data position to pixel index for each start gate */
+    std::map<int, std::vector<int> > m_mappings;
+    /** Number of trailing frames */
+    int m_trailingFrames;
+    /** Sigma of the common mode per row */
+    double m_commonMode;
+    /** Mean number of hits per frame */
+    double m_hitsPerFrame;
+    /** Mean seed signal */
+    double m_signal;
+    /** Current temperature */
+    double m_temperature;
+    /** Temperature change per event */
+    double m_temperatureDrift;
+    /** Pedestal shift per degree */
+    double m_pedestalShift;
+    /** Temperature at the start of the run */
+    double m_startTemperature;
+    /** Wether the start gate changes from event to event */
+    bool m_rotateStartGate;
+    /** Run number */
+    int m_runNumber;
+    /** Number of events written */
+    int m_events;
+    /** State of the random number generator */
+    uint64_t m_random;
+    /** Table of gaussian random numbers */
+    std::vector<double> m_gaussTable;
+    /** Pixel values of the current frame */
+    std::vector<double> m_values;
+    /** Buffer for the current record */
+    std::vector<RawData::value_type> m_buffer;
+  };
+
+}
+#endif
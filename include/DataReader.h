@@ -3,18 +3,41 @@
 
 #include <DEPFETReader/RawData.h>
 #include <DEPFETReader/Event.h>
+#include <DEPFETReader/ProcessingStats.h>
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/FileWatcher.h>
+#include <DEPFETReader/StreamBuffer.h>
 
 #include <fstream>
 #include <map>
 
 namespace DEPFET {
+  class EventBuilder;
+
+  /** Interface to get notified when a reader in follow mode has processed
+   * all available data and starts waiting for more */
+  class FollowHandler {
+  public:
+    /** Virtual destructor for derived classes */
+    virtual ~FollowHandler() {}
+    /** Called once each time the reader reaches the end of the data written so far */
+    virtual void waitingForData() = 0;
+  };
+
   /** Class to read binary DEPFET file and return the raw adc values for each readout event */
   class DataReader {
   public:
     /** constructor to create a new instance */
-    DataReader(): m_eventNumber(0), m_nEvents(-1), m_fold(2), m_useDCDBMapping(true), m_rawData(m_file), m_event(1) {}
+    DataReader(): m_eventNumber(0), m_nEvents(-1), m_fold(2), m_useDCDBMapping(true), m_recover(false), m_merge(false), m_builder(0),
+      m_putBack(false), m_follow(false), m_followTimeout(0), m_followHandler(0), m_stream(false), m_fileSize(0), m_verified(0), m_recordEnd(0),
+      m_file(0), m_rawData(m_file), m_event(1) {}
+    /** destructor to delete the event builder if files were merged */
+    ~DataReader();
 
-    /** open a list of files and limit the readout to nEvents */
+    /** open a list of files and limit the readout to nEvents. Besides
+     * regular files the list can contain inputs which are read as stream, see
+     * StreamBuffer::open: "-" for stdin, named pipes and "tcp://host:port".
+     * Skipping events in streams reads and discards the data */
     void open(const std::vector<std::string>& filenames, int nEvents = -1);
     /** skip a given number of events from the data file */
     bool skip(int nEvents);
@@ -23,12 +46,50 @@ namespace DEPFET {
     bool next(bool skip = false);
     /** return reference to the event data */
     Event& getEvent() { return m_event; }
+    /** return the current event again on the next call to next() instead of
+     * reading a new one. Allows to look at the first event, e.g. to load the
+     * calibration, without opening the files again, which is not possible
+     * for streams. The event still counts as skipped by skip() */
+    void putBack();
 
     /** set the readout fold, has to be known to configure the binary format
      * interpreter, normally 2 fold (curo readout) or 4fold (dcd readout) */
     void setReadoutFold(int fold) { m_fold = fold; }
     /** configure if DCDB mapping should be used, only relevant for dcd readout */
     void setUseDCDBMapping(bool useDCDBmapping) { m_useDCDBMapping = useDCDBmapping; }
+    /** configure if reading should continue after corrupted data. If
+     * enabled, an invalid record is not an error: the reader searches for the
+     * next position which looks like the start of an event and records the
+     * skipped part of the file */
+    void setRecovery(bool recover) { m_recover = recover; }
+    /** configure if the files given to open() should be read at the same
+     * time and merged by trigger number instead of one after another. Each
+     * file is expected to contain the data of different modules */
+    void setMergeFiles(bool merge) { m_merge = merge; }
+    /** configure if the last file should be followed while it is still
+     * being written. If enabled, reaching a partial record at the end of the
+     * last file is not the end of the data: the reader waits until the
+     * record is complete and continues with it. Reading stops once no new
+     * data arrived for idleTimeout seconds, 0 means waiting forever.
+     * If given, the handler is notified whenever the reader starts waiting */
+    void setFollow(bool follow, double idleTimeout = 0, FollowHandler* handler = 0) {
+      m_follow = follow;
+      m_followTimeout = idleTimeout;
+      m_followHandler = handler;
+    }
+    /** return the event builder used to merge the files, 0 if the files are
+     * read one after another */
+    const EventBuilder* getEventBuilder() const { return m_builder; }
+    /** return the parts of the files skipped because of corrupted data */
+    const std::vector<SkippedRange>& getSkippedRanges() const;
+    /** convert the raw binary data to ADCValues using the configured readout.
+     * Returns the number of words used for the frame */
+    size_t convertData(RawData& rawdata, ADCValues& adcvalues);
+    /** return the time and amount of data spent reading and converting since
+     * the reader was created or the statistics were cleared */
+    const ProcessingStats& getStats() const;
+    /** reset the reading and conversion statistics */
+    void clearStats();
   protected:
     /** actually open the next file */
     bool openFile();
@@ -36,8 +97,13 @@ namespace DEPFET {
     bool readHeader();
     /** read the next event */
     void readEvent(int dataSize);
-    /** convert the raw binary data to ADCValues */
-    size_t convertData(RawData& rawdata, ADCValues& adcvalues);
+    /** check if the header just read is a valid top level record */
+    bool checkHeader(std::streamoff offset);
+    /** continue reading after corrupted data, skipping everything after the last complete event */
+    void resync();
+    /** in follow mode, wait until the record at the current position is
+     * completely written. Returns false if no data arrived in time */
+    bool waitForRecord();
 
     /** current event number */
     int m_eventNumber;
@@ -47,14 +113,48 @@ namespace DEPFET {
     int m_fold;
     /** use dcdb mapping? */
     bool m_useDCDBMapping;
+    /** continue after corrupted data? */
+    bool m_recover;
+    /** merge files by trigger number? */
+    bool m_merge;
+    /** event builder to merge the files, only used if m_merge is set */
+    EventBuilder* m_builder;
+    /** return the current event again on the next call to next()? */
+    bool m_putBack;
+    /** follow the last file while it is written? */
+    bool m_follow;
+    /** time in seconds without new data after which following stops, 0=never */
+    double m_followTimeout;
+    /** handler to notify when waiting for new data */
+    FollowHandler* m_followHandler;
+    /** watcher for the last file in follow mode */
+    FileWatcher m_watcher;
+    /** wether the current file is read as stream which cannot seek */
+    bool m_stream;
+    /** size of the current file */
+    std::streamoff m_fileSize;
+    /** end of the last complete event in the current file. Records after
+     * it are not trusted until the next event is read, as corrupted data
+     * can look like a valid record of another type */
+    std::streamoff m_verified;
+    /** end of the last top level record known to be completely written, only used in follow mode */
+    std::streamoff m_recordEnd;
+    /** parts of the files skipped because of corrupted data */
+    std::vector<SkippedRange> m_skipped;
     /** list of filenames */
     std::vector<std::string> m_filenames;
-    /** currently open file */
-    std::ifstream m_file;
+    /** buffer for regular files */
+    std::filebuf m_fileBuffer;
+    /** buffer for inputs read as stream */
+    StreamBuffer m_streamBuffer;
+    /** currently open file, reading from m_fileBuffer or m_streamBuffer */
+    std::istream m_file;
     /** rawdata structure used for reading the binary blobs */
     RawData m_rawData;
     /** event structure to fill the data in */
     Event m_event;
+    /** reading and conversion statistics */
+    ProcessingStats m_stats;
   };
 }
 
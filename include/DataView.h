@@ -15,6 +15,8 @@ namespace DEPFET {
    */
   template < class VIEWTYPE, class STORAGETYPE = unsigned int > class DataView {
   public:
+    /** Create an empty view without data */
+    DataView(): m_data(0), m_nX(0), m_nY(0) {}
     /** Create a view of a given array.
      * The parameters nX and nY specify the dimensions of the view. If one is
      * zero, the other will be calculated from the size of the array. If both
@@ -47,6 +49,8 @@ namespace DEPFET {
      * @param index index of the element
      */
     const VIEWTYPE& operator[](size_t index) const { return m_data[index]; }
+    /** Check if the view has no data */
+    bool empty() const { return m_data == 0; }
     /** Return the size of the view along X */
     size_t getSizeX() const { return m_nX; }
     /** Return the size of the view along Y */
@@ -0,0 +1,117 @@
+#ifndef DEPFET_EVENTBUILDER_H
+#define DEPFET_EVENTBUILDER_H
+
+#include <DEPFETReader/DataReader.h>
+
+#include <ostream>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Class to merge several files, each containing different modules, into
+   * one stream of events by trigger number.
+   *
+   * All files are read at the same time with one DataReader each. The
+   * trigger numbers in each file are expected to increase, so only the
+   * current event of each file has to be kept in memory and every file is
+   * read sequentially. Each built event contains the frames of all files
+   * which have the smallest pending trigger number. Missing triggers,
+   * duplicate triggers and triggers out of order are counted per file.
+   */
+  class EventBuilder {
+  public:
+    /** Create an event builder
+     * @param fold readout fold, passed to all readers
+     * @param useDCDBMapping wether to use DCDB mapping, passed to all readers
+     * @param recover wether to continue after corrupted data, passed to all readers
+     */
+    EventBuilder(int fold = 2, bool useDCDBMapping = true, bool recover = false):
+      m_fold(fold), m_useDCDBMapping(useDCDBMapping), m_recover(recover), m_follow(false), m_followTimeout(0),
+      m_followHandler(0), m_incomplete(0), m_events(0) {}
+    /** Close all files */
+    ~EventBuilder() { close(); }
+
+    /** Configure follow mode for all readers, see DataReader::setFollow. Has to be called before open() */
+    void setFollow(bool follow, double idleTimeout = 0, FollowHandler* handler = 0) {
+      m_follow = follow;
+      m_followTimeout = idleTimeout;
+      m_followHandler = handler;
+    }
+    /** Open the given files, one stream per file */
+    void open(const std::vector<std::string>& filenames);
+    /** Close all files */
+    void close();
+    /** Build the next event. Returns false if all files are finished */
+    bool next(Event& event);
+
+    /** Return the number of files */
+    size_t getStreams() const { return m_streams.size(); }
+    /** Return the number of events built */
+    uint64_t getEvents() const { return m_events; }
+    /** Return the number of events where at least one file was missing */
+    uint64_t getIncomplete() const { return m_incomplete; }
+    /** Return the number of built events missing in a file */
+    uint64_t getMissing(size_t stream) const { return m_streams[stream].missing; }
+    /** Return the number of events in a file repeating the previous trigger number, these are dropped */
+    uint64_t getDuplicates(size_t stream) const { return m_streams[stream].duplicates; }
+    /** Return the number of events in a file with a smaller trigger number than the previous one, these are dropped */
+    uint64_t getUnordered(size_t stream) const { return m_streams[stream].unordered; }
+    /** Return the reading statistics of all files combined */
+    const ProcessingStats& getStats() const;
+    /** Reset the reading statistics of all files */
+    void clearStats();
+    /** Return the parts of all files skipped because of corrupted data */
+    const std::vector<SkippedRange>& getSkippedRanges() const;
+    /** Print the number of missing, duplicate and unordered triggers per file */
+    void printSummary(std::ostream& output) const;
+
+  protected:
+    /** State of one input file */
+    struct Stream {
+      /** name of the file */
+      std::string filename;
+      /** reader for the file */
+      DataReader* reader;
+      /** wether the file has a pending event */
+      bool active;
+      /** wether an event was read from the file */
+      bool started;
+      /** trigger number of the pending event */
+      unsigned int trigger;
+      /** number of built events without data from this file */
+      uint64_t missing;
+      /** number of dropped events with repeated trigger number */
+      uint64_t duplicates;
+      /** number of dropped events with decreasing trigger number */
+      uint64_t unordered;
+    };
+
+    /** Read the next usable event of one stream */
+    void advance(Stream& stream);
+
+    /** Readout fold */
+    int m_fold;
+    /** Wether DCDB mapping is used */
+    bool m_useDCDBMapping;
+    /** Wether to continue after corrupted data */
+    bool m_recover;
+    /** Wether to follow the files while they are written */
+    bool m_follow;
+    /** Time in seconds without new data after which following stops */
+    double m_followTimeout;
+    /** Handler to notify when a reader waits for new data */
+    FollowHandler* m_followHandler;
+    /** All input streams */
+    std::vector<Stream> m_streams;
+    /** Number of incomplete events */
+    uint64_t m_incomplete;
+    /** Number of built events */
+    uint64_t m_events;
+    /** Combined reading statistics, filled on request */
+    mutable ProcessingStats m_stats;
+    /** Combined skipped ranges, filled on request */
+    mutable std::vector<SkippedRange> m_skipped;
+  };
+
+}
+#endif
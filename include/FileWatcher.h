@@ -0,0 +1,48 @@
+#ifndef DEPFET_FILEWATCHER_H
+#define DEPFET_FILEWATCHER_H
+
+#include <string>
+
+namespace DEPFET {
+
+  /** Class to wait for changes of a file which is still being written.
+   *
+   * Uses inotify if available so the waiting returns as soon as data is
+   * appended. Without inotify, or if a change was missed, wait() returns
+   * after a short polling interval, so the caller always has to check the
+   * file size itself.
+   */
+  class FileWatcher {
+  public:
+    /** Maximal time in seconds to block in one call to wait() */
+    static const double maxWait;
+
+    /** Create a watcher not watching any file */
+    FileWatcher(): m_fd(-1), m_wd(-1) {}
+    /** Stop watching */
+    ~FileWatcher() { close(); }
+
+    /** Start watching the given file, replacing the previous one */
+    void watch(const std::string& filename);
+    /** Stop watching */
+    void close();
+    /** Wait until the watched file was modified or the timeout in seconds
+     * expired, at most maxWait. Returns true if a modification was seen */
+    bool wait(double timeout);
+    /** Return the current size of a file, -1 on error */
+    static long long getFileSize(const std::string& filename);
+
+  private:
+    /** no copying of the inotify descriptor */
+    FileWatcher(const FileWatcher&);
+    /** no assignment of the inotify descriptor */
+    FileWatcher& operator=(const FileWatcher&);
+
+    /** inotify file descriptor, -1 if inotify is not used */
+    int m_fd;
+    /** inotify watch descriptor */
+    int m_wd;
+  };
+
+}
+#endif
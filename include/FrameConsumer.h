@@ -0,0 +1,309 @@
+#ifndef DEPFET_FRAMECONSUMER_H
+#define DEPFET_FRAMECONSUMER_H
+
+#include <DEPFETReader/Event.h>
+#include <DEPFETReader/PartialResult.h>
+#include <DEPFETReader/SharedHitmap.h>
+#include <DEPFETReader/Clusterizer.h>
+#include <DEPFETReader/CommonMode.h>
+
+#include <string>
+#include <fstream>
+#include <map>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Base class for analyses which get pedestal substracted and common mode
+   * corrected frames from a common driver.
+   *
+   * The driver reads and corrects every frame once and passes it to all
+   * registered consumers, so several analyses only need one pass over the
+   * data. A pixel counts as hit if it is not masked and its value is above
+   * sigmaCut times its noise.
+   */
+  class FrameConsumer {
+  public:
+    /** Create a consumer using the given sigma cut for hits */
+    FrameConsumer(double sigmaCut): m_sigmaCut(sigmaCut) {}
+    /** Virtual destructor for derived classes */
+    virtual ~FrameConsumer() {}
+
+    /** Called at the beginning of each event, before its frames */
+    virtual void beginEvent(const Event&) {}
+    /** Called for each corrected frame with the mask and noise of its module */
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise) = 0;
+    /** Called at the end of each event, after its frames */
+    virtual void endEvent(const Event&) {}
+    /** Called after the last event to write the results, throws an Exception on error */
+    virtual void finish() {}
+    /** Called periodically while following data being written to publish
+     * the current results, throws an Exception on error. Does nothing by
+     * default, consumers writing files replace them atomically so they can
+     * be watched while they are updated */
+    virtual void snapshot() {}
+
+  protected:
+    /** Check if a pixel is hit */
+    bool isHit(const ADCValues& data, const MaskView& mask, const ValueView& noise, size_t x, size_t y) const {
+      return !mask(x, y) && data(x, y) > m_sigmaCut * noise(x, y);
+    }
+
+    /** Sigma cut for hits */
+    double m_sigmaCut;
+  };
+
+  /** Consumer summing the signal of all hits per pixel, writing the same
+   * format as depfetHitmap. One hitmap is kept per module, a %1% in the
+   * filename is replaced by the module number */
+  class HitmapConsumer: public FrameConsumer {
+  public:
+    /** Create a hitmap consumer writing to filename, optionally also writing a partial result for depfetMerge */
+    HitmapConsumer(const std::string& filename, double sigmaCut, const std::string& partialFilename = ""):
+      FrameConsumer(sigmaCut), m_filename(filename), m_partialFilename(partialFilename), m_events(0) {}
+
+    virtual void endEvent(const Event&) { ++m_events; }
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish();
+    virtual void snapshot();
+
+  protected:
+    /** Write the hitmap of one module */
+    void write(int moduleNr, const PartialHitmap& hitmap) const;
+
+    /** output filename */
+    std::string m_filename;
+    /** filename of the partial result */
+    std::string m_partialFilename;
+    /** number of events */
+    uint64_t m_events;
+    /** hitmap per module */
+    std::map<int, PartialHitmap> m_hitmaps;
+  };
+
+  /** Consumer writing all frames as text in the same format as depfetDump */
+  class DumpConsumer: public FrameConsumer {
+  public:
+    /** Create a dump consumer writing to filename */
+    DumpConsumer(const std::string& filename, double sigmaCut);
+
+    virtual void beginEvent(const Event& event);
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void endEvent(const Event& event);
+    virtual void finish();
+
+  protected:
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+  };
+
+  /** Consumer writing only the hit pixels, one "event module frame column row signal" line per hit */
+  class HitListConsumer: public FrameConsumer {
+  public:
+    /** Create a hit list consumer writing to filename */
+    HitListConsumer(const std::string& filename, double sigmaCut);
+
+    virtual void beginEvent(const Event& event) { m_eventNumber = event.getEventNumber(); }
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish();
+
+  protected:
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+    /** trigger number of the current event */
+    int m_eventNumber;
+  };
+
+  /** Consumer counting how often each pixel is hit. Writes per module the
+   * number of frames, the mean number of hits per frame and the fraction of
+   * frames in which each pixel was hit */
+  class OccupancyConsumer: public FrameConsumer {
+  public:
+    /** Create an occupancy consumer writing to filename */
+    OccupancyConsumer(const std::string& filename, double sigmaCut): FrameConsumer(sigmaCut), m_filename(filename) {}
+
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish() { write(); }
+    virtual void snapshot() { write(); }
+
+  protected:
+    /** Write the occupancy of all modules */
+    void write() const;
+
+    /** Hit counts of one module */
+    struct Occupancy {
+      /** default constructor */
+      Occupancy(): frames(0), maxHits(0) {}
+      /** number of frames */
+      uint64_t frames;
+      /** largest number of hits in one frame */
+      uint64_t maxHits;
+      /** number of hits per pixel */
+      ValueMatrix<uint64_t> hits;
+    };
+
+    /** output filename */
+    std::string m_filename;
+    /** hit counts per module */
+    std::map<int, Occupancy> m_occupancy;
+  };
+
+  /** Consumer publishing the hitmap and hit statistics of each module in
+   * shared memory, see SharedHitmap. The segments are updated with every
+   * snapshot and at the end, a %1% in the name is replaced by the module
+   * number */
+  class SharedHitmapConsumer: public FrameConsumer {
+  public:
+    /** Create a consumer publishing to the shared memory segment name */
+    SharedHitmapConsumer(const std::string& name, double sigmaCut): FrameConsumer(sigmaCut), m_name(name), m_events(0) {}
+    /** Unmap all segments */
+    virtual ~SharedHitmapConsumer();
+
+    virtual void endEvent(const Event&) { ++m_events; }
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish() { snapshot(); }
+    virtual void snapshot();
+
+  protected:
+    /** Hitmap and shared memory of one module */
+    struct Module {
+      /** default constructor */
+      Module(): shared(0) {}
+      /** summed signal per pixel */
+      ValueMatrix<double> sums;
+      /** pixel mask */
+      PixelMask mask;
+      /** hit statistics */
+      HitmapSummary summary;
+      /** shared memory segment, owned by the consumer */
+      SharedHitmap* shared;
+    };
+
+    /** name of the shared memory segments */
+    std::string m_name;
+    /** number of events */
+    uint64_t m_events;
+    /** hitmap per module */
+    std::map<int, Module> m_modules;
+  };
+
+  /** Consumer finding clusters of neighbouring hits in each frame and
+   * writing them as compact binary records.
+   *
+   * The file starts with the 8 bytes "DEPFETCL", followed by the version and
+   * the size of one record as 32bit integers. Then follows one Record per
+   * cluster, so the file can be read with numpy.fromfile using a
+   * structured dtype.
+   */
+  class ClusterConsumer: public FrameConsumer {
+  public:
+    /** Record written for each cluster */
+    struct Record {
+      /** trigger number of the event */
+      uint32_t event;
+      /** module number */
+      uint16_t module;
+      /** frame number in the event */
+      uint16_t frame;
+      /** sum of the signal */
+      float charge;
+      /** largest signal of one pixel */
+      float seed;
+      /** signal weighted mean column */
+      float col;
+      /** signal weighted mean row */
+      float row;
+      /** number of pixels */
+      uint32_t size;
+    };
+    /** Version of the file format */
+    enum { VERSION = 1 };
+
+    /** Create a cluster consumer writing to filename */
+    ClusterConsumer(const std::string& filename, double sigmaCut);
+
+    virtual void beginEvent(const Event& event) { m_eventNumber = event.getEventNumber(); }
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish();
+    /** Return the number of clusters written */
+    uint64_t getClusters() const { return m_clusters; }
+
+  protected:
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+    /** cluster finder */
+    Clusterizer m_clusterizer;
+    /** trigger number of the current event */
+    int m_eventNumber;
+    /** number of clusters written */
+    uint64_t m_clusters;
+  };
+
+  /** Consumer writing a small data quality summary for each frame so bad
+   * frames can be found and vetoed without reading the raw data again.
+   *
+   * The file starts with the 8 bytes "DEPFETDQ", followed by the version and
+   * the size of one record as 32bit integers. Then follows one Record per
+   * frame. Mean, RMS and occupancy are calculated from the unmasked pixels
+   * of the corrected frame, the common mode range is taken from the common
+   * mode correction applied to the frame.
+   */
+  class FrameSummaryConsumer: public FrameConsumer {
+  public:
+    /** Record written for each frame */
+    struct Record {
+      /** trigger number of the event */
+      uint32_t event;
+      /** module number */
+      uint16_t module;
+      /** frame number in the event */
+      uint16_t frame;
+      /** start gate of the readout */
+      int32_t startGate;
+      /** module temperature in degree celsius */
+      float temperature;
+      /** mean value of the unmasked pixels */
+      float mean;
+      /** RMS of the unmasked pixels around the mean */
+      float rms;
+      /** fraction of unmasked pixels which are hit */
+      float occupancy;
+      /** smallest row or column wise common mode correction */
+      float minCommonMode;
+      /** largest row or column wise common mode correction */
+      float maxCommonMode;
+    };
+    /** Version of the file format */
+    enum { VERSION = 1 };
+
+    /** Create a summary consumer writing to filename. The common mode
+     * corrections are taken from commonMode which must have been applied to
+     * each frame before it is passed to processFrame */
+    FrameSummaryConsumer(const std::string& filename, double sigmaCut, const CommonMode* commonMode);
+
+    virtual void beginEvent(const Event& event) { m_eventNumber = event.getEventNumber(); }
+    virtual void processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise);
+    virtual void finish();
+    virtual void snapshot() { m_output.flush(); }
+
+  protected:
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+    /** common mode correction applied to the frames */
+    const CommonMode* m_commonMode;
+    /** row and column wise corrections of the current frame */
+    std::vector<double> m_corrections;
+    /** trigger number of the current event */
+    int m_eventNumber;
+  };
+
+}
+#endif
@@ -0,0 +1,81 @@
+#ifndef DEPFET_FRAMEIMAGE_H
+#define DEPFET_FRAMEIMAGE_H
+
+#include <DEPFETReader/ADCValues.h>
+
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Write values as binary 8bit PGM image with one pixel per value.
+   * Columns go from left to right and rows from bottom to top. Values are
+   * scaled linearly from 0 to maxValue, or to the largest value if
+   * maxValue is not positive. Masked and negative values are black.
+   * Throws an Exception on error */
+  void writePGM(const std::string& filename, const ValueMatrix<double>& values, const MaskView& mask, double maxValue = 0);
+
+  /** Class to write a sequence of images, e.g. hitmaps of consecutive
+   * slices of events, to one binary file.
+   *
+   * The file starts with a Header, followed by one record per image: a
+   * RecordHeader with the first event and number of events of the image,
+   * then sizeX*sizeY floats stored column after column like ValueMatrix.
+   * Masked pixels are -1. All records have the same size, so the file can
+   * be read with numpy.memmap using a structured dtype.
+   */
+  class FrameStack {
+  public:
+    /** Header at the beginning of the file */
+    struct Header {
+      /** magic bytes "DEPFETFS" */
+      char magic[8];
+      /** version of the format */
+      uint32_t version;
+      /** number of columns */
+      uint32_t sizeX;
+      /** number of rows */
+      uint32_t sizeY;
+      /** unused, keeps the records aligned */
+      uint32_t padding;
+    };
+    /** Header of each image */
+    struct RecordHeader {
+      /** index of the first event of the image */
+      uint64_t firstEvent;
+      /** number of events summed in the image */
+      uint32_t events;
+      /** unused, keeps the data aligned */
+      uint32_t padding;
+    };
+    /** Version of the format */
+    enum { VERSION = 1 };
+
+    /** Create a stack without file */
+    FrameStack(): m_images(0) {}
+
+    /** Create the file for images of the given size, throws an Exception on error */
+    void open(const std::string& filename, size_t sizeX, size_t sizeY);
+    /** Append one image, throws an Exception on error */
+    void write(const ValueMatrix<double>& values, const MaskView& mask, uint64_t firstEvent, uint32_t events);
+    /** Close the file, throws an Exception if writing failed */
+    void close();
+    /** Return the number of images written */
+    uint64_t getImages() const { return m_images; }
+
+  protected:
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+    /** header of the file */
+    Header m_header;
+    /** number of images written */
+    uint64_t m_images;
+    /** buffer for the values of one image */
+    std::vector<float> m_buffer;
+  };
+
+}
+#endif
@@ -0,0 +1,173 @@
+#ifndef DEPFET_HEADERSCANNER_H
+#define DEPFET_HEADERSCANNER_H
+
+#include <DEPFETReader/RawData.h>
+
+#include <string>
+#include <istream>
+#include <vector>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Header information of one module record inside an event */
+  struct ModuleHeader {
+    /** module number */
+    int moduleNr;
+    /** device type of the module */
+    int deviceType;
+    /** start gate of the readout */
+    int startGate;
+    /** temperature in degree celsius */
+    float temperature;
+    /** number of frames in the record, including trailing frames */
+    int frames;
+    /** size of the record in bytes including header */
+    uint32_t size;
+  };
+
+  /** A part of a file which was skipped because it did not contain valid records */
+  struct SkippedRange {
+    /** name of the file */
+    std::string filename;
+    /** offset of the first skipped byte */
+    uint64_t offset;
+    /** number of skipped bytes */
+    uint64_t size;
+  };
+
+  /** Class to walk through a binary DEPFET file reading only the record headers.
+   *
+   * The pixel data is never read: the file is accessed with positioned
+   * reads of single pages at the header positions and the kernel is told
+   * not to read ahead, so only a small fraction of a file with large
+   * frames has to be read from disk.
+   *
+   * If recovery is enabled, scanning continues after an invalid record at
+   * the next position which looks like the start of an event and the
+   * skipped part of the file is recorded.
+   */
+  class HeaderScanner {
+  public:
+    /** Create a scanner without open file */
+    HeaderScanner();
+    /** Close the file on destruction */
+    ~HeaderScanner() { close(); }
+
+    /** Open a file for scanning */
+    void open(const std::string& filename);
+    /** Close the file */
+    void close();
+    /** Enable or disable continuing after invalid records */
+    void setRecovery(bool recover) { m_recover = recover; }
+    /** Advance to the next data event.
+     * Returns false at the end of the file or, unless recovery is enabled,
+     * at the first record which is incomplete or does not look valid */
+    bool next();
+
+    /** Return the file offset of the current event in bytes */
+    uint64_t getOffset() const { return m_offset; }
+    /** Return the size of the current event in bytes */
+    uint32_t getEventSize() const { return m_eventSize; }
+    /** Return the trigger number of the current event */
+    unsigned int getTriggerNr() const { return m_triggerNr; }
+    /** Return the run number of the last run header, -1 if none was found */
+    int getRunNumber() const { return m_runNumber; }
+    /** Return the module records of the current event */
+    const std::vector<ModuleHeader>& getModules() const { return m_modules; }
+
+    /** Return the size of the file in bytes */
+    uint64_t getFileSize() const { return m_fileSize; }
+    /** Return the offset up to which the file was scanned */
+    uint64_t getPosition() const { return m_position; }
+    /** Return true if scanning stopped at an incomplete or invalid record without recovery */
+    bool isDamaged() const { return m_damaged; }
+    /** Return the number of run begin records found so far */
+    int getRunBegins() const { return m_runBegins; }
+    /** Return the number of run end records found so far */
+    int getRunEnds() const { return m_runEnds; }
+    /** Return the number of records which were neither events nor run headers */
+    int getOtherRecords() const { return m_otherRecords; }
+    /** Return the number of bytes actually read from the file */
+    uint64_t getBytesRead() const { return m_bytesRead; }
+    /** Return the parts of the file skipped during recovery */
+    const std::vector<SkippedRange>& getSkippedRanges() const { return m_skipped; }
+
+    /** Return the size of one frame in units of RawData::value_type for a
+     * device type, 0 if unknown */
+    static size_t getFrameWords(int deviceType);
+    /** Return true if the device type is one of the known types */
+    static bool isKnownDeviceType(int deviceType);
+    /** Return true if the module record header is consistent with its device type */
+    static bool isValidModule(const RawData::Header& module);
+    /** Return true if a group header and the following module header look like the start of an event */
+    static bool isPlausibleEvent(const RawData::Header& group, const RawData::Header& module);
+    /** Search a buffer for the first position which looks like the start
+     * of an event. Returns size if there is none */
+    static size_t findEvent(const char* data, size_t size);
+    /** Search a stream for the next position, starting at the current
+     * position, which looks like the start of an event.
+     * Returns the number of bytes until that position or until the end of
+     * the stream and leaves the stream positioned there */
+    static uint64_t findEvent(std::istream& stream);
+
+  protected:
+    /** Result of reading one top level record */
+    enum RecordType { EVENT, OTHER, END, INVALID };
+    /** Read the record at the current position */
+    RecordType readRecord();
+    /** Continue after an invalid record, skipping everything after the
+     * last complete event. Returns false if no further event was found */
+    bool resync();
+    /** Read size bytes at offset, returns false if beyond the end of the file */
+    bool read(uint64_t offset, void* buffer, size_t size);
+    /** Read a header at offset and check it for consistency */
+    bool readHeader(uint64_t offset, RawData::Header& header);
+
+    /** File descriptor */
+    int m_fd;
+    /** File name */
+    std::string m_filename;
+    /** File size in bytes */
+    uint64_t m_fileSize;
+    /** Offset of the next record */
+    uint64_t m_position;
+    /** Copy of the page at m_pageOffset */
+    std::vector<char> m_page;
+    /** Offset of the buffered page */
+    uint64_t m_pageOffset;
+    /** Number of valid bytes in the buffered page */
+    size_t m_pageSize;
+    /** Number of bytes read from the file */
+    uint64_t m_bytesRead;
+
+    /** Offset of the current event */
+    uint64_t m_offset;
+    /** Size of the current event in bytes */
+    uint32_t m_eventSize;
+    /** Trigger number of the current event */
+    unsigned int m_triggerNr;
+    /** Last run number */
+    int m_runNumber;
+    /** Module records of the current event */
+    std::vector<ModuleHeader> m_modules;
+    /** Wether an invalid record was found */
+    bool m_damaged;
+    /** Number of run begin records */
+    int m_runBegins;
+    /** Number of run end records */
+    int m_runEnds;
+    /** Number of other records */
+    int m_otherRecords;
+    /** Wether to continue after invalid records */
+    bool m_recover;
+    /** End of the last complete event. Records after it are not trusted
+     * until the next event is found, as corrupted data can look like a
+     * valid record of another type */
+    uint64_t m_verified;
+    /** Skipped parts of the file */
+    std::vector<SkippedRange> m_skipped;
+  };
+
+}
+#endif
@@ -0,0 +1,98 @@
+#ifndef DEPFET_HOTPIXELTRACKER_H
+#define DEPFET_HOTPIXELTRACKER_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <DEPFETReader/ADCValues.h>
+
+namespace DEPFET {
+
+  /** Class to find and mask hot pixels during a run.
+   *
+   * Counts for each pixel how often it is above cutvalue*noise in a
+   * pedestal substracted and common mode corrected frame. Every window
+   * frames the counts are compared to the median count of all unmasked
+   * pixels: pixels which fired more than threshold times the median, but
+   * at least threshold times, are hot. They are set in the mask given with
+   * setMask, so everything using the same mask, like CommonMode, ignores
+   * them from then on. The counts are reset after each window.
+   *
+   * The resulting mask can be written in the format of the mask files read
+   * by depfetCalibration to be used for later runs.
+   */
+  class HotPixelTracker {
+  public:
+    /** Constructor
+     * @param window number of frames to count hits before checking for hot pixels
+     * @param threshold factor above the median hit count for a pixel to be hot
+     */
+    HotPixelTracker(int window = 1000, double threshold = 20):
+      m_window(window), m_threshold(threshold), m_frames(0), m_mask(0), m_cutvalue(0) {}
+
+    /** Set the mask to be updated. Pixels which are already masked are not counted */
+    void setMask(PixelMask* mask) {
+      m_mask = mask;
+    }
+    /** Set noise map and the cut value. All pixels which are more than cutvalue*noise are hit */
+    void setNoise(double cutvalue, const ValueView& noise) {
+      m_cutvalue = cutvalue;
+      m_noise = noise;
+    }
+    /** Count the hits of a pedestal substracted and common mode corrected
+     * frame and mask hot pixels if the window is complete.
+     * @return number of pixels masked by this call
+     */
+    int add(const ADCValues& data);
+    /** Return the column and row of all pixels masked so far */
+    const std::vector<std::pair<int, int> >& getHotPixels() const { return m_hotPixels; }
+    /** Write all pixels masked in the mask, static and hot ones, as mask file.
+     * Throws an Exception on error */
+    void write(const std::string& filename) const;
+    /** Discard all collected counts */
+    void clear() {
+      m_frames = 0;
+      m_hits.assign(m_hits.size(), 0);
+    }
+  protected:
+    /** Compare the counts to the median and mask hot pixels */
+    int update(size_t sizeY);
+
+    /** Number of frames in one window */
+    int m_window;
+    /** Factor above the median for hot pixels */
+    double m_threshold;
+    /** Number of frames counted in the current window */
+    int m_frames;
+    /** Number of hits of each pixel in the current window */
+    std::vector<int> m_hits;
+    /** Pixels masked so far */
+    std::vector<std::pair<int, int> > m_hotPixels;
+    /** Mask to update */
+    PixelMask* m_mask;
+    /** Matrix containing the pixel noise */
+    ValueView m_noise;
+    /** Cut value to find hits */
+    double m_cutvalue;
+  };
+
+  inline int HotPixelTracker::add(const ADCValues& data)
+  {
+    if (!m_mask || m_noise.empty()) {
+      throw std::runtime_error("HotPixelTracker needs a mask and noise");
+    }
+    const size_t size = data.getSize();
+    if (m_hits.size() != size) {
+      m_hits.assign(size, 0);
+      m_frames = 0;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      if (data[i] > m_cutvalue * m_noise[i] && (*m_mask)[i] == 0) ++m_hits[i];
+    }
+    if (++m_frames < m_window) return 0;
+    return update(data.getSizeY());
+  }
+
+}
+#endif
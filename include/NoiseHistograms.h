@@ -0,0 +1,81 @@
+#ifndef DEPFET_NOISEHISTOGRAMS_H
+#define DEPFET_NOISEHISTOGRAMS_H
+
+#include <DEPFETReader/ADCValues.h>
+#include <DEPFETReader/PixelAccumulator.h>
+
+#include <vector>
+#include <istream>
+#include <ostream>
+
+namespace DEPFET {
+
+  /** Class to collect a histogram of the corrected signals of every pixel
+   * and to determine the noise from it.
+   *
+   * Each pixel has BINS bins covering a fixed range of plus minus the sigma
+   * cut around zero, taken from the pedestals of the second pass. Because the
+   * range does not depend on the values filled, the histograms of several
+   * jobs can be combined with merge() and give the same noise as one job
+   * reading all data.
+   *
+   * The noise is the sigma of a Gaussian fitted to the central bins of the
+   * histogram which contain the given fraction of the entries. This is the
+   * estimator used by depfetCalibration and depfetMerge.
+   */
+  class NoiseHistograms {
+  public:
+    /** Number of bins per pixel */
+    enum { BINS = 80 };
+
+    /** Create empty histograms */
+    NoiseHistograms(): m_sizeX(0), m_sizeY(0) {}
+
+    /** Set the size and the range of every pixel to plus minus sigmaCut
+     * times the sigma of the pedestals. Pixels without a valid sigma get a
+     * range of plus minus one. All entries are cleared */
+    void setRange(const PixelAccumulator& pedestals, double sigmaCut);
+    /** Add one value to the histogram of a pixel, values outside of the range are ignored */
+    void fill(size_t x, size_t y, double value);
+    /** Add all entries of other histograms of the same size. If the range of
+     * a pixel differs, the bins of both are redistributed onto the wider range */
+    void merge(const NoiseHistograms& other);
+    /** Write the complete state to a binary stream */
+    void write(std::ostream& output) const;
+    /** Restore the complete state from a binary stream written by write() */
+    void read(std::istream& input);
+
+    /** Return the number of columns */
+    size_t getSizeX() const { return m_sizeX; }
+    /** Return the number of rows */
+    size_t getSizeY() const { return m_sizeY; }
+    /** Return true if no size was set */
+    bool operator!() const { return m_width.empty(); }
+    /** Return the half width of the range of a pixel */
+    double getWidth(size_t x, size_t y) const { return m_width[x * m_sizeY + y]; }
+    /** Return the number of entries of a pixel */
+    double getEntries(size_t x, size_t y) const;
+
+    /** Return the noise of a pixel: restrict the histogram to the bins around
+     * the mean containing fraction of the entries and fit a Gaussian to them.
+     * Returns 0 if there are not enough entries. If chi2 and ndf are given,
+     * they are set to the chi2 and degrees of freedom of the fit */
+    double getNoise(size_t x, size_t y, double fraction = 0.9, double* chi2 = 0, int* ndf = 0) const;
+
+  protected:
+    /** Add the bins of a histogram with the given half width to bins with a
+     * different half width, distributing the content by overlap */
+    static void rebin(const double* from, double fromWidth, double* to, double toWidth);
+
+    /** number of columns */
+    size_t m_sizeX;
+    /** number of rows */
+    size_t m_sizeY;
+    /** half width of the range of each pixel */
+    std::vector<double> m_width;
+    /** bin contents, BINS consecutive values per pixel */
+    std::vector<double> m_bins;
+  };
+
+}
+#endif
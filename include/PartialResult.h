@@ -0,0 +1,85 @@
+#ifndef DEPFET_PARTIALRESULT_H
+#define DEPFET_PARTIALRESULT_H
+
+#include <DEPFETReader/ADCValues.h>
+#include <DEPFETReader/PixelAccumulator.h>
+#include <DEPFETReader/NoiseHistograms.h>
+
+#include <string>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Intermediate state of a hitmap which can be merged with the hitmaps of other jobs */
+  struct PartialHitmap {
+    /** default constructor */
+    PartialHitmap(): events(0), frames(0) {}
+    /** Add the sums and counts of another partial hitmap of the same size, masks are combined */
+    void merge(const PartialHitmap& other);
+
+    /** number of events */
+    uint64_t events;
+    /** number of frames */
+    uint64_t frames;
+    /** masked pixels */
+    PixelMask mask;
+    /** sum of the signals above the cut per pixel */
+    ValueMatrix<double> sums;
+  };
+
+  /** Intermediate state of a calibration which can be merged with the calibrations of other jobs */
+  struct PartialCalibration {
+    /** default constructor */
+    PartialCalibration(): moduleNr(0), events(0) {}
+    /** Add the accumulators, histograms and counts of another partial calibration of the same module, masks are combined */
+    void merge(const PartialCalibration& other);
+
+    /** module number */
+    int moduleNr;
+    /** number of events */
+    uint64_t events;
+    /** masked pixels */
+    PixelMask mask;
+    /** raw values inside the sigma cut, giving the pedestals */
+    PixelAccumulator pedestals;
+    /** histograms of the pedestal and common mode corrected values inside the sigma cut, giving the noise */
+    NoiseHistograms noise;
+  };
+
+  /** Class to read and write binary files with partial results.
+   *
+   * The file starts with a FileHeader containing the type of the result,
+   * followed by the counters and the per pixel data of the result. All
+   * values are stored in native byte order.
+   */
+  class PartialResult {
+  public:
+    /** Current version of the file format */
+    enum { VERSION = 2 };
+    /** Type of the stored result */
+    enum Type { UNKNOWN = 0, HITMAP = 1, CALIBRATION = 2 };
+
+    /** Header at the beginning of the file */
+    struct FileHeader {
+      /** magic bytes to identify the file */
+      char magic[8];
+      /** version of the file format */
+      uint32_t version;
+      /** type of the stored result */
+      uint32_t type;
+    };
+
+    /** Return the type of result stored in a file, UNKNOWN if it is no partial result file */
+    static Type getType(const std::string& filename);
+    /** Write a partial hitmap, throws an Exception on error */
+    static void write(const std::string& filename, const PartialHitmap& hitmap);
+    /** Write a partial calibration, throws an Exception on error */
+    static void write(const std::string& filename, const PartialCalibration& calibration);
+    /** Read a partial hitmap, throws an Exception on error */
+    static void read(const std::string& filename, PartialHitmap& hitmap);
+    /** Read a partial calibration, throws an Exception on error */
+    static void read(const std::string& filename, PartialCalibration& calibration);
+  };
+
+}
+#endif
@@ -0,0 +1,109 @@
+#ifndef DEPFET_PEDESTALTRACKER_H
+#define DEPFET_PEDESTALTRACKER_H
+
+#include <vector>
+#include <cmath>
+
+#include <DEPFETReader/ADCValues.h>
+
+namespace DEPFET {
+
+  /** Class to follow slow pedestal drifts during a run.
+   *
+   * After pedestal substraction and common mode correction, the value of a
+   * signal free pixel is the shift of its pedestal since the calibration
+   * was taken. This class collects these residuals for all pixels which are
+   * below cutvalue*noise and every interval frames moves the pedestals by
+   * the mean residual of each pixel, scaled with a weight to damp the
+   * statistical fluctuation of the update.
+   *
+   * In contrast to AdaptivePedestal no history is kept: only a sum and an
+   * entry count per pixel, so tracking costs two additions per pixel and frame.
+   */
+  class PedestalTracker {
+  public:
+    /** Constructor
+     * @param interval number of frames to collect before updating the pedestals
+     * @param weight fraction of the mean residual applied on each update
+     */
+    PedestalTracker(int interval = 100, double weight = 0.5):
+      m_interval(interval), m_weight(weight), m_frames(0), m_updates(0),
+      m_cutvalue(0) {}
+
+    /** Set the mask to be used. All pixels which have a nonzero value in mask will be ignored */
+    void setMask(const MaskView& mask) {
+      m_mask = mask;
+    }
+    /** Set noise map and the cut value. All pixels which are more than
+     * cutvalue*noise away from 0 are considered to contain signal and are ignored */
+    void setNoise(double cutvalue, const ValueView& noise) {
+      m_cutvalue = cutvalue;
+      m_noise = noise;
+    }
+    /** Add the residuals of a pedestal substracted and common mode corrected
+     * frame and update the pedestals if enough frames have been collected.
+     * @return true if the pedestals were updated
+     */
+    bool add(const ADCValues& data, ValueMatrix<double>& pedestals);
+    /** Return the number of pedestal updates done so far */
+    int getUpdates() const { return m_updates; }
+    /** Discard all collected residuals */
+    void clear() {
+      m_frames = 0;
+      m_sum.assign(m_sum.size(), 0);
+      m_entries.assign(m_entries.size(), 0);
+    }
+  protected:
+    /** Number of frames between pedestal updates */
+    int m_interval;
+    /** Fraction of the mean residual applied to the pedestals */
+    double m_weight;
+    /** Number of frames collected since the last update */
+    int m_frames;
+    /** Number of updates performed */
+    int m_updates;
+    /** Sum of residuals for each pixel */
+    std::vector<double> m_sum;
+    /** Number of residuals collected for each pixel */
+    std::vector<int> m_entries;
+    /** Matrix containing masked pixels */
+    MaskView m_mask;
+    /** Matrix containing the pixel noise */
+    ValueView m_noise;
+    /** Cut value to separate signal from signal free pixels */
+    double m_cutvalue;
+  };
+
+  inline bool PedestalTracker::add(const ADCValues& data, ValueMatrix<double>& pedestals)
+  {
+    if (pedestals.getSizeX() != data.getSizeX() || pedestals.getSizeY() != data.getSizeY()) {
+      throw std::runtime_error("Dimensions do not match");
+    }
+    const size_t size = data.getSize();
+    if (m_sum.size() != size) {
+      m_sum.assign(size, 0);
+      m_entries.assign(size, 0);
+      m_frames = 0;
+    }
+
+    //Collect residuals of all signal free pixels
+    for (size_t i = 0; i < size; ++i) {
+      if (!m_mask.empty() && m_mask[i] != 0) continue;
+      const double residual = data[i];
+      if (!m_noise.empty() && std::fabs(residual) > m_cutvalue * m_noise[i]) continue;
+      m_sum[i] += residual;
+      ++m_entries[i];
+    }
+    if (++m_frames < m_interval) return false;
+
+    //Move pedestals by the mean residual
+    for (size_t i = 0; i < size; ++i) {
+      if (m_entries[i] > 0) pedestals[i] += m_weight * m_sum[i] / m_entries[i];
+    }
+    clear();
+    ++m_updates;
+    return true;
+  }
+
+}
+#endif
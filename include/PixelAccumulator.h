@@ -0,0 +1,294 @@
+#ifndef DEPFET_PIXELACCUMULATOR_H
+#define DEPFET_PIXELACCUMULATOR_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <DEPFETReader/ADCValues.h>
+
+namespace DEPFET {
+
+  /** Class to calculate mean and sigma for all pixels of a frame at once.
+   *
+   * In contrast to a ValueMatrix<IncrementalMean> the statistics are kept as
+   * separate arrays for entries, sum and sum of squares (structure of arrays)
+   * and are updated without any division or branch, two pixels at a time
+   * using SSE2 where available. To keep the sum of squares
+   * numerically stable all values are accumulated relative to a per pixel
+   * shift which is taken from the first frame or from the reference given
+   * for a sigma cut.
+   *
+   * Each pixel only accepts values inside a window around the shift. By
+   * default the window is unlimited, setMask() closes it for masked pixels
+   * and setCut() restricts it to a number of sigmas of a previous result.
+   *
+   * Two accumulators can be combined with merge(), so partial results
+   * obtained by several threads or processes can be joined afterwards. The
+   * complete state can be stored with write() and restored with read().
+   */
+  class PixelAccumulator {
+  public:
+    /** Construct an empty accumulator with no elements and zero size */
+    PixelAccumulator(): m_sizeX(0), m_sizeY(0), m_hasShift(false) {}
+    /** Construct an accumulator with a given size */
+    PixelAccumulator(size_t sizeX, size_t sizeY): m_sizeX(0), m_sizeY(0), m_hasShift(false) {
+      setSize(sizeX, sizeY);
+    }
+
+    /** resize the accumulator to the given dimensions, removing all entries, masks and cuts */
+    void setSize(size_t sizeX, size_t sizeY);
+    /** resize the accumulator to match the size of a matrix */
+    template<class T> void setSize(const ValueMatrix<T>& other) { setSize(other.getSizeX(), other.getSizeY()); }
+    /** remove all entries but keep masks and cuts */
+    void clear();
+
+    /** get size in x */
+    size_t getSizeX() const { return m_sizeX; }
+    /** get size in y */
+    size_t getSizeY() const { return m_sizeY; }
+    /** get total number of pixels */
+    size_t getSize() const { return m_entries.size(); }
+    /** check if the accumulator has a nonzero size */
+    bool operator!() const { return m_entries.empty(); }
+
+    /** Ignore all pixels which have a nonzero value in mask */
+    void setMask(const PixelMask& mask);
+    /** Only accept values within sigmaCut times the sigma around the mean of
+     * a reference result. Pixels without entries in the reference accept all values */
+    void setCut(const PixelAccumulator& reference, double sigmaCut);
+
+    /** Add one frame of values */
+    void add(const ValueMatrix<double>& data);
+    /** Add all entries of another accumulator of the same size */
+    void merge(const PixelAccumulator& other);
+    /** Write the complete state to a binary stream */
+    void write(std::ostream& output) const;
+    /** Restore the complete state from a binary stream written by write() */
+    void read(std::istream& input);
+
+    /** return the number of entries for a given pixel */
+    double getEntries(size_t x, size_t y) const { return getEntries(x * m_sizeY + y); }
+    /** return the mean for a given pixel */
+    double getMean(size_t x, size_t y) const { return getMean(x * m_sizeY + y); }
+    /** return the sigma for a given pixel */
+    double getSigma(size_t x, size_t y) const { return getSigma(x * m_sizeY + y); }
+    /** return the number of entries for an element of the flat array */
+    double getEntries(size_t index) const { return m_entries[index]; }
+    /** return the mean for an element of the flat array, 0 if there are no entries */
+    double getMean(size_t index) const {
+      if (m_entries[index] <= 0) return 0;
+      return m_shift[index] + m_sum[index] / m_entries[index];
+    }
+    /** return the sigma for an element of the flat array */
+    double getSigma(size_t index) const {
+      const double mean = m_sum[index] / m_entries[index];
+      return std::sqrt(std::max(0.0, m_sumSq[index] / m_entries[index] - mean * mean));
+    }
+    /** return the fraction of unmasked pixels whose mean is known better
+     * than meanPrecision and whose sigma is known better than the relative
+     * precision sigmaPrecision, estimated from the standard errors
+     * sigma/sqrt(n) and 1/sqrt(2(n-1)). A precision of 0 is not checked */
+    double getConvergedFraction(double meanPrecision, double sigmaPrecision) const;
+    /** fill a matrix with the mean of all pixels */
+    template<class T> void getMeans(ValueMatrix<T>& means) const {
+      means.setSize(m_sizeX, m_sizeY);
+      for (size_t i = 0; i < getSize(); ++i) means[i] = getMean(i);
+    }
+    /** fill a matrix with the sigma of all pixels */
+    template<class T> void getSigmas(ValueMatrix<T>& sigmas) const {
+      sigmas.setSize(m_sizeX, m_sizeY);
+      for (size_t i = 0; i < getSize(); ++i) sigmas[i] = getSigma(i);
+    }
+
+  protected:
+    /** size in X */
+    size_t m_sizeX;
+    /** size in Y */
+    size_t m_sizeY;
+    /** flag whether the shift has been set */
+    bool m_hasShift;
+    /** number of entries per pixel */
+    std::vector<double> m_entries;
+    /** sum of (value-shift) per pixel */
+    std::vector<double> m_sum;
+    /** sum of (value-shift)^2 per pixel */
+    std::vector<double> m_sumSq;
+    /** shift per pixel */
+    std::vector<double> m_shift;
+    /** lower limit of accepted (value-shift) per pixel */
+    std::vector<double> m_lower;
+    /** upper limit of accepted (value-shift) per pixel */
+    std::vector<double> m_upper;
+  };
+
+  inline void PixelAccumulator::setSize(size_t sizeX, size_t sizeY)
+  {
+    const size_t size = sizeX * sizeY;
+    m_sizeX = sizeX;
+    m_sizeY = sizeY;
+    m_hasShift = false;
+    m_shift.assign(size, 0);
+    m_lower.assign(size, -std::numeric_limits<double>::infinity());
+    m_upper.assign(size, std::numeric_limits<double>::infinity());
+    m_entries.assign(size, 0);
+    m_sum.assign(size, 0);
+    m_sumSq.assign(size, 0);
+  }
+
+  inline void PixelAccumulator::clear()
+  {
+    m_entries.assign(m_entries.size(), 0);
+    m_sum.assign(m_sum.size(), 0);
+    m_sumSq.assign(m_sumSq.size(), 0);
+  }
+
+  inline void PixelAccumulator::setMask(const PixelMask& mask)
+  {
+    if (mask.getSizeX() != m_sizeX || mask.getSizeY() != m_sizeY) {
+      throw std::runtime_error("Dimensions do not match");
+    }
+    for (size_t i = 0; i < getSize(); ++i) {
+      if (!mask[i]) continue;
+      //An empty window will never accept any value
+      m_lower[i] = std::numeric_limits<double>::infinity();
+      m_upper[i] = -std::numeric_limits<double>::infinity();
+    }
+  }
+
+  inline void PixelAccumulator::setCut(const PixelAccumulator& reference, double sigmaCut)
+  {
+    if (reference.getSizeX() != m_sizeX || reference.getSizeY() != m_sizeY) {
+      throw std::runtime_error("Dimensions do not match");
+    }
+    if (m_hasShift) {
+      throw std::runtime_error("Cannot change the cut of a filled accumulator");
+    }
+    for (size_t i = 0; i < getSize(); ++i) {
+      m_shift[i] = reference.getMean(i);
+      //Keep masked pixels masked and accept everything without reference
+      if (m_lower[i] > m_upper[i] || reference.getEntries(i) <= 0) continue;
+      const double width = reference.getSigma(i) * sigmaCut;
+      m_lower[i] = -width;
+      m_upper[i] = width;
+    }
+    m_hasShift = true;
+  }
+
+  inline void PixelAccumulator::add(const ValueMatrix<double>& data)
+  {
+    if (data.getSizeX() != m_sizeX || data.getSizeY() != m_sizeY) {
+      throw std::runtime_error("Dimensions do not match");
+    }
+    const size_t size = getSize();
+    if (!m_hasShift) {
+      for (size_t i = 0; i < size; ++i) m_shift[i] = data[i];
+      m_hasShift = true;
+    }
+
+    //Branch free update so that the loop can be vectorized: values outside
+    //the window get a weight of zero instead of being skipped
+    const double* values = data.getData();
+    const double* shift = &m_shift.front();
+    const double* lower = &m_lower.front();
+    const double* upper = &m_upper.front();
+    double* entries = &m_entries.front();
+    double* sum = &m_sum.front();
+    double* sumSq = &m_sumSq.front();
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128d one = _mm_set1_pd(1.0);
+    for (; i + 2 <= size; i += 2) {
+      const __m128d value = _mm_sub_pd(_mm_loadu_pd(values + i), _mm_loadu_pd(shift + i));
+      const __m128d inside = _mm_and_pd(_mm_cmpge_pd(value, _mm_loadu_pd(lower + i)),
+                                        _mm_cmple_pd(value, _mm_loadu_pd(upper + i)));
+      const __m128d weighted = _mm_and_pd(inside, value);
+      _mm_storeu_pd(entries + i, _mm_add_pd(_mm_loadu_pd(entries + i), _mm_and_pd(inside, one)));
+      _mm_storeu_pd(sum + i, _mm_add_pd(_mm_loadu_pd(sum + i), weighted));
+      _mm_storeu_pd(sumSq + i, _mm_add_pd(_mm_loadu_pd(sumSq + i), _mm_mul_pd(weighted, value)));
+    }
+#endif
+    for (; i < size; ++i) {
+      const double value = values[i] - shift[i];
+      const double weight = (value >= lower[i] && value <= upper[i]) ? 1.0 : 0.0;
+      const double weighted = weight * value;
+      entries[i] += weight;
+      sum[i] += weighted;
+      sumSq[i] += weighted * value;
+    }
+  }
+
+  inline double PixelAccumulator::getConvergedFraction(double meanPrecision, double sigmaPrecision) const
+  {
+    //Relative error of sigma only depends on the number of entries
+    const double minEntries = sigmaPrecision > 0 ? 1 + 0.5 / (sigmaPrecision * sigmaPrecision) : 2;
+    size_t pixels(0), converged(0);
+    for (size_t i = 0; i < getSize(); ++i) {
+      //Masked pixels are not counted
+      if (m_lower[i] > m_upper[i]) continue;
+      ++pixels;
+      const double entries = m_entries[i];
+      if (entries < std::max(2.0, minEntries)) continue;
+      if (meanPrecision > 0) {
+        const double sigma = getSigma(i);
+        if (sigma * sigma > meanPrecision * meanPrecision * entries) continue;
+      }
+      ++converged;
+    }
+    return pixels ? (double)converged / pixels : 1;
+  }
+
+  inline void PixelAccumulator::merge(const PixelAccumulator& other)
+  {
+    if (other.getSizeX() != m_sizeX || other.getSizeY() != m_sizeY) {
+      throw std::runtime_error("Dimensions do not match");
+    }
+    if (!other.m_hasShift) return;
+    if (!m_hasShift) {
+      m_shift = other.m_shift;
+      m_hasShift = true;
+    }
+    //Transform the sums of the other accumulator to our shift before adding them
+    for (size_t i = 0; i < getSize(); ++i) {
+      const double n = other.m_entries[i];
+      const double delta = other.m_shift[i] - m_shift[i];
+      m_entries[i] += n;
+      m_sum[i] += other.m_sum[i] + n * delta;
+      m_sumSq[i] += other.m_sumSq[i] + 2 * delta * other.m_sum[i] + n * delta * delta;
+    }
+  }
+
+  inline void PixelAccumulator::write(std::ostream& output) const
+  {
+    const uint32_t size[3] = {(uint32_t) m_sizeX, (uint32_t) m_sizeY, m_hasShift};
+    output.write((const char*) size, sizeof(size));
+    const std::vector<double>* arrays[6] = {&m_entries, &m_sum, &m_sumSq, &m_shift, &m_lower, &m_upper};
+    for (int i = 0; i < 6; ++i) {
+      if (!arrays[i]->empty()) output.write((const char*) &arrays[i]->front(), arrays[i]->size() * sizeof(double));
+    }
+  }
+
+  inline void PixelAccumulator::read(std::istream& input)
+  {
+    uint32_t size[3];
+    input.read((char*) size, sizeof(size));
+    if (!input) throw std::runtime_error("Error reading pixel accumulator");
+    setSize(size[0], size[1]);
+    m_hasShift = size[2];
+    std::vector<double>* arrays[6] = {&m_entries, &m_sum, &m_sumSq, &m_shift, &m_lower, &m_upper};
+    for (int i = 0; i < 6; ++i) {
+      if (!arrays[i]->empty()) input.read((char*) &arrays[i]->front(), arrays[i]->size() * sizeof(double));
+    }
+    if (!input) throw std::runtime_error("Error reading pixel accumulator");
+  }
+
+}
+#endif
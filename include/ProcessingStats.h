@@ -0,0 +1,153 @@
+#ifndef DEPFET_PROCESSINGSTATS_H
+#define DEPFET_PROCESSINGSTATS_H
+
+#include <ostream>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <boost/format.hpp>
+#include <DEPFETReader/ADCValues.h>
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/TraceRecorder.h>
+
+namespace DEPFET {
+
+  /** Time and amount of data spent in one processing stage */
+  struct StageStats {
+    StageStats(): time(0), calls(0), bytes(0), frames(0), events(0) {}
+    /** Add the values of another stage */
+    void add(const StageStats& other) {
+      time += other.time;
+      calls += other.calls;
+      bytes += other.bytes;
+      frames += other.frames;
+      events += other.events;
+    }
+    /** Count one processed frame */
+    void countFrame(const ADCValues& data) {
+      ++frames;
+      bytes += data.getSize() * sizeof(ADCValues::value_type);
+    }
+    /** Total time in seconds */
+    double time;
+    /** Number of times the stage was entered */
+    uint64_t calls;
+    /** Number of bytes processed */
+    uint64_t bytes;
+    /** Number of frames processed */
+    uint64_t frames;
+    /** Number of events processed */
+    uint64_t events;
+  };
+
+  /** Statistics for all processing stages of reading and analysing DEPFET data.
+   *
+   * DataReader fills the READ and CONVERT stages, the tools fill the other
+   * stages for their own processing. Statistics of several readers or
+   * threads can be combined with merge().
+   */
+  class ProcessingStats {
+  public:
+    /** Processing stages */
+    enum Stage {
+      /** reading headers and raw data from file */
+      READ,
+      /** converting raw data to ADCValues */
+      CONVERT,
+      /** pedestal substraction and tracking */
+      PEDESTAL,
+      /** common mode correction */
+      COMMONMODE,
+      /** filling results and writing output */
+      OUTPUT,
+      /** number of stages */
+      NSTAGES
+    };
+
+    /** Return the name of a stage */
+    static const char* getName(int stage) {
+      static const char* names[NSTAGES] = {"read", "convert", "pedestal", "commonmode", "output"};
+      return names[stage];
+    }
+
+    /** Return the statistics of one stage */
+    StageStats& operator[](int stage) { return m_stages[stage]; }
+    /** Return the statistics of one stage */
+    const StageStats& operator[](int stage) const { return m_stages[stage]; }
+
+    /** Reset all stages */
+    void clear() {
+      for (int i = 0; i < NSTAGES; ++i) m_stages[i] = StageStats();
+    }
+    /** Add the statistics of another instance */
+    void merge(const ProcessingStats& other) {
+      for (int i = 0; i < NSTAGES; ++i) m_stages[i].add(other.m_stages[i]);
+    }
+    /** Print a table of all stages with time, amount of data and throughput */
+    void print(std::ostream& output) const;
+    /** Print one line for each part of the input skipped because of corrupted data */
+    static void printSkipped(std::ostream& output, const std::vector<SkippedRange>& skipped);
+
+  protected:
+    /** Statistics for each stage */
+    StageStats m_stages[NSTAGES];
+  };
+
+  /** Scoped timer which adds the time between construction and destruction
+   * to a stage. If the timer has a name and tracing is enabled, the time is
+   * also recorded as span in the TraceRecorder */
+  class StageTimer {
+  public:
+    /** Start timing a stage with an optional name for tracing */
+    StageTimer(StageStats& stats, const char* name = 0): m_stats(stats), m_name(name), m_start(getTime()) {}
+    /** Start timing one of the stages of ProcessingStats, traced with the name of the stage */
+    StageTimer(ProcessingStats& stats, int stage):
+      m_stats(stats[stage]), m_name(ProcessingStats::getName(stage)), m_start(getTime()) {}
+    /** Stop timing and add the elapsed time */
+    ~StageTimer() {
+      const double end = getTime();
+      m_stats.time += end - m_start;
+      ++m_stats.calls;
+      if (m_name) TraceRecorder::record(m_name, m_start, end);
+    }
+    /** Return the current value of a monotonic clock in seconds */
+    static double getTime() {
+      timespec t;
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      return t.tv_sec + t.tv_nsec * 1e-9;
+    }
+  protected:
+    /** Statistics to add to */
+    StageStats& m_stats;
+    /** Name used for tracing, 0 if not traced */
+    const char* m_name;
+    /** Start time in seconds */
+    double m_start;
+  };
+
+  inline void ProcessingStats::print(std::ostream& output) const
+  {
+    boost::format line("%-12s %10.3f %10d %10d %14d %12.1f %12.2f\n");
+    output << boost::format("%-12s %10s %10s %10s %14s %12s %12s\n")
+           % "stage" % "time/s" % "events" % "frames" % "bytes" % "frames/s" % "MB/s";
+    StageStats total;
+    for (int i = 0; i < NSTAGES; ++i) {
+      const StageStats& stage = m_stages[i];
+      total.time += stage.time;
+      const double time = stage.time > 0 ? stage.time : 1;
+      output << line % getName(i) % stage.time % stage.events % stage.frames % stage.bytes
+             % (stage.frames / time) % (stage.bytes / time / 1e6);
+    }
+    output << boost::format("%-12s %10.3f\n") % "total" % total.time;
+  }
+
+  inline void ProcessingStats::printSkipped(std::ostream& output, const std::vector<SkippedRange>& skipped)
+  {
+    for (size_t i = 0; i < skipped.size(); ++i) {
+      output << "Skipped " << skipped[i].size << " bytes of corrupted data at offset " << skipped[i].offset
+             << " in " << skipped[i].filename << std::endl;
+    }
+  }
+
+}
+#endif
@@ -51,6 +51,14 @@ namespace DEPFET {
 
     typedef unsigned int value_type;
 
+    /** Limits of the header fields */
+    enum {
+      /** Largest record size in units of value_type, including the header */
+      MAX_EVENT_SIZE = (1 << 20) - 1,
+      /** Largest module number */
+      MAX_MODULE_NO = 15
+    };
+
     /** Constructor taking a reference to the stream from which to read the data */
     RawData(std::istream& stream): m_stream(stream) {}
 
@@ -85,6 +93,8 @@ namespace DEPFET {
       m_stream.seekg((m_header.eventSize - 2)*sizeof(value_type), std::ios::cur);
     }
 
+    /** Return the header of the current record */
+    const Header& getHeader() const { return m_header; }
     /** Return the Event Type */
     int getEventType() const { return m_header.eventType; }
     /** Return the Trigger Number */
@@ -7,6 +7,10 @@
 namespace DEPFET {
 
   struct S3AConverter {
+    /** Size of the converted frame */
+    enum { SIZEX = 64, SIZEY = 128 };
+    /** Size of one raw frame in units of RawData::value_type */
+    enum { FRAME_WORDS = SIZEX * SIZEY * sizeof(unsigned int) / sizeof(RawData::value_type) };
     size_t operator()(const RawData& rawData, ADCValues& adcValues);
   };
 
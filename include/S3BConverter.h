@@ -7,10 +7,18 @@
 namespace DEPFET {
 
   struct S3BConverter2Fold {
+    /** Size of the converted frame */
+    enum { SIZEX = 64, SIZEY = 256 };
+    /** Size of one raw frame in units of RawData::value_type */
+    enum { FRAME_WORDS = SIZEX * SIZEY * sizeof(short) / sizeof(RawData::value_type) };
     size_t operator()(const RawData& rawData, ADCValues& adcValues);
   };
 
   struct S3BConverter4Fold {
+    /** Size of the converted frame */
+    enum { SIZEX = 32, SIZEY = 512 };
+    /** Size of one raw frame in units of RawData::value_type */
+    enum { FRAME_WORDS = SIZEX * SIZEY * sizeof(short) / sizeof(RawData::value_type) };
     size_t operator()(const RawData& rawData, ADCValues& adcValues);
   };
 }
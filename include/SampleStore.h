@@ -0,0 +1,116 @@
+#ifndef DEPFET_SAMPLESTORE_H
+#define DEPFET_SAMPLESTORE_H
+
+#include <DEPFETReader/ADCValues.h>
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Layout of the files written by SampleWriter and read by SampleReader.
+   *
+   * The raw samples of all frames are stored transposed, pixel after pixel,
+   * so the history of one pixel can be read without touching the other
+   * pixels. To keep the memory needed for writing bounded, the frames are
+   * stored in blocks of a fixed number of frames: The file starts with a
+   * Header, followed by one block after the other. Each block consists of a
+   * BlockHeader and then the samples of all pixels as 16bit integers, first
+   * all samples of pixel (0,0), then all of pixel (0,1) and so on in the
+   * order of ValueMatrix. All blocks but the last one contain blockFrames
+   * frames.
+   */
+  struct SampleStore {
+    /** Header at the beginning of the file */
+    struct Header {
+      /** magic bytes "DEPFETRS" */
+      char magic[8];
+      /** version of the format */
+      uint32_t version;
+      /** number of columns */
+      uint32_t sizeX;
+      /** number of rows */
+      uint32_t sizeY;
+      /** number of frames per block */
+      uint32_t blockFrames;
+    };
+    /** Header of each block */
+    struct BlockHeader {
+      /** index of the first frame in the block */
+      uint64_t firstFrame;
+      /** number of frames in the block */
+      uint32_t frames;
+      /** unused, keeps the samples aligned */
+      uint32_t padding;
+    };
+    /** Version of the format */
+    enum { VERSION = 1 };
+  };
+
+  /** Class to write the raw samples of all frames of one module in the
+   * transposed layout described in SampleStore. Samples are rounded to the
+   * nearest integer and clipped to the range of 16bit integers */
+  class SampleWriter {
+  public:
+    /** Create a writer without file */
+    SampleWriter(): m_frames(0), m_totalFrames(0) {}
+
+    /** Create the file for frames of the given size, buffering blockFrames
+     * frames in memory. Throws an Exception on error */
+    void open(const std::string& filename, size_t sizeX, size_t sizeY, size_t blockFrames = 1024);
+    /** Add the samples of one frame, throws an Exception on error */
+    void add(const ValueMatrix<double>& data);
+    /** Write the remaining frames and close the file, throws an Exception on error */
+    void close();
+    /** Return the number of frames added */
+    uint64_t getFrames() const { return m_totalFrames; }
+
+  protected:
+    /** Write the buffered frames as one block */
+    void writeBlock();
+
+    /** output file */
+    std::ofstream m_output;
+    /** output filename */
+    std::string m_filename;
+    /** header of the file */
+    SampleStore::Header m_header;
+    /** samples of the current block, blockFrames per pixel */
+    std::vector<int16_t> m_buffer;
+    /** number of frames in the current block */
+    size_t m_frames;
+    /** number of frames added */
+    uint64_t m_totalFrames;
+  };
+
+  /** Class to read the history of single pixels from a file written by SampleWriter */
+  class SampleReader {
+  public:
+    /** Open the file and read the block structure, throws an Exception on error */
+    void open(const std::string& filename);
+    /** Return the number of columns */
+    size_t getSizeX() const { return m_header.sizeX; }
+    /** Return the number of rows */
+    size_t getSizeY() const { return m_header.sizeY; }
+    /** Return the number of frames in the file */
+    uint64_t getFrames() const { return m_frames; }
+    /** Read all samples of one pixel, throws an Exception on error */
+    void readPixel(size_t x, size_t y, std::vector<int16_t>& samples);
+
+  protected:
+    /** input file */
+    std::ifstream m_input;
+    /** input filename */
+    std::string m_filename;
+    /** header of the file */
+    SampleStore::Header m_header;
+    /** offset of the samples and number of frames of each block */
+    std::vector<std::pair<std::streamoff, uint32_t> > m_blocks;
+    /** number of frames in the file */
+    uint64_t m_frames;
+  };
+
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef DEPFET_SHARD_H
+#define DEPFET_SHARD_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace DEPFET {
+
+  /** Class to select one part of the input if a run is split over several processes.
+   *
+   * Shard i of N gets the i-th of N consecutive event ranges of nearly
+   * equal size. The number of events is determined by scanning only the
+   * record headers of the files, so every process can resolve its own
+   * range without reading the pixel data. The ranges of all shards in
+   * order of their index add up to the complete input.
+   */
+  class Shard {
+  public:
+    /** Create a shard, the default is the complete input */
+    Shard(int index = 0, int count = 1): m_index(index), m_count(count) {}
+
+    /** Parse a shard specification "i/N" with 0 <= i < N, throws an Exception if it is invalid */
+    static Shard parse(const std::string& spec);
+
+    /** Return the index of the shard */
+    int getIndex() const { return m_index; }
+    /** Return the number of shards */
+    int getCount() const { return m_count; }
+    /** Return true if the input is split into several shards */
+    bool isPartial() const { return m_count > 1; }
+    /** Return the specification "i/N" of the shard */
+    std::string toString() const;
+
+    /** Restrict the events to read to the range of this shard.
+     * skipEvents and nEvents select the events of all files like for the
+     * DataReader, nEvents <= 0 meaning all events. They are replaced by the
+     * first event and the number of events of this shard. If the shard
+     * contains no events, skipEvents points past the last event.
+     * @return the number of events in this shard
+     */
+    int selectEvents(const std::vector<std::string>& filenames, int& skipEvents, int& nEvents, bool recover = false) const;
+
+    /** Parse a shard specification "i/N" and restrict the events to read to
+     * the range of this shard, see parse() and selectEvents(). The selected
+     * range is written to output. Throws an Exception if the specification
+     * is invalid or the files cannot be read.
+     * @return the number of events in the shard
+     */
+    static int select(const std::string& spec, const std::vector<std::string>& filenames, int& skipEvents, int& nEvents,
+                      bool recover, std::ostream& output);
+
+  protected:
+    /** Index of the shard */
+    int m_index;
+    /** Number of shards */
+    int m_count;
+  };
+
+}
+#endif
@@ -0,0 +1,97 @@
+#ifndef DEPFET_SHAREDHITMAP_H
+#define DEPFET_SHAREDHITMAP_H
+
+#include <DEPFETReader/ADCValues.h>
+
+#include <string>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  /** Hit statistics published together with a hitmap */
+  struct HitmapSummary {
+    /** default constructor */
+    HitmapSummary(): events(0), frames(0), lastHits(0), maxHits(0), hits(0), signal(0) {}
+    /** number of events */
+    uint64_t events;
+    /** number of frames */
+    uint64_t frames;
+    /** number of hits in the last frame */
+    uint64_t lastHits;
+    /** largest number of hits in one frame */
+    uint64_t maxHits;
+    /** total number of hits */
+    uint64_t hits;
+    /** total signal of all hits */
+    double signal;
+  };
+
+  /** Class to publish a hitmap in a POSIX shared memory segment, so that
+   * display programs can show it while the data is processed.
+   *
+   * The segment starts with a Header followed by sizeX*sizeY doubles with
+   * the summed signal, stored column after column like ValueMatrix, masked
+   * pixels are negative. Updates are protected by a sequence lock: the
+   * sequence number is odd while the writer updates the segment, so readers
+   * copy the data and retry if the sequence number was odd or changed in
+   * between. The writer never waits for readers. The segment is kept after
+   * the publisher exits so the last result stays visible, it can be removed
+   * from /dev/shm.
+   */
+  class SharedHitmap {
+  public:
+    /** Layout of the beginning of the shared memory segment */
+    struct Header {
+      /** magic bytes "DEPFETSM" */
+      char magic[8];
+      /** version of the layout */
+      uint32_t version;
+      /** size of the header in bytes, the hitmap starts after it */
+      uint32_t headerSize;
+      /** module number */
+      uint32_t moduleNr;
+      /** number of columns */
+      uint32_t sizeX;
+      /** number of rows */
+      uint32_t sizeY;
+      /** unused, keeps the following fields aligned */
+      uint32_t padding;
+      /** sequence number, odd while an update is in progress */
+      volatile uint64_t sequence;
+      /** hit statistics */
+      HitmapSummary summary;
+    };
+    /** Version of the layout */
+    enum { VERSION = 1 };
+
+    /** Create an object not connected to any segment */
+    SharedHitmap(): m_fd(-1), m_size(0), m_header(0), m_data(0) {}
+    /** Unmap the segment */
+    ~SharedHitmap() { close(); }
+
+    /** Create the shared memory segment for a hitmap of the given size,
+     * replacing an existing segment of the same name. Throws an Exception on error */
+    void create(const std::string& name, int moduleNr, size_t sizeX, size_t sizeY);
+    /** Unmap the segment, it stays available for readers */
+    void close();
+    /** Publish a hitmap and its statistics, the hitmap must have the size given to create() */
+    void publish(const ValueMatrix<double>& hitmap, const HitmapSummary& summary);
+
+  private:
+    /** no copying of the mapping */
+    SharedHitmap(const SharedHitmap&);
+    /** no assignment of the mapping */
+    SharedHitmap& operator=(const SharedHitmap&);
+
+    /** file descriptor of the segment */
+    int m_fd;
+    /** size of the mapping in bytes */
+    size_t m_size;
+    /** header at the start of the mapping */
+    Header* m_header;
+    /** hitmap following the header */
+    double* m_data;
+  };
+
+}
+#endif
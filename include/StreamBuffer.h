@@ -0,0 +1,64 @@
+#ifndef DEPFET_STREAMBUFFER_H
+#define DEPFET_STREAMBUFFER_H
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace DEPFET {
+
+  /** Stream buffer reading from a file descriptor which cannot seek, like
+   * stdin, a named pipe or a TCP connection.
+   *
+   * Data is read in large blocks. Since the reader only moves forward, the
+   * only seeks supported are querying the current position and skipping
+   * forward relative to it, which reads and discards the data. All other
+   * seeks fail.
+   */
+  class StreamBuffer: public std::streambuf {
+  public:
+    /** Size of the read buffer in bytes */
+    enum { BUFFER_SIZE = 1 << 20 };
+
+    /** Create a buffer without input */
+    StreamBuffer(): m_fd(-1), m_close(false), m_position(0), m_buffer(BUFFER_SIZE) {}
+    /** Close the input */
+    ~StreamBuffer() { close(); }
+
+    /** Open an input stream. "-" is the standard input, "tcp://host:port"
+     * connects to a TCP server and everything else is opened as a file.
+     * Throws an Exception on error */
+    void open(const std::string& name);
+    /** Close the input */
+    void close();
+    /** Return true if the name refers to something which has to be read as
+     * stream: stdin, a TCP connection, or a file which is not a regular
+     * file like a named pipe */
+    static bool isStream(const std::string& name);
+
+  protected:
+    /** Read the next block of data */
+    virtual int_type underflow();
+    /** Return the position or skip forward relative to the current position */
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which);
+    /** Only seeking to the current position is supported */
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+  private:
+    /** no copying of the file descriptor */
+    StreamBuffer(const StreamBuffer&);
+    /** no assignment of the file descriptor */
+    StreamBuffer& operator=(const StreamBuffer&);
+
+    /** file descriptor to read from, -1 if closed */
+    int m_fd;
+    /** wether the file descriptor has to be closed */
+    bool m_close;
+    /** stream position of the end of the buffered data */
+    std::streamoff m_position;
+    /** read buffer */
+    std::vector<char> m_buffer;
+  };
+
+}
+#endif
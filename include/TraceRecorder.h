@@ -0,0 +1,89 @@
+#ifndef DEPFET_TRACERECORDER_H
+#define DEPFET_TRACERECORDER_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace DEPFET {
+
+  /** Class to record a timeline of processing spans for all threads.
+   *
+   * Each thread records into its own buffer which is only registered once
+   * under a lock, so recording a span does not need any synchronisation.
+   * Recording is disabled by default and costs only a flag check then.
+   * The timeline is written in the Chrome trace event format which can be
+   * viewed with Perfetto or chrome://tracing.
+   */
+  class TraceRecorder {
+  public:
+    /** One recorded span */
+    struct Span {
+      /** Name of the span, has to be a string literal or otherwise outlive the recorder */
+      const char* name;
+      /** Start time in seconds */
+      double start;
+      /** End time in seconds */
+      double end;
+    };
+
+    /** Start recording spans */
+    static void enable();
+    /** Return true if spans are recorded */
+    static bool isEnabled() { return s_enabled; }
+    /** Record a span for the calling thread, times are in seconds as returned by StageTimer::getTime() */
+    static void record(const char* name, double start, double end) {
+      if (s_enabled) add(name, start, end);
+    }
+    /** Set the name of the calling thread shown in the timeline */
+    static void setThreadName(const std::string& name);
+    /** Write all recorded spans to a file. Threads still recording at the
+     * same time are not allowed, so this should be called after all
+     * worker threads have been joined */
+    static void write(const std::string& filename);
+
+  protected:
+    /** Buffer holding the spans of one thread */
+    struct ThreadBuffer {
+      /** Thread id used in the timeline */
+      int tid;
+      /** Thread name used in the timeline */
+      std::string name;
+      /** Recorded spans */
+      std::vector<Span> spans;
+      /** Number of spans not recorded because the buffer was full */
+      size_t dropped;
+    };
+
+    /** Add a span to the buffer of the calling thread */
+    static void add(const char* name, double start, double end);
+    /** Return the buffer of the calling thread, creating it if needed */
+    static ThreadBuffer* getBuffer();
+
+    /** Wether spans are recorded */
+    static bool s_enabled;
+    /** Time when recording was enabled */
+    static double s_startTime;
+    /** Buffers of all threads */
+    static std::vector<ThreadBuffer*> s_buffers;
+    /** Mutex protecting the list of buffers */
+    static pthread_mutex_t s_mutex;
+  };
+
+  /** Scoped span which is recorded from construction until destruction.
+   * Spans created while tracing is disabled are never recorded */
+  class TraceSpan {
+  public:
+    /** Start a span with the given name */
+    TraceSpan(const char* name);
+    /** End the span */
+    ~TraceSpan();
+  protected:
+    /** Name of the span */
+    const char* m_name;
+    /** Start time in seconds, 0 if tracing was disabled at construction */
+    double m_start;
+  };
+
+}
+#endif
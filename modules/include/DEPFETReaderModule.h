@@ -17,6 +17,8 @@
 #include <DEPFETReader/DataReader.h>
 #include <DEPFETReader/CommonMode.h>
 #include <DEPFETReader/IncrementalMean.h>
+#include <DEPFETReader/HotPixelTracker.h>
+#include <DEPFETReader/CalibrationStore.h>
 namespace DEPFET {
   typedef ValueMatrix<double> Pedestals;
   typedef ValueMatrix<double> Noise;
@@ -47,6 +49,9 @@ namespace Belle2 {
     /** Method is called for each event. */
     virtual void event();
 
+    /** Writes the mask including hot pixels if requested. */
+    virtual void terminate();
+
   protected:
     void progress(int event, int maxOrder = 4);
     void calculatePedestals();
@@ -61,12 +66,18 @@ namespace Belle2 {
     int m_dcd;
     int m_trailingFrames;
     int m_currentFrame;
+    int m_hotPixelWindow;
+    double m_hotPixelThreshold;
+    std::string m_hotPixelMaskFile;
 
     DEPFET::DataReader m_reader;
-    DEPFET::Pedestals m_pedestals;
-    DEPFET::Noise m_noise;
-    DEPFET::PixelMask m_mask;
+    DEPFET::CalibrationStore m_calibrationStore;
+    DEPFET::CalibrationView m_calibration;
+    DEPFET::MaskView m_mask;
+    DEPFET::ValueView m_pedestals;
+    DEPFET::ValueView m_noise;
     DEPFET::CommonMode m_commonMode;
+    DEPFET::HotPixelTracker m_hotPixelTracker;
   };
 
 } // end namespace Belle2
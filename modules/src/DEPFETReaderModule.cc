@@ -44,6 +44,9 @@ DEPFETReaderModule::DEPFETReaderModule() : Module(), m_commonMode(2, 1, 2, 1), m
   addParam("trailingFrames", m_trailingFrames, "Number of trailing frames", 0);
   //addParam("calibrationEvents", m_calibrationEvents, "Calibrate using this number of events before starting.", 1000);
   addParam("calibrationFile", m_calibrationFile, "File to read calibration from");
+  addParam("hotPixelWindow", m_hotPixelWindow, "Mask pixels firing far more often than the median pixel, checked every N frames, 0=disabled", 0);
+  addParam("hotPixelThreshold", m_hotPixelThreshold, "Factor above the median number of hits for a pixel to be hot", 20.0);
+  addParam("hotPixelMaskFile", m_hotPixelMaskFile, "Write the mask including the hot pixels to this file at the end", string(""));
 }
 
 void DEPFETReaderModule::progress(int event, int maxOrder)
@@ -134,24 +137,14 @@ void DEPFETReaderModule::initialize()
   }
   DEPFET::Event& event = m_reader.getEvent();
   ADCValues& data = event[0];
-  m_mask.setSize(data);
-  m_pedestals.setSize(data);
-  m_noise.setSize(data);
 
-  //Read calibration data
+  //Read calibration data, binary files stay mapped while the module runs
+  m_calibration.clear(data.getSizeX(), data.getSizeY());
   if (!m_calibrationFile.empty()) {
-    ifstream maskStream(m_calibrationFile.c_str());
-    if (!maskStream) {
-      B2FATAL("Could not open calibration file " << m_calibrationFile);
-    }
-    while (maskStream) {
-      int col, row, mask;
-      double pedestal, noise;
-      maskStream >> col >> row >> mask >> pedestal >> noise;
-      if (!maskStream) break;
-      m_mask(col, row) = mask;
-      m_pedestals(col, row) = pedestal;
-      m_noise(col, row) = noise;
+    try {
+      m_calibration.load(m_calibrationStore, m_calibrationFile, data.getModuleNr(), data.getSizeX(), data.getSizeY());
+    } catch (std::exception& e) {
+      B2FATAL("Could not read calibration: " << e.what());
     }
   }
 
@@ -159,8 +152,15 @@ void DEPFETReaderModule::initialize()
   m_reader.open(m_inputFiles);
   m_reader.skip(m_skipEvents);
 
-  m_commonMode.setMask(&m_mask);
-  m_commonMode.setNoise(m_sigmaCut, &m_noise);
+  //Only the mask is changed during the run, and only if hot pixels are masked
+  m_hotPixelTracker = HotPixelTracker(m_hotPixelWindow, m_hotPixelThreshold);
+  if (m_hotPixelWindow > 0) m_hotPixelTracker.setMask(&m_calibration.copyMask());
+  m_mask = m_calibration.getMask();
+  m_pedestals = m_calibration.getPedestals();
+  m_noise = m_calibration.getNoise();
+  m_commonMode.setMask(m_mask);
+  m_commonMode.setNoise(m_sigmaCut, m_noise);
+  m_hotPixelTracker.setNoise(m_sigmaCut, m_noise);
   m_currentFrame = event.size();
 }
 
@@ -185,6 +185,7 @@ void DEPFETReaderModule::event()
   ADCValues& data = event[m_currentFrame++];
   data.substract(m_pedestals);
   m_commonMode.apply(data);
+  if (m_hotPixelWindow > 0) m_hotPixelTracker.add(data);
   for (size_t y = 0; y < data.getSizeY(); ++y) {
     for (size_t x = 0; x < data.getSizeX(); ++x) {
       if (m_mask(x, y)) continue;
@@ -196,3 +197,15 @@ void DEPFETReaderModule::event()
     }
   }
 }
+
+void DEPFETReaderModule::terminate()
+{
+  if (m_hotPixelWindow <= 0) return;
+  B2INFO("Masked " << m_hotPixelTracker.getHotPixels().size() << " hot pixels");
+  if (m_hotPixelMaskFile.empty()) return;
+  try {
+    m_hotPixelTracker.write(m_hotPixelMaskFile);
+  } catch (std::exception& e) {
+    B2ERROR("Could not write hot pixel mask: " << e.what());
+  }
+}
@@ -0,0 +1,145 @@
+#include <DEPFETReader/CalibrationCache.h>
+#include <DEPFETReader/RawData.h>
+#include <DEPFETReader/Exception.h>
+
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Maximum number of record headers used to identify a raw data file */
+    const int FINGERPRINT_HEADERS = 1000;
+
+    /** Copy a file, returns false on error */
+    bool copyFile(const std::string& source, const std::string& destination)
+    {
+      std::ifstream input(source.c_str(), std::ios::in | std::ios::binary);
+      if (!input) return false;
+      std::ofstream output(destination.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!output) return false;
+      //Streaming an empty buffer sets the failbit, so only copy if there is content
+      if (input.peek() != std::ifstream::traits_type::eof()) output << input.rdbuf();
+      return output.good();
+    }
+
+    /** Create a directory if it does not exist yet */
+    void createDirectory(const std::string& directory)
+    {
+      if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw Exception("Could not create cache directory " + directory);
+      }
+    }
+  }
+
+  uint64_t CalibrationCache::hash(const void* data, size_t size, uint64_t previous)
+  {
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint64_t result = previous;
+    for (size_t i = 0; i < size; ++i) {
+      result ^= bytes[i];
+      result *= 1099511628211ULL;
+    }
+    return result;
+  }
+
+  void CalibrationCache::addFile(const std::string& filename)
+  {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+      throw Exception("Could not access file " + filename);
+    }
+
+    //Hash the headers of the first records, skipping the data in between
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    uint64_t headerHash = hash(0, 0);
+    for (int i = 0; i < FINGERPRINT_HEADERS; ++i) {
+      RawData::Header header;
+      if (!file.read((char*) &header, sizeof(header))) break;
+      headerHash = hash(&header, sizeof(header), headerHash);
+      if (header.eventSize < 2) break;
+      file.seekg((header.eventSize - 2) * sizeof(RawData::value_type), std::ios::cur);
+    }
+
+    std::ostringstream entry;
+    entry << "file " << filename << " " << info.st_size << " " << info.st_mtime << " "
+          << std::hex << headerHash << "\n";
+    m_key += entry.str();
+  }
+
+  void CalibrationCache::addSmallFile(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    std::ostringstream entry;
+    if (!file) {
+      entry << "file " << filename << " missing\n";
+    } else {
+      std::ostringstream content;
+      content << file.rdbuf();
+      const std::string data = content.str();
+      entry << "file " << filename << " " << std::hex << hash(data.data(), data.size()) << "\n";
+    }
+    m_key += entry.str();
+  }
+
+  std::string CalibrationCache::getHash() const
+  {
+    std::ostringstream result;
+    result << std::hex << std::setw(16) << std::setfill('0') << hash(m_key.data(), m_key.size());
+    return result.str();
+  }
+
+  bool CalibrationCache::fetch(const std::vector<std::string>& filenames) const
+  {
+    const std::string entryDirectory = getEntryDirectory();
+
+    //The key file is written last, so an entry is only complete if the key matches
+    std::ifstream keyFile((entryDirectory + "/key").c_str());
+    if (!keyFile) return false;
+    std::ostringstream key;
+    key << keyFile.rdbuf();
+    if (key.str() != m_key) return false;
+
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      std::ostringstream cached;
+      cached << entryDirectory << "/" << i;
+      if (!copyFile(cached.str(), filenames[i])) return false;
+    }
+    return true;
+  }
+
+  void CalibrationCache::store(const std::vector<std::string>& filenames) const
+  {
+    const std::string entryDirectory = getEntryDirectory();
+    createDirectory(m_directory);
+    createDirectory(entryDirectory);
+
+    //Write to temporary files and rename them so that concurrent jobs never see partial files
+    std::ostringstream suffix;
+    suffix << ".tmp" << getpid();
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      std::ostringstream cached;
+      cached << entryDirectory << "/" << i;
+      if (!copyFile(filenames[i], cached.str() + suffix.str()) ||
+          std::rename((cached.str() + suffix.str()).c_str(), cached.str().c_str()) != 0) {
+        throw Exception("Could not store " + filenames[i] + " in cache " + m_directory);
+      }
+    }
+    const std::string keyFilename = entryDirectory + "/key";
+    {
+      std::ofstream keyFile((keyFilename + suffix.str()).c_str());
+      keyFile << m_key;
+      if (!keyFile) {
+        throw Exception("Could not write cache key to " + m_directory);
+      }
+    }
+    if (std::rename((keyFilename + suffix.str()).c_str(), keyFilename.c_str()) != 0) {
+      throw Exception("Could not write cache key to " + m_directory);
+    }
+  }
+
+}
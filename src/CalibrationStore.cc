@@ -0,0 +1,319 @@
+#include <DEPFETReader/CalibrationStore.h>
+#include <DEPFETReader/Exception.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Magic bytes at the beginning of a binary calibration file */
+    const char CALIBRATION_MAGIC[8] = {'D', 'E', 'P', 'F', 'E', 'T', 'C', 'A'};
+
+    /** Size of the data block for a module with the given number of pixels, padded to 8 bytes */
+    size_t getBlockSize(size_t nPixels)
+    {
+      return 2 * nPixels * sizeof(double) + (nPixels + 7) / 8 * 8;
+    }
+  }
+
+  void CalibrationStore::open(const std::string& filename)
+  {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw Exception("Error opening calibration file " + filename);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FileHeader)) {
+      ::close(fd);
+      throw Exception("Calibration file " + filename + " is too small");
+    }
+    void* data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    //The mapping stays valid after closing the descriptor
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      throw Exception("Error mapping calibration file " + filename);
+    }
+    m_data = (const char*) data;
+    m_size = info.st_size;
+    m_filename = filename;
+
+    //Check header and module table
+    const FileHeader* header = (const FileHeader*) m_data;
+    if (std::memcmp(header->magic, CALIBRATION_MAGIC, sizeof(CALIBRATION_MAGIC)) != 0) {
+      close();
+      throw Exception(filename + " is not a binary calibration file");
+    }
+    if (header->version != VERSION) {
+      close();
+      throw Exception("Unsupported calibration file version in " + filename);
+    }
+    const ModuleEntry* entries = (const ModuleEntry*)(m_data + sizeof(FileHeader));
+    if (sizeof(FileHeader) + header->nModules * sizeof(ModuleEntry) > m_size) {
+      close();
+      throw Exception("Calibration file " + filename + " is truncated");
+    }
+    for (size_t i = 0; i < header->nModules; ++i) {
+      //Widen before multiplying so a corrupt header cannot wrap around the check
+      const uint64_t nPixels = (uint64_t) entries[i].sizeX * entries[i].sizeY;
+      if (entries[i].offset > m_size || nPixels > m_size || getBlockSize(nPixels) > m_size - entries[i].offset) {
+        close();
+        throw Exception("Calibration file " + filename + " is truncated");
+      }
+    }
+  }
+
+  void CalibrationStore::close()
+  {
+    if (m_data) munmap((void*) m_data, m_size);
+    m_data = 0;
+    m_size = 0;
+    m_filename.clear();
+  }
+
+  std::vector<int> CalibrationStore::getModules() const
+  {
+    std::vector<int> modules;
+    if (!m_data) return modules;
+    const FileHeader* header = (const FileHeader*) m_data;
+    const ModuleEntry* entries = (const ModuleEntry*)(m_data + sizeof(FileHeader));
+    for (size_t i = 0; i < header->nModules; ++i) modules.push_back(entries[i].moduleNr);
+    return modules;
+  }
+
+  const CalibrationStore::ModuleEntry* CalibrationStore::findModule(int moduleNr) const
+  {
+    if (!m_data) return 0;
+    const FileHeader* header = (const FileHeader*) m_data;
+    const ModuleEntry* entries = (const ModuleEntry*)(m_data + sizeof(FileHeader));
+    for (size_t i = 0; i < header->nModules; ++i) {
+      if (entries[i].moduleNr == moduleNr) return entries + i;
+    }
+    return 0;
+  }
+
+  const CalibrationStore::ModuleEntry& CalibrationStore::getModule(int moduleNr) const
+  {
+    const ModuleEntry* entry = findModule(moduleNr);
+    if (!entry) {
+      std::ostringstream message;
+      message << "No calibration for module " << moduleNr << " in " << m_filename;
+      throw Exception(message.str());
+    }
+    return *entry;
+  }
+
+  MaskView CalibrationStore::getMask(int moduleNr) const
+  {
+    const ModuleEntry& entry = getModule(moduleNr);
+    const size_t nPixels = (size_t) entry.sizeX * entry.sizeY;
+    const unsigned char* data = (const unsigned char*)(m_data + entry.offset + 2 * nPixels * sizeof(double));
+    return MaskView(data, nPixels, entry.sizeX, entry.sizeY);
+  }
+
+  ValueView CalibrationStore::getPedestals(int moduleNr) const
+  {
+    const ModuleEntry& entry = getModule(moduleNr);
+    const size_t nPixels = (size_t) entry.sizeX * entry.sizeY;
+    const double* data = (const double*)(m_data + entry.offset);
+    return ValueView(data, nPixels, entry.sizeX, entry.sizeY);
+  }
+
+  ValueView CalibrationStore::getNoise(int moduleNr) const
+  {
+    const ModuleEntry& entry = getModule(moduleNr);
+    const size_t nPixels = (size_t) entry.sizeX * entry.sizeY;
+    const double* data = (const double*)(m_data + entry.offset) + nPixels;
+    return ValueView(data, nPixels, entry.sizeX, entry.sizeY);
+  }
+
+  void CalibrationStore::read(int moduleNr, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise) const
+  {
+    MaskView maskView = getMask(moduleNr);
+    ValueView pedestalView = getPedestals(moduleNr);
+    ValueView noiseView = getNoise(moduleNr);
+    const size_t sizeX = maskView.getSizeX();
+    const size_t sizeY = maskView.getSizeY();
+    if (!mask) mask.setSize(sizeX, sizeY);
+    if (!pedestals) pedestals.setSize(mask);
+    if (!noise) noise.setSize(mask);
+    checkSize(moduleNr, mask.getSizeX(), mask.getSizeY());
+    checkSize(moduleNr, pedestals.getSizeX(), pedestals.getSizeY());
+    checkSize(moduleNr, noise.getSizeX(), noise.getSizeY());
+    mask.set(maskView);
+    pedestals.set(pedestalView);
+    noise.set(noiseView);
+  }
+
+  void CalibrationStore::checkSize(int moduleNr, size_t sizeX, size_t sizeY) const
+  {
+    const ModuleEntry& entry = getModule(moduleNr);
+    if (entry.sizeX != sizeX || entry.sizeY != sizeY) {
+      std::ostringstream message;
+      message << "Calibration size " << entry.sizeX << "x" << entry.sizeY << " of module " << moduleNr << " in " << m_filename
+              << " does not match frame size " << sizeX << "x" << sizeY;
+      throw Exception(message.str());
+    }
+  }
+
+  bool CalibrationStore::isBinary(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    char magic[sizeof(CALIBRATION_MAGIC)];
+    if (!file.read(magic, sizeof(magic))) return false;
+    return std::memcmp(magic, CALIBRATION_MAGIC, sizeof(magic)) == 0;
+  }
+
+  void CalibrationStore::write(const std::string& filename, const std::vector<ModuleCalibration>& modules)
+  {
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file) {
+      throw Exception("Error opening calibration file " + filename + " for writing");
+    }
+    FileHeader header;
+    std::memcpy(header.magic, CALIBRATION_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.nModules = modules.size();
+    file.write((const char*) &header, sizeof(header));
+
+    //Module table, data blocks follow directly after it
+    uint64_t offset = sizeof(FileHeader) + modules.size() * sizeof(ModuleEntry);
+    for (size_t i = 0; i < modules.size(); ++i) {
+      const ModuleCalibration& module = modules[i];
+      if (module.pedestals.getSizeX() != module.mask.getSizeX() || module.pedestals.getSizeY() != module.mask.getSizeY() ||
+          module.noise.getSizeX() != module.mask.getSizeX() || module.noise.getSizeY() != module.mask.getSizeY()) {
+        throw Exception("Dimensions do not match");
+      }
+      ModuleEntry entry;
+      entry.moduleNr = module.moduleNr;
+      entry.sizeX = module.mask.getSizeX();
+      entry.sizeY = module.mask.getSizeY();
+      entry.reserved = 0;
+      entry.offset = offset;
+      file.write((const char*) &entry, sizeof(entry));
+      offset += getBlockSize(module.mask.getSize());
+    }
+
+    //Data blocks
+    for (size_t i = 0; i < modules.size(); ++i) {
+      const ModuleCalibration& module = modules[i];
+      const size_t nPixels = module.mask.getSize();
+      if (nPixels == 0) continue;
+      file.write((const char*) module.pedestals.getData(), nPixels * sizeof(double));
+      file.write((const char*) module.noise.getData(), nPixels * sizeof(double));
+      file.write((const char*) module.mask.getData(), nPixels);
+      const char padding[8] = {0};
+      file.write(padding, getBlockSize(nPixels) - 2 * nPixels * sizeof(double) - nPixels);
+    }
+    if (!file) {
+      throw Exception("Error writing calibration file " + filename);
+    }
+  }
+
+  void CalibrationStore::readText(const std::string& filename, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise)
+  {
+    std::ifstream calStream(filename.c_str());
+    if (!calStream) {
+      throw Exception("Could not open calibration file " + filename);
+    }
+    std::vector<int> cols, rows;
+    std::vector<double> pixelPedestals, pixelNoise;
+    std::vector<unsigned char> pixelMask;
+    int maxCol(-1), maxRow(-1);
+    while (calStream) {
+      int col, row, px_masked;
+      double px_pedestal, px_noise;
+      calStream >> col >> row >> px_masked >> px_pedestal >> px_noise;
+      if (!calStream) break;
+      cols.push_back(col);
+      rows.push_back(row);
+      pixelMask.push_back(px_masked);
+      pixelPedestals.push_back(px_pedestal);
+      pixelNoise.push_back(px_noise);
+      maxCol = std::max(maxCol, col);
+      maxRow = std::max(maxRow, row);
+    }
+
+    //The text format has no geometry header, so take the size from the content if needed
+    if (!mask) mask.setSize(maxCol + 1, maxRow + 1);
+    if (!pedestals) pedestals.setSize(mask);
+    if (!noise) noise.setSize(mask);
+    for (size_t i = 0; i < cols.size(); ++i) {
+      if (cols[i] < 0 || rows[i] < 0 || (size_t) cols[i] >= mask.getSizeX() || (size_t) rows[i] >= mask.getSizeY()) {
+        std::ostringstream message;
+        message << "Calibration pixel " << cols[i] << "/" << rows[i] << " in " << filename << " is outside the frame size "
+                << mask.getSizeX() << "x" << mask.getSizeY();
+        throw Exception(message.str());
+      }
+      mask.at(cols[i], rows[i]) = pixelMask[i];
+      pedestals.at(cols[i], rows[i]) = pixelPedestals[i];
+      noise.at(cols[i], rows[i]) = pixelNoise[i];
+    }
+  }
+
+  void CalibrationStore::load(const std::string& filename, int moduleNr, PixelMask& mask, ValueMatrix<double>& pedestals, PixelNoise& noise)
+  {
+    if (isBinary(filename)) {
+      CalibrationStore store(filename);
+      store.read(moduleNr, mask, pedestals, noise);
+    } else {
+      readText(filename, mask, pedestals, noise);
+    }
+  }
+
+  void CalibrationView::load(CalibrationStore& store, const std::string& filename, int moduleNr, size_t sizeX, size_t sizeY)
+  {
+    m_calibration = ModuleCalibration(moduleNr);
+    if (!CalibrationStore::isBinary(filename)) {
+      m_calibration.mask.setSize(sizeX, sizeY);
+      m_calibration.pedestals.setSize(sizeX, sizeY);
+      m_calibration.noise.setSize(sizeX, sizeY);
+      CalibrationStore::readText(filename, m_calibration.mask, m_calibration.pedestals, m_calibration.noise);
+      m_privateMask = m_privatePedestals = m_privateNoise = true;
+      return;
+    }
+    if (store.getFilename() != filename) store.open(filename);
+    store.checkSize(moduleNr, sizeX, sizeY);
+    m_mask = store.getMask(moduleNr);
+    m_pedestals = store.getPedestals(moduleNr);
+    m_noise = store.getNoise(moduleNr);
+    m_privateMask = m_privatePedestals = m_privateNoise = false;
+  }
+
+  void CalibrationView::clear(size_t sizeX, size_t sizeY)
+  {
+    m_calibration = ModuleCalibration();
+    m_calibration.mask.setSize(sizeX, sizeY);
+    m_calibration.pedestals.setSize(sizeX, sizeY);
+    m_calibration.noise.setSize(sizeX, sizeY);
+    m_privateMask = m_privatePedestals = m_privateNoise = true;
+  }
+
+  PixelMask& CalibrationView::copyMask()
+  {
+    if (!m_privateMask) {
+      m_calibration.mask.setSize(m_mask.getSizeX(), m_mask.getSizeY());
+      m_calibration.mask.set(m_mask);
+      m_privateMask = true;
+    }
+    return m_calibration.mask;
+  }
+
+  ValueMatrix<double>& CalibrationView::copyPedestals()
+  {
+    if (!m_privatePedestals) {
+      m_calibration.pedestals.setSize(m_pedestals.getSizeX(), m_pedestals.getSizeY());
+      m_calibration.pedestals.set(m_pedestals);
+      m_privatePedestals = true;
+    }
+    return m_calibration.pedestals;
+  }
+
+}
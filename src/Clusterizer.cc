@@ -0,0 +1,79 @@
+#include <DEPFETReader/Clusterizer.h>
+
+#include <algorithm>
+
+namespace DEPFET {
+
+  const std::vector<Cluster>& Clusterizer::findClusters(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    m_hits.clear();
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (mask(x, y) || data(x, y) <= m_sigmaCut * noise(x, y)) continue;
+        Hit hit;
+        hit.col = x;
+        hit.row = y;
+        hit.signal = data(x, y);
+        m_hits.push_back(hit);
+      }
+    }
+    return clusterHits();
+  }
+
+  const std::vector<Cluster>& Clusterizer::findClusters(const std::vector<Hit>& hits)
+  {
+    m_hits = hits;
+    return clusterHits();
+  }
+
+  const std::vector<Cluster>& Clusterizer::clusterHits()
+  {
+    const std::vector<Hit>& hits = m_hits;
+    const int nHits = hits.size();
+    m_parent.resize(nHits);
+    //First hit of the previous column which might touch the current hit
+    int previous(0);
+    for (int i = 0; i < nHits; ++i) {
+      const Hit& hit = hits[i];
+      m_parent[i] = i;
+      //Hit directly below in the same column
+      if (i > 0 && hits[i - 1].col == hit.col && hits[i - 1].row + 1 == hit.row) join(i, i - 1);
+      //Hits in the previous column with a row differing by at most one
+      while (previous < i && (hits[previous].col + 1 < hit.col ||
+                              (hits[previous].col + 1 == hit.col && hits[previous].row + 1 < hit.row))) {
+        ++previous;
+      }
+      for (int j = previous; j < i && hits[j].col + 1 == hit.col && hits[j].row <= hit.row + 1; ++j) {
+        join(i, j);
+      }
+    }
+
+    //Sum up the hits of each group
+    m_clusters.clear();
+    m_clusterIndex.assign(nHits, -1);
+    for (int i = 0; i < nHits; ++i) {
+      const int root = find(i);
+      if (m_clusterIndex[root] < 0) {
+        m_clusterIndex[root] = m_clusters.size();
+        Cluster cluster = {0, 0, 0, 0, 0};
+        m_clusters.push_back(cluster);
+      }
+      Cluster& cluster = m_clusters[m_clusterIndex[root]];
+      const Hit& hit = hits[i];
+      cluster.charge += hit.signal;
+      cluster.seed = std::max(cluster.seed, hit.signal);
+      cluster.col += hit.signal * hit.col;
+      cluster.row += hit.signal * hit.row;
+      ++cluster.size;
+    }
+    for (size_t i = 0; i < m_clusters.size(); ++i) {
+      Cluster& cluster = m_clusters[i];
+      if (cluster.charge > 0) {
+        cluster.col /= cluster.charge;
+        cluster.row /= cluster.charge;
+      }
+    }
+    return m_clusters;
+  }
+
+}
@@ -0,0 +1,120 @@
+#include <DEPFETReader/CovarianceMatrix.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cmath>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace DEPFET {
+
+  CovarianceMatrix::CovarianceMatrix(size_t sizeX, size_t sizeY, int band, size_t batchFrames, int nThreads):
+    m_sizeY(sizeY), m_pixels(sizeX * sizeY), m_band(band), m_batchFrames(std::max(batchFrames, (size_t)1)),
+    m_nThreads(std::max(nThreads, 1)), m_batchSize(0), m_frames(0)
+  {
+    if (m_pixels == 0) {
+      throw Exception("Cannot calculate the covariance of empty frames");
+    }
+    //Select all tiles of the upper triangle containing at least one pair inside the band
+    m_nTiles = (m_pixels + TILE - 1) / TILE;
+    m_tileOffset.assign(m_nTiles * m_nTiles, 0);
+    size_t offset(0);
+    for (size_t i = 0; i < m_nTiles; ++i) {
+      const size_t lastCol = (std::min(m_pixels, (i + 1) * TILE) - 1) / sizeY;
+      for (size_t j = i; j < m_nTiles; ++j) {
+        const size_t firstCol = j * TILE / sizeY;
+        if (band >= 0 && firstCol > lastCol && (int)(firstCol - lastCol) > band) break;
+        Tile tile;
+        tile.row = i * TILE;
+        tile.col = j * TILE;
+        tile.offset = offset;
+        m_tiles.push_back(tile);
+        m_tileOffset[i * m_nTiles + j] = offset;
+        offset += TILE * TILE;
+      }
+    }
+    m_sums.assign(offset, 0);
+    m_sum.assign(m_pixels, 0);
+    m_scale.assign(m_pixels, 0);
+    m_batch.resize(m_pixels * m_batchFrames);
+  }
+
+  void CovarianceMatrix::add(const ValueMatrix<double>& data)
+  {
+    if (data.getSize() != m_pixels) {
+      throw Exception("Frame size does not match covariance matrix");
+    }
+    std::copy(data.getData(), data.getData() + m_pixels, &m_batch[m_batchSize * m_pixels]);
+    if (++m_batchSize == m_batchFrames) flush();
+  }
+
+  void CovarianceMatrix::flush()
+  {
+    if (m_batchSize == 0) return;
+    for (size_t k = 0; k < m_batchSize; ++k) {
+      const double* values = &m_batch[k * m_pixels];
+      for (size_t p = 0; p < m_pixels; ++p) m_sum[p] += values[p];
+    }
+    if (m_nThreads == 1) {
+      updateTiles(0, 1);
+    } else {
+      boost::thread_group threads;
+      for (int i = 0; i < m_nThreads; ++i) {
+        threads.create_thread(boost::bind(&CovarianceMatrix::updateTiles, this, i, m_nThreads));
+      }
+      threads.join_all();
+    }
+    m_frames += m_batchSize;
+    m_batchSize = 0;
+    for (size_t p = 0; p < m_pixels; ++p) {
+      const double variance = getCovariance(p, p);
+      m_scale[p] = variance > 0 ? 1 / std::sqrt(variance) : 0;
+    }
+  }
+
+  void CovarianceMatrix::updateTiles(size_t first, size_t step)
+  {
+    for (size_t t = first; t < m_tiles.size(); t += step) {
+      const Tile& tile = m_tiles[t];
+      const size_t nRows = std::min((size_t)TILE, m_pixels - tile.row);
+      const size_t nCols = std::min((size_t)TILE, m_pixels - tile.col);
+      double* sums = &m_sums[tile.offset];
+      //Add four frames at a time to reduce the loads and stores of the sums
+      size_t k(0);
+      for (; k + 4 <= m_batchSize; k += 4) {
+        const double* x0 = &m_batch[k * m_pixels];
+        const double* x1 = x0 + m_pixels;
+        const double* x2 = x1 + m_pixels;
+        const double* x3 = x2 + m_pixels;
+        for (size_t i = 0; i < nRows; ++i) {
+          const double a0 = x0[tile.row + i], a1 = x1[tile.row + i], a2 = x2[tile.row + i], a3 = x3[tile.row + i];
+          const double* b0 = x0 + tile.col;
+          const double* b1 = x1 + tile.col;
+          const double* b2 = x2 + tile.col;
+          const double* b3 = x3 + tile.col;
+          double* row = sums + i * TILE;
+          //Pairs of columns, which the compiler can combine into vector instructions
+          size_t j(0);
+          for (; j + 2 <= nCols; j += 2) {
+            const double s0 = row[j] + a0 * b0[j] + a1 * b1[j] + a2 * b2[j] + a3 * b3[j];
+            const double s1 = row[j + 1] + a0 * b0[j + 1] + a1 * b1[j + 1] + a2 * b2[j + 1] + a3 * b3[j + 1];
+            row[j] = s0;
+            row[j + 1] = s1;
+          }
+          for (; j < nCols; ++j) {
+            row[j] += a0 * b0[j] + a1 * b1[j] + a2 * b2[j] + a3 * b3[j];
+          }
+        }
+      }
+      for (; k < m_batchSize; ++k) {
+        const double* x = &m_batch[k * m_pixels];
+        for (size_t i = 0; i < nRows; ++i) {
+          const double a = x[tile.row + i];
+          const double* b = x + tile.col;
+          double* row = sums + i * TILE;
+          for (size_t j = 0; j < nCols; ++j) row[j] += a * b[j];
+        }
+      }
+    }
+  }
+
+}
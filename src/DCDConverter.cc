@@ -21,7 +21,7 @@ namespace DEPFET {
 
   size_t DCDConverter2Fold::operator()(const RawData& rawData, ADCValues& adcValues)
   {
-    adcValues.setSize(64, 32);
+    adcValues.setSize(SIZEX, SIZEY);
     DataView<signed char> v4data = rawData.getView<signed char>();
     if (m_useDCDMapping) {
       // printf("=> try with internal maps \n");
@@ -69,13 +69,13 @@ namespace DEPFET {
         }
       }
     }
-    return rawData.getFrameSize<signed char>(64, 32);
+    return rawData.getFrameSize<signed char>(SIZEX, SIZEY);
   }
 
   size_t DCDConverter4Fold::operator()(const RawData& rawData, ADCValues& adcValues)
   {
-    adcValues.setSize(32, 64);
-    DataView<signed char> v4data = rawData.getView<signed char>(32 * 64, 1);
+    adcValues.setSize(SIZEX, SIZEY);
+    DataView<signed char> v4data = rawData.getView<signed char>(SIZEX * SIZEY, 1);
     int iPix(-1);
     int nGates = adcValues.getSizeY() / 4;
     int nColDCD = adcValues.getSizeX() * 4;
@@ -88,6 +88,6 @@ namespace DEPFET {
         adcValues(col, row) = (signed short) v4data[++iPix];
       }
     }
-    return rawData.getFrameSize<signed char>(32, 64);
+    return rawData.getFrameSize<signed char>(SIZEX, SIZEY);
   }
 }
@@ -0,0 +1,319 @@
+#include <DEPFETReader/DataGenerator.h>
+#include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/Exception.h>
+
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace DEPFET {
+
+  namespace {
+    /** Number of entries in the table of gaussian random numbers */
+    const size_t GAUSS_TABLE_SIZE = 1 << 16;
+    /** Maximum number of start gates which can be encoded in the info word */
+    const int MAX_GATES = 128;
+    /** Size of a record header in units of RawData::value_type */
+    const size_t HEADER_WORDS = sizeof(RawData::Header) / sizeof(RawData::value_type);
+
+    /** Round and limit a value to the given range */
+    inline int clamp(double value, int minimum, int maximum)
+    {
+      const int rounded = (int) std::floor(value + 0.5);
+      return std::max(minimum, std::min(maximum, rounded));
+    }
+
+    /** Append a header to a buffer */
+    void appendHeader(std::vector<RawData::value_type>& buffer, int deviceType, int eventType, int moduleNr,
+                      unsigned int triggerNumber)
+    {
+      RawData::Header header;
+      std::memset(&header, 0, sizeof(header));
+      header.eventSize = 2;
+      header.eventType = eventType;
+      header.moduleNo = moduleNr;
+      header.deviceType = deviceType;
+      header.triggerNumber = triggerNumber;
+      const size_t pos = buffer.size();
+      buffer.resize(pos + HEADER_WORDS);
+      std::memcpy(&buffer[pos], &header, sizeof(header));
+    }
+
+    /** Set the size of a header in the buffer to include everything up to the end of the buffer */
+    void finishHeader(std::vector<RawData::value_type>& buffer, size_t pos)
+    {
+      //The size field has only 20 bits, larger records would silently corrupt the file
+      if (buffer.size() - pos > RawData::MAX_EVENT_SIZE) {
+        std::ostringstream message;
+        message << "Record size of " << buffer.size() - pos << " words exceeds the maximum of " << RawData::MAX_EVENT_SIZE << " words";
+        throw Exception(message.str());
+      }
+      RawData::Header header;
+      std::memcpy(&header, &buffer[pos], sizeof(header));
+      header.eventSize = buffer.size() - pos;
+      std::memcpy(&buffer[pos], &header, sizeof(header));
+    }
+  }
+
+  DataGenerator::DataGenerator(int deviceType, int fold, bool useDCDBMapping, unsigned int seed):
+    m_deviceType(deviceType), m_fold(fold), m_useDCDBMapping(useDCDBMapping), m_sizeX(0), m_sizeY(0),
+    m_frameWords(0), m_elementSize(0), m_gates(1), m_trailingFrames(0), m_commonMode(0), m_hitsPerFrame(0),
+    m_signal(0), m_temperature(0), m_temperatureDrift(0), m_pedestalShift(0), m_startTemperature(0),
+    m_rotateStartGate(true), m_runNumber(0), m_events(0), m_random(0x9E3779B97F4A7C15ULL ^ seed)
+  {
+    //Precompute gaussian random numbers using Box-Muller
+    m_gaussTable.resize(GAUSS_TABLE_SIZE);
+    for (size_t i = 0; i < GAUSS_TABLE_SIZE; i += 2) {
+      const double r = std::sqrt(-2 * std::log(1 - uniform()));
+      const double phi = 2 * M_PI * uniform();
+      m_gaussTable[i] = r * std::cos(phi);
+      m_gaussTable[i + 1] = r * std::sin(phi);
+    }
+
+    //Determine geometry and frame size by converting an empty frame
+    ADCValues adcValues;
+    convert(std::vector<unsigned char>(2 * MAX_GATES * MAX_GATES * sizeof(RawData::value_type)), 0, adcValues, m_frameWords);
+    m_sizeX = adcValues.getSizeX();
+    m_sizeY = adcValues.getSizeY();
+    if (m_sizeX * m_sizeY == 0 || m_frameWords == 0) {
+      throw Exception("Could not determine frame size for device type");
+    }
+    m_elementSize = m_frameWords * sizeof(RawData::value_type) / (m_sizeX * m_sizeY);
+    m_values.resize(m_sizeX * m_sizeY);
+
+    //The start gate rotates the mapping, find out after how many gates it repeats
+    const std::vector<int>& firstMapping = getMapping(0);
+    m_gates = MAX_GATES;
+    for (int gate = 1; gate < MAX_GATES; ++gate) {
+      if (getMapping(gate) == firstMapping) {
+        m_gates = gate;
+        break;
+      }
+    }
+  }
+
+  void DataGenerator::checkModuleNr(int moduleNr)
+  {
+    if (moduleNr < 0 || moduleNr > RawData::MAX_MODULE_NO) {
+      std::ostringstream message;
+      message << "Module number " << moduleNr << " is outside of 0-" << RawData::MAX_MODULE_NO;
+      throw Exception(message.str());
+    }
+  }
+
+  void DataGenerator::addModule(int moduleNr, double pedestal, double pedestalSpread, double noise, double noiseSpread)
+  {
+    checkModuleNr(moduleNr);
+    ModuleCalibration module(moduleNr);
+    module.mask.setSize(m_sizeX, m_sizeY);
+    module.pedestals.setSize(m_sizeX, m_sizeY);
+    module.noise.setSize(m_sizeX, m_sizeY);
+    for (size_t i = 0; i < module.pedestals.getSize(); ++i) {
+      module.pedestals[i] = pedestal + pedestalSpread * gauss();
+      module.noise[i] = std::max(0.0, noise + noiseSpread * gauss());
+    }
+    m_modules.push_back(module);
+  }
+
+  void DataGenerator::addModule(const ModuleCalibration& calibration)
+  {
+    checkModuleNr(calibration.moduleNr);
+    if (calibration.pedestals.getSizeX() != m_sizeX || calibration.pedestals.getSizeY() != m_sizeY ||
+        calibration.noise.getSizeX() != m_sizeX || calibration.noise.getSizeY() != m_sizeY) {
+      throw Exception("Dimensions do not match");
+    }
+    m_modules.push_back(calibration);
+  }
+
+  int DataGenerator::poisson(double mean)
+  {
+    if (mean <= 0) return 0;
+    if (mean > 30) return std::max(0, clamp(mean + std::sqrt(mean) * gauss(), 0, 1 << 30));
+    const double limit = std::exp(-mean);
+    int n(0);
+    double p = uniform();
+    while (p > limit) {
+      ++n;
+      p *= uniform();
+    }
+    return n;
+  }
+
+  void DataGenerator::convert(const std::vector<unsigned char>& elements, int startGate, ADCValues& adcValues, size_t& frameWords)
+  {
+    //Build a complete record and let RawData read it like from a file
+    std::vector<RawData::value_type> record;
+    appendHeader(record, m_deviceType, EVENTTYPE_DATA, 0, 0);
+    RawData::InfoWord info;
+    std::memset(&info, 0, sizeof(info));
+    info.startGate = startGate;
+    record.push_back(0);
+    std::memcpy(&record.back(), &info, sizeof(info));
+    const size_t pos = record.size();
+    record.resize(pos + (elements.size() + sizeof(RawData::value_type) - 1) / sizeof(RawData::value_type));
+    std::memcpy(&record[pos], &elements.front(), elements.size());
+    finishHeader(record, 0);
+
+    std::istringstream stream(std::string((const char*) &record.front(), record.size() * sizeof(RawData::value_type)));
+    RawData rawData(stream);
+    rawData.readHeader();
+    rawData.readData();
+    DataReader reader;
+    reader.setReadoutFold(m_fold);
+    reader.setUseDCDBMapping(m_useDCDBMapping);
+    frameWords = reader.convertData(rawData, adcValues);
+  }
+
+  const std::vector<int>& DataGenerator::getMapping(int startGate)
+  {
+    //Values with 32bit per pixel contain the pixel position, so the order does not matter
+    if (m_elementSize >= sizeof(RawData::value_type)) startGate = 0;
+    std::vector<int>& mapping = m_mappings[startGate];
+    if (!mapping.empty()) return mapping;
+
+    const size_t nPixels = m_sizeX * m_sizeY;
+    mapping.resize(nPixels);
+    if (m_elementSize >= sizeof(RawData::value_type)) {
+      for (size_t i = 0; i < nPixels; ++i) mapping[i] = i;
+      return mapping;
+    }
+
+    //Mark each element with its index, one byte at a time, and see where it ends up
+    std::vector<int> index(nPixels, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+      std::vector<unsigned char> elements(nPixels * m_elementSize);
+      for (size_t i = 0; i < nPixels; ++i) elements[i * m_elementSize] = (i >> (8 * pass)) & 0xff;
+      ADCValues adcValues;
+      size_t frameWords;
+      convert(elements, startGate, adcValues, frameWords);
+      for (size_t pixel = 0; pixel < nPixels; ++pixel) {
+        index[pixel] |= ((int) adcValues[pixel] & 0xff) << (8 * pass);
+      }
+    }
+
+    //Invert and check that every element is used exactly once
+    std::vector<int> used(nPixels, 0);
+    for (size_t pixel = 0; pixel < nPixels; ++pixel) {
+      if (index[pixel] >= (int) nPixels || used[index[pixel]]++) {
+        throw Exception("Could not determine raw data layout, converter is not a permutation");
+      }
+      mapping[index[pixel]] = pixel;
+    }
+    return mapping;
+  }
+
+  void DataGenerator::fillFrame(const ModuleCalibration& module, bool addHits)
+  {
+    //Common mode per row and pedestal shift due to temperature change
+    const double shift = (m_temperature - m_startTemperature) * m_pedestalShift;
+    std::vector<double> rowOffset(m_sizeY, shift);
+    if (m_commonMode > 0) {
+      for (size_t y = 0; y < m_sizeY; ++y) rowOffset[y] += m_commonMode * gauss();
+    }
+    const double* pedestals = module.pedestals.getData();
+    const double* noise = module.noise.getData();
+    for (size_t x = 0; x < m_sizeX; ++x) {
+      for (size_t y = 0; y < m_sizeY; ++y) {
+        const size_t i = x * m_sizeY + y;
+        m_values[i] = pedestals[i] + rowOffset[y] + noise[i] * gauss();
+      }
+    }
+    if (!addHits) return;
+
+    //Hits share their charge with the direct neighbours
+    const int nHits = poisson(m_hitsPerFrame);
+    for (int hit = 0; hit < nHits; ++hit) {
+      const int x = random() % m_sizeX;
+      const int y = random() % m_sizeY;
+      const double charge = m_signal * (0.5 - 0.5 * std::log(1 - uniform()));
+      m_values[x * m_sizeY + y] += 0.6 * charge;
+      if (x > 0) m_values[(x - 1) * m_sizeY + y] += 0.1 * charge;
+      if (x + 1 < (int) m_sizeX) m_values[(x + 1) * m_sizeY + y] += 0.1 * charge;
+      if (y > 0) m_values[x * m_sizeY + y - 1] += 0.1 * charge;
+      if (y + 1 < (int) m_sizeY) m_values[x * m_sizeY + y + 1] += 0.1 * charge;
+    }
+  }
+
+  void DataGenerator::encodeFrame(int startGate)
+  {
+    const std::vector<int>& mapping = getMapping(startGate);
+    const size_t pos = m_buffer.size();
+    m_buffer.resize(pos + m_frameWords);
+    const size_t nPixels = m_sizeX * m_sizeY;
+    switch (m_elementSize) {
+      case 4: { //S3A: position is encoded with the value
+        unsigned int* raw = (unsigned int*) &m_buffer[pos];
+        for (size_t i = 0; i < nPixels; ++i) {
+          const int pixel = mapping[i];
+          const unsigned int x = pixel / m_sizeY;
+          const unsigned int y = pixel % m_sizeY;
+          raw[i] = (y << 22) | (x << 16) | clamp(m_values[pixel], 0, 0xffff);
+        }
+        break;
+      }
+      case 2: { //S3B: 16bit unsigned values
+        unsigned short* raw = (unsigned short*) &m_buffer[pos];
+        for (size_t i = 0; i < nPixels; ++i) raw[i] = clamp(m_values[mapping[i]], 0, 0xffff);
+        break;
+      }
+      default: { //DCD: 8bit signed values
+        signed char* raw = (signed char*) &m_buffer[pos];
+        for (size_t i = 0; i < nPixels; ++i) raw[i] = clamp(m_values[mapping[i]], -128, 127);
+      }
+    }
+  }
+
+  void DataGenerator::writeRunHeader(std::ostream& output)
+  {
+    m_buffer.clear();
+    appendHeader(m_buffer, DEVICETYPE_INFO, EVENTTYPE_RUN_BEGIN, 0, m_runNumber);
+    output.write((const char*) &m_buffer.front(), m_buffer.size() * sizeof(RawData::value_type));
+  }
+
+  size_t DataGenerator::getEventSize() const
+  {
+    //Group header, then per module a record header, the info word and all frames
+    const size_t recordSize = HEADER_WORDS + 1 + (m_trailingFrames + 1) * m_frameWords;
+    return HEADER_WORDS + m_modules.size() * recordSize;
+  }
+
+  void DataGenerator::writeEvent(std::ostream& output)
+  {
+    const unsigned int triggerNumber = m_events + 1;
+    const int startGate = m_rotateStartGate ? random() % m_gates : 0;
+    RawData::InfoWord info;
+    std::memset(&info, 0, sizeof(info));
+    info.framecnt = m_events;
+    info.startGate = startGate;
+    info.startgate_ver = 1;
+    info.temperature = clamp(m_temperature * 4, 0, 1023);
+
+    m_buffer.clear();
+    appendHeader(m_buffer, DEVICETYPE_GROUP, EVENTTYPE_DATA, 0, triggerNumber);
+    for (size_t i = 0; i < m_modules.size(); ++i) {
+      const size_t recordStart = m_buffer.size();
+      appendHeader(m_buffer, m_deviceType, EVENTTYPE_DATA, m_modules[i].moduleNr, triggerNumber);
+      m_buffer.push_back(0);
+      std::memcpy(&m_buffer.back(), &info, sizeof(info));
+      for (int frame = 0; frame <= m_trailingFrames; ++frame) {
+        fillFrame(m_modules[i], frame == 0);
+        encodeFrame(startGate);
+      }
+      finishHeader(m_buffer, recordStart);
+    }
+    finishHeader(m_buffer, 0);
+    output.write((const char*) &m_buffer.front(), m_buffer.size() * sizeof(RawData::value_type));
+
+    ++m_events;
+    m_temperature += m_temperatureDrift;
+  }
+
+  void DataGenerator::writeRunTrailer(std::ostream& output)
+  {
+    m_buffer.clear();
+    appendHeader(m_buffer, DEVICETYPE_GROUP, EVENTTYPE_RUN_END, 0, m_events);
+    output.write((const char*) &m_buffer.front(), m_buffer.size() * sizeof(RawData::value_type));
+  }
+
+}
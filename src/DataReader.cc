@@ -1,21 +1,42 @@
 #include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/EventBuilder.h>
 #include <DEPFETReader/S3AConverter.h>
 #include <DEPFETReader/S3BConverter.h>
 #include <DEPFETReader/DCDConverter.h>
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 namespace DEPFET {
 
+  DataReader::~DataReader()
+  {
+    delete m_builder;
+  }
+
   void DataReader::open(const std::vector<std::string>& filenames, int nEvents)
   {
     //Close open files
-    m_file.close();
+    m_fileBuffer.close();
+    m_streamBuffer.close();
     m_file.clear();
+    delete m_builder;
+    m_builder = 0;
 
     //Set number of events
     m_nEvents = nEvents;
     m_eventNumber = 0;
+    m_putBack = false;
+    m_skipped.clear();
+
+    //Read all files at the same time and merge them by trigger number
+    if (m_merge) {
+      m_filenames.clear();
+      m_builder = new EventBuilder(m_fold, m_useDCDBMapping, m_recover);
+      m_builder->setFollow(m_follow, m_followTimeout, m_followHandler);
+      m_builder->open(filenames);
+      return;
+    }
 
     //Set list of filenames to read in succession
     m_filenames = filenames;
@@ -29,12 +50,29 @@ namespace DEPFET {
     //Open the next file from the stack of files
     std::string filename = m_filenames.back();
     //std::cout << "Opening " << filename << std::endl;
-    m_file.close();
-    m_file.clear();
-    m_file.open(filename.c_str(), std::ios::in | std::ios::binary);
-    if (!m_file) {
-      throw std::runtime_error("Error opening file " + filename);
+    m_fileBuffer.close();
+    m_streamBuffer.close();
+    m_stream = StreamBuffer::isStream(filename);
+    if (m_stream) {
+      //Streams cannot go back to search for valid data and have no known size
+      if (m_recover) {
+        throw std::runtime_error("Recovery from corrupted data is not possible when reading from " + filename);
+      }
+      m_streamBuffer.open(filename);
+      m_file.rdbuf(&m_streamBuffer);
+      m_fileSize = std::numeric_limits<std::streamoff>::max();
+    } else {
+      if (!m_fileBuffer.open(filename.c_str(), std::ios::in | std::ios::binary)) {
+        throw std::runtime_error("Error opening file " + filename);
+      }
+      m_file.rdbuf(&m_fileBuffer);
+      m_file.seekg(0, std::ios::end);
+      m_fileSize = m_file.tellg();
+      m_file.seekg(0, std::ios::beg);
     }
+    m_verified = 0;
+    m_recordEnd = 0;
+    if (m_follow && !m_stream && m_filenames.size() == 1) m_watcher.watch(filename);
     return true;
   }
 
@@ -42,11 +80,20 @@ namespace DEPFET {
   {
     //Read one header from file. If an error occured, try the next file
     while (true) {
-      m_rawData.readHeader();
+      //Only the last file can still be written to, streams wait for data anyway
+      if (m_follow && !m_stream && m_filenames.size() == 1 && !waitForRecord()) return false;
+      {
+        StageTimer timer(m_stats, ProcessingStats::READ);
+        m_rawData.readHeader();
+      }
       //No error, so return true
-      if (!m_file.fail()) return true;
+      if (!m_file.fail()) {
+        m_stats[ProcessingStats::READ].bytes += sizeof(RawData::Header);
+        return true;
+      }
 
       //We have an error, check if there is an additional file to open
+      if (m_filenames.empty()) return false;
       m_filenames.pop_back();
       if (!openFile()) return false;
     }
@@ -54,6 +101,8 @@ namespace DEPFET {
 
   bool DataReader::skip(int nEvents)
   {
+    //Nothing to skip, keep an event which was put back
+    if (nEvents <= 0) return true;
     m_event.clear();
     for (int i = 0; i < nEvents; ++i) {
       if (!next(true)) return false;
@@ -61,8 +110,24 @@ namespace DEPFET {
     return true;
   }
 
+  void DataReader::putBack()
+  {
+    if (m_putBack) return;
+    m_putBack = true;
+    if (m_nEvents > 0) --m_eventNumber;
+  }
+
   bool DataReader::next(bool skip)
   {
+    if (m_putBack) {
+      m_putBack = false;
+      return skip || m_nEvents <= 0 || ++m_eventNumber <= m_nEvents;
+    }
+    if (m_builder) {
+      //Skipping still has to read all files to find the matching triggers
+      if (!skip && m_nEvents > 0 && ++m_eventNumber > m_nEvents) return false;
+      return m_builder->next(m_event);
+    }
     if (!skip) {
       m_event.clear();
       ++m_eventNumber;
@@ -71,6 +136,12 @@ namespace DEPFET {
     }
 
     while (readHeader()) {
+      //Offset of the record, only needed to recover from corrupted data
+      const std::streamoff offset = m_recover ? (std::streamoff) m_file.tellg() - sizeof(RawData::Header) : 0;
+      if (m_recover && !checkHeader(offset)) {
+        resync();
+        continue;
+      }
       if (m_rawData.getDeviceType() == DEVICETYPE_INFO) {
         m_event.setRunNumber(m_rawData.getTriggerNr());
         continue;
@@ -79,17 +150,32 @@ namespace DEPFET {
         if (m_rawData.getEventType() == EVENTTYPE_DATA) {
           //If we are in skipping mode we don't read the data
           if (skip) {
+            StageTimer timer(m_stats, ProcessingStats::READ);
             m_rawData.skipData();
+            if (m_recover) m_verified = m_file.tellg();
             return true;
           }
 
           //Read event data
           m_event.setEventNumber(m_rawData.getTriggerNr());
-          readEvent(m_rawData.getEventSize() - 2);
+          if (!m_recover) {
+            readEvent(m_rawData.getEventSize() - 2);
+          } else {
+            try {
+              readEvent(m_rawData.getEventSize() - 2);
+            } catch (std::runtime_error&) {
+              resync();
+              continue;
+            }
+            m_verified = m_file.tellg();
+          }
+          ++m_stats[ProcessingStats::READ].events;
+          ++m_stats[ProcessingStats::CONVERT].events;
           return true;
         }
       }
       //Skip all other headers
+      StageTimer timer(m_stats, ProcessingStats::READ);
       m_rawData.skipData();
     }
     return false;
@@ -109,9 +195,17 @@ namespace DEPFET {
       if (dataSize < 0) {
         throw std::runtime_error("Eventsize does not fit into remaining data size");
       }
+      if (m_recover && !HeaderScanner::isValidModule(m_rawData.getHeader())) {
+        throw std::runtime_error("Invalid module record");
+      }
 
       //Read data
-      m_rawData.readData();
+      {
+        StageTimer timer(m_stats, ProcessingStats::READ);
+        m_rawData.readData();
+        m_stats[ProcessingStats::READ].bytes += (m_rawData.getEventSize() - 2) * sizeof(RawData::value_type);
+      }
+      StageTimer timer(m_stats, ProcessingStats::CONVERT);
       size_t alreadyUsed = 0;
       int frameNr = 0;
       while (alreadyUsed < m_rawData.getDataSize()) {
@@ -120,14 +214,101 @@ namespace DEPFET {
         adcvalues.setModuleNr(m_rawData.getModuleNr());
         adcvalues.setTriggerNr(m_rawData.getTriggerNr());
         adcvalues.setStartGate(m_rawData.getStartGate());
+        adcvalues.setTemperature(m_rawData.getTemperature());
         adcvalues.setFrameNr(frameNr++);
-        alreadyUsed += convertData(m_rawData, adcvalues);
+        const size_t used = convertData(m_rawData, adcvalues);
+        alreadyUsed += used;
         m_rawData.setOffset(alreadyUsed);
+        ++m_stats[ProcessingStats::CONVERT].frames;
+        m_stats[ProcessingStats::CONVERT].bytes += used * sizeof(RawData::value_type);
       }
     }
   }
 
 
+  bool DataReader::checkHeader(std::streamoff offset)
+  {
+    const RawData::Header& header = m_rawData.getHeader();
+    if (!HeaderScanner::isKnownDeviceType(header.deviceType)) return false;
+    //Info records only consist of the header
+    if (header.deviceType == DEVICETYPE_INFO) return true;
+    return header.eventSize >= 2 && offset + (std::streamoff)(header.eventSize * sizeof(RawData::value_type)) <= m_fileSize;
+  }
+
+  void DataReader::resync()
+  {
+    //Start searching one byte after the last complete event
+    m_file.clear();
+    m_file.seekg(m_verified + 1);
+    SkippedRange skipped;
+    skipped.filename = m_filenames.back();
+    skipped.offset = m_verified;
+    {
+      StageTimer timer(m_stats, ProcessingStats::READ);
+      skipped.size = 1 + HeaderScanner::findEvent(m_file);
+    }
+    m_skipped.push_back(skipped);
+    m_verified += skipped.size;
+  }
+
+  bool DataReader::waitForRecord()
+  {
+    //Records inside the last complete top level record are already written
+    const std::streamoff position = m_file.tellg();
+    if (position >= 0 && position < m_recordEnd) return true;
+
+    bool waiting(false);
+    double lastData = StageTimer::getTime();
+    while (true) {
+      //Check if the header and the whole record are available
+      if (position >= 0 && position + (std::streamoff)sizeof(RawData::Header) <= m_fileSize) {
+        RawData::Header header;
+        m_file.read((char*)&header, sizeof(header));
+        m_file.seekg(position);
+        std::streamoff size = sizeof(RawData::Header);
+        if (header.deviceType != DEVICETYPE_INFO) {
+          size = std::max(size, (std::streamoff)(header.eventSize * sizeof(RawData::value_type)));
+        }
+        if (m_file && position + size <= m_fileSize) {
+          m_recordEnd = position + size;
+          return true;
+        }
+      }
+      if (!waiting && m_followHandler) m_followHandler->waitingForData();
+      waiting = true;
+
+      //Wait for the file to grow and start again from the beginning of the record
+      const double now = StageTimer::getTime();
+      if (m_followTimeout > 0 && now - lastData >= m_followTimeout) return false;
+      m_watcher.wait(m_followTimeout > 0 ? m_followTimeout - (now - lastData) : FileWatcher::maxWait);
+      const long long fileSize = FileWatcher::getFileSize(m_filenames.back());
+      if (fileSize > m_fileSize) {
+        m_fileSize = fileSize;
+        lastData = StageTimer::getTime();
+      }
+      m_file.clear();
+      m_file.seekg(position);
+    }
+  }
+
+  const std::vector<SkippedRange>& DataReader::getSkippedRanges() const
+  {
+    if (m_builder) return m_builder->getSkippedRanges();
+    return m_skipped;
+  }
+
+  const ProcessingStats& DataReader::getStats() const
+  {
+    if (m_builder) return m_builder->getStats();
+    return m_stats;
+  }
+
+  void DataReader::clearStats()
+  {
+    if (m_builder) m_builder->clearStats();
+    m_stats.clear();
+  }
+
   size_t DataReader::convertData(RawData& rawdata, ADCValues& adcvalues)
   {
     switch (rawdata.getDeviceType()) {
@@ -0,0 +1,144 @@
+#include <DEPFETReader/EventBuilder.h>
+
+#include <algorithm>
+#include <boost/format.hpp>
+
+namespace DEPFET {
+
+  void EventBuilder::open(const std::vector<std::string>& filenames)
+  {
+    close();
+    m_incomplete = 0;
+    m_events = 0;
+    m_streams.resize(filenames.size());
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      Stream& stream = m_streams[i];
+      stream.filename = filenames[i];
+      stream.reader = new DataReader();
+      stream.reader->setReadoutFold(m_fold);
+      stream.reader->setUseDCDBMapping(m_useDCDBMapping);
+      stream.reader->setRecovery(m_recover);
+      stream.reader->setFollow(m_follow, m_followTimeout, m_followHandler);
+      stream.active = false;
+      stream.started = false;
+      stream.trigger = 0;
+      stream.missing = 0;
+      stream.duplicates = 0;
+      stream.unordered = 0;
+    }
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      m_streams[i].reader->open(std::vector<std::string>(1, filenames[i]));
+      advance(m_streams[i]);
+    }
+  }
+
+  void EventBuilder::close()
+  {
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      delete m_streams[i].reader;
+    }
+    m_streams.clear();
+  }
+
+  void EventBuilder::advance(Stream& stream)
+  {
+    const bool hasPrevious = stream.started;
+    const unsigned int previous = stream.trigger;
+    while (stream.reader->next()) {
+      const unsigned int trigger = stream.reader->getEvent().getEventNumber();
+      if (hasPrevious && trigger == previous) {
+        ++stream.duplicates;
+        continue;
+      }
+      if (hasPrevious && trigger < previous) {
+        ++stream.unordered;
+        continue;
+      }
+      stream.trigger = trigger;
+      stream.active = true;
+      stream.started = true;
+      return;
+    }
+    stream.active = false;
+  }
+
+  bool EventBuilder::next(Event& event)
+  {
+    //Find the smallest pending trigger number
+    bool found(false);
+    unsigned int trigger(0);
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      if (!m_streams[i].active) continue;
+      if (!found || m_streams[i].trigger < trigger) trigger = m_streams[i].trigger;
+      found = true;
+    }
+    if (!found) return false;
+
+    //Move the frames of all streams with that trigger into the event. The
+    //frames are swapped, the reader will overwrite its copy with the next event
+    size_t index(0);
+    bool first(true);
+    bool complete(true);
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      Stream& stream = m_streams[i];
+      if (!stream.active || stream.trigger != trigger) {
+        ++stream.missing;
+        complete = false;
+        continue;
+      }
+      Event& streamEvent = stream.reader->getEvent();
+      if (first) {
+        event.setRunNumber(streamEvent.getRunNumber());
+        event.setEventNumber(streamEvent.getEventNumber());
+        first = false;
+      }
+      if (event.size() < index + streamEvent.size()) event.resize(index + streamEvent.size());
+      for (size_t frame = 0; frame < streamEvent.size(); ++frame) {
+        std::swap(event[index++], streamEvent[frame]);
+      }
+      advance(stream);
+    }
+    event.resize(index);
+    if (!complete) ++m_incomplete;
+    ++m_events;
+    return true;
+  }
+
+  const ProcessingStats& EventBuilder::getStats() const
+  {
+    m_stats.clear();
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      m_stats.merge(m_streams[i].reader->getStats());
+    }
+    return m_stats;
+  }
+
+  void EventBuilder::clearStats()
+  {
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      m_streams[i].reader->clearStats();
+    }
+  }
+
+  const std::vector<SkippedRange>& EventBuilder::getSkippedRanges() const
+  {
+    m_skipped.clear();
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      const std::vector<SkippedRange>& skipped = m_streams[i].reader->getSkippedRanges();
+      m_skipped.insert(m_skipped.end(), skipped.begin(), skipped.end());
+    }
+    return m_skipped;
+  }
+
+  void EventBuilder::printSummary(std::ostream& output) const
+  {
+    output << "Event building: " << m_events << " events from " << m_streams.size() << " files, "
+           << m_incomplete << " incomplete" << std::endl;
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      const Stream& stream = m_streams[i];
+      output << boost::format("  %-40s %10d missing %10d duplicate %10d out of order\n")
+             % stream.filename % stream.missing % stream.duplicates % stream.unordered;
+    }
+  }
+
+}
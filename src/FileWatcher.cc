@@ -0,0 +1,58 @@
+#include <DEPFETReader/FileWatcher.h>
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace DEPFET {
+
+  const double FileWatcher::maxWait = 0.2;
+
+  void FileWatcher::watch(const std::string& filename)
+  {
+    close();
+#ifdef __linux__
+    m_fd = inotify_init();
+    if (m_fd < 0) return;
+    m_wd = inotify_add_watch(m_fd, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE);
+    if (m_wd < 0) close();
+#endif
+  }
+
+  void FileWatcher::close()
+  {
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+    m_wd = -1;
+  }
+
+  bool FileWatcher::wait(double timeout)
+  {
+    const int ms = static_cast<int>(std::max(0.0, std::min(timeout, maxWait)) * 1000);
+    if (m_fd < 0) {
+      usleep(ms * 1000);
+      return false;
+    }
+    pollfd fds;
+    fds.fd = m_fd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (poll(&fds, 1, ms) <= 0) return false;
+    //Drain all pending events, we only need to know that something changed
+    char buffer[4096];
+    if (read(m_fd, buffer, sizeof(buffer)) < 0) return false;
+    return true;
+  }
+
+  long long FileWatcher::getFileSize(const std::string& filename)
+  {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) return -1;
+    return info.st_size;
+  }
+
+}
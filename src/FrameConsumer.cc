@@ -0,0 +1,336 @@
+#include <DEPFETReader/FrameConsumer.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cmath>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include <boost/format.hpp>
+
+namespace DEPFET {
+
+  namespace {
+    /** Return the filename for a module, replacing %1% by the module number if present */
+    std::string getModuleFilename(const std::string& pattern, int moduleNr)
+    {
+      boost::format filename(pattern);
+      filename.exceptions(boost::io::all_error_bits ^ boost::io::too_many_args_bit);
+      return (filename % moduleNr).str();
+    }
+
+    /** Open an output file, throws an Exception on error */
+    void openOutput(std::ofstream& output, const std::string& filename)
+    {
+      output.open(filename.c_str());
+      if (!output) {
+        throw Exception("Could not open output file " + filename);
+      }
+    }
+
+    /** Close an output file, throws an Exception if writing failed */
+    void closeOutput(std::ofstream& output, const std::string& filename)
+    {
+      output.close();
+      if (output.fail()) {
+        throw Exception("Error writing output file " + filename);
+      }
+    }
+
+    /** Close a file written under a temporary name and move it to its final
+     * name, so that readers never see a partially written file */
+    void replaceOutput(std::ofstream& output, const std::string& temporary, const std::string& filename)
+    {
+      closeOutput(output, temporary);
+      if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        throw Exception("Could not rename " + temporary + " to " + filename);
+      }
+    }
+  }
+
+  void HitmapConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    PartialHitmap& hitmap = m_hitmaps[data.getModuleNr()];
+    if (!hitmap.sums) {
+      hitmap.sums.setSize(data);
+      hitmap.mask.setSize(data);
+    }
+    //The mask can change during the run if hot pixels are masked
+    hitmap.mask.set(mask);
+    ++hitmap.frames;
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (data(x, y) > m_sigmaCut * noise(x, y)) hitmap.sums(x, y) += data(x, y);
+      }
+    }
+  }
+
+  void HitmapConsumer::finish()
+  {
+    for (std::map<int, PartialHitmap>::iterator it = m_hitmaps.begin(); it != m_hitmaps.end(); ++it) {
+      it->second.events = m_events;
+      if (!m_partialFilename.empty()) {
+        PartialResult::write(getModuleFilename(m_partialFilename, it->first), it->second);
+      }
+      write(it->first, it->second);
+    }
+  }
+
+  void HitmapConsumer::snapshot()
+  {
+    for (std::map<int, PartialHitmap>::const_iterator it = m_hitmaps.begin(); it != m_hitmaps.end(); ++it) {
+      write(it->first, it->second);
+    }
+  }
+
+  void HitmapConsumer::write(int moduleNr, const PartialHitmap& hitmap) const
+  {
+    const std::string filename = getModuleFilename(m_filename, moduleNr);
+    const std::string temporary = filename + ".tmp";
+    std::ofstream output;
+    openOutput(output, temporary);
+    //Mark masked pixels
+    ValueMatrix<double> sums(hitmap.sums);
+    sums.substract(hitmap.mask, 1e4);
+    output << sums.getSizeX() << " " << sums.getSizeY() << std::endl;
+    for (unsigned int col = 0; col < sums.getSizeX(); ++col) {
+      for (unsigned int row = 0; row < sums.getSizeY(); ++row) {
+        output << sums(col, row) << " ";
+      }
+      output << std::endl;
+    }
+    replaceOutput(output, temporary, filename);
+  }
+
+  DumpConsumer::DumpConsumer(const std::string& filename, double sigmaCut): FrameConsumer(sigmaCut), m_filename(filename)
+  {
+    openOutput(m_output, filename);
+  }
+
+  void DumpConsumer::beginEvent(const Event& event)
+  {
+    m_output << "event " << event.getRunNumber() << " " << event.getEventNumber() << " " << event.size() << std::endl;
+  }
+
+  void DumpConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    m_output << "module " << data.getModuleNr() << " " << data.getSizeX() << " " << data.getSizeY() << std::endl;
+    m_output << std::setprecision(2) << std::fixed;
+    for (size_t y = 0; y < data.getSizeY(); ++y) {
+      for (size_t x = 0; x < data.getSizeX(); ++x) {
+        double adc = data(x, y);
+        if (adc < noise(x, y) * m_sigmaCut || std::isnan(adc)) adc = 0;
+        if (mask(x, y)) adc = -1;
+        m_output << std::setw(8) << adc << " ";
+      }
+      m_output << std::endl;
+    }
+  }
+
+  void DumpConsumer::endEvent(const Event&)
+  {
+    m_output << std::endl;
+  }
+
+  void DumpConsumer::finish()
+  {
+    closeOutput(m_output, m_filename);
+  }
+
+  HitListConsumer::HitListConsumer(const std::string& filename, double sigmaCut):
+    FrameConsumer(sigmaCut), m_filename(filename), m_eventNumber(0)
+  {
+    openOutput(m_output, filename);
+  }
+
+  void HitListConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (!isHit(data, mask, noise, x, y)) continue;
+        m_output << m_eventNumber << " " << data.getModuleNr() << " " << data.getFrameNr() << " "
+                 << x << " " << y << " " << data(x, y) << "\n";
+      }
+    }
+  }
+
+  void HitListConsumer::finish()
+  {
+    closeOutput(m_output, m_filename);
+  }
+
+  void OccupancyConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    Occupancy& occupancy = m_occupancy[data.getModuleNr()];
+    if (!occupancy.hits) occupancy.hits.setSize(data);
+    uint64_t hits(0);
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (!isHit(data, mask, noise, x, y)) continue;
+        ++occupancy.hits(x, y);
+        ++hits;
+      }
+    }
+    ++occupancy.frames;
+    occupancy.maxHits = std::max(occupancy.maxHits, hits);
+  }
+
+  void OccupancyConsumer::write() const
+  {
+    const std::string temporary = m_filename + ".tmp";
+    std::ofstream output;
+    openOutput(output, temporary);
+    for (std::map<int, Occupancy>::const_iterator it = m_occupancy.begin(); it != m_occupancy.end(); ++it) {
+      const Occupancy& occupancy = it->second;
+      uint64_t total(0);
+      for (size_t i = 0; i < occupancy.hits.getSize(); ++i) total += occupancy.hits[i];
+      const double frames = std::max<uint64_t>(occupancy.frames, 1);
+      output << "module " << it->first << " frames " << occupancy.frames << " hits/frame " << total / frames
+             << " max " << occupancy.maxHits << " occupancy " << total / frames / std::max<size_t>(occupancy.hits.getSize(), 1)
+             << std::endl;
+      output << occupancy.hits.getSizeX() << " " << occupancy.hits.getSizeY() << std::endl;
+      for (unsigned int col = 0; col < occupancy.hits.getSizeX(); ++col) {
+        for (unsigned int row = 0; row < occupancy.hits.getSizeY(); ++row) {
+          output << occupancy.hits(col, row) / frames << " ";
+        }
+        output << std::endl;
+      }
+    }
+    replaceOutput(output, temporary, m_filename);
+  }
+
+  SharedHitmapConsumer::~SharedHitmapConsumer()
+  {
+    for (std::map<int, Module>::iterator it = m_modules.begin(); it != m_modules.end(); ++it) {
+      delete it->second.shared;
+    }
+  }
+
+  void SharedHitmapConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    Module& module = m_modules[data.getModuleNr()];
+    if (!module.shared) {
+      module.sums.setSize(data);
+      module.mask.setSize(data);
+      module.shared = new SharedHitmap();
+      module.shared->create(getModuleFilename(m_name, data.getModuleNr()), data.getModuleNr(), data.getSizeX(), data.getSizeY());
+    }
+    module.mask.set(mask);
+    uint64_t hits(0);
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (data(x, y) <= m_sigmaCut * noise(x, y)) continue;
+        module.sums(x, y) += data(x, y);
+        if (mask(x, y)) continue;
+        ++hits;
+        module.summary.signal += data(x, y);
+      }
+    }
+    HitmapSummary& summary = module.summary;
+    ++summary.frames;
+    summary.lastHits = hits;
+    summary.maxHits = std::max(summary.maxHits, hits);
+    summary.hits += hits;
+  }
+
+  void SharedHitmapConsumer::snapshot()
+  {
+    for (std::map<int, Module>::iterator it = m_modules.begin(); it != m_modules.end(); ++it) {
+      Module& module = it->second;
+      module.summary.events = m_events;
+      //Mark masked pixels like the hitmap output
+      ValueMatrix<double> sums(module.sums);
+      sums.substract(module.mask, 1e4);
+      module.shared->publish(sums, module.summary);
+    }
+  }
+
+  ClusterConsumer::ClusterConsumer(const std::string& filename, double sigmaCut):
+    FrameConsumer(sigmaCut), m_filename(filename), m_clusterizer(sigmaCut), m_eventNumber(0), m_clusters(0)
+  {
+    m_output.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_output) {
+      throw Exception("Could not open output file " + filename);
+    }
+    const uint32_t format[2] = {VERSION, sizeof(Record)};
+    m_output.write("DEPFETCL", 8);
+    m_output.write((const char*)format, sizeof(format));
+  }
+
+  void ClusterConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    const std::vector<Cluster>& clusters = m_clusterizer.findClusters(data, mask, noise);
+    Record record;
+    record.event = m_eventNumber;
+    record.module = data.getModuleNr();
+    record.frame = data.getFrameNr();
+    for (size_t i = 0; i < clusters.size(); ++i) {
+      const Cluster& cluster = clusters[i];
+      record.charge = cluster.charge;
+      record.seed = cluster.seed;
+      record.col = cluster.col;
+      record.row = cluster.row;
+      record.size = cluster.size;
+      m_output.write((const char*)&record, sizeof(record));
+    }
+    m_clusters += clusters.size();
+  }
+
+  void ClusterConsumer::finish()
+  {
+    closeOutput(m_output, m_filename);
+  }
+
+  FrameSummaryConsumer::FrameSummaryConsumer(const std::string& filename, double sigmaCut, const CommonMode* commonMode):
+    FrameConsumer(sigmaCut), m_filename(filename), m_commonMode(commonMode), m_eventNumber(0)
+  {
+    m_output.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_output) {
+      throw Exception("Could not open output file " + filename);
+    }
+    const uint32_t format[2] = {VERSION, sizeof(Record)};
+    m_output.write("DEPFETDQ", 8);
+    m_output.write((const char*)format, sizeof(format));
+  }
+
+  void FrameSummaryConsumer::processFrame(const ADCValues& data, const MaskView& mask, const ValueView& noise)
+  {
+    double sum(0), sum2(0);
+    size_t pixels(0), hits(0);
+    for (size_t x = 0; x < data.getSizeX(); ++x) {
+      for (size_t y = 0; y < data.getSizeY(); ++y) {
+        if (mask(x, y)) continue;
+        const double value = data(x, y);
+        sum += value;
+        sum2 += value * value;
+        ++pixels;
+        if (value > m_sigmaCut * noise(x, y)) ++hits;
+      }
+    }
+    Record record;
+    record.event = m_eventNumber;
+    record.module = data.getModuleNr();
+    record.frame = data.getFrameNr();
+    record.startGate = data.getStartGate();
+    record.temperature = data.getTemperature();
+    record.mean = pixels ? sum / pixels : 0;
+    record.rms = pixels ? std::sqrt(std::max(sum2 / pixels - record.mean * record.mean, 0.0)) : 0;
+    record.occupancy = pixels ? (double)hits / pixels : 0;
+    record.minCommonMode = 0;
+    record.maxCommonMode = 0;
+    if (m_commonMode) {
+      m_corrections = m_commonMode->getCommonModesRow();
+      m_corrections.insert(m_corrections.end(), m_commonMode->getCommonModesCol().begin(), m_commonMode->getCommonModesCol().end());
+      if (!m_corrections.empty()) {
+        record.minCommonMode = *std::min_element(m_corrections.begin(), m_corrections.end());
+        record.maxCommonMode = *std::max_element(m_corrections.begin(), m_corrections.end());
+      }
+    }
+    m_output.write((const char*)&record, sizeof(record));
+  }
+
+  void FrameSummaryConsumer::finish()
+  {
+    closeOutput(m_output, m_filename);
+  }
+
+}
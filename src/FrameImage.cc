@@ -0,0 +1,85 @@
+#include <DEPFETReader/FrameImage.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace DEPFET {
+
+  void writePGM(const std::string& filename, const ValueMatrix<double>& values, const MaskView& mask, double maxValue)
+  {
+    if (maxValue <= 0) {
+      for (size_t i = 0; i < values.getSize(); ++i) {
+        if (!mask[i]) maxValue = std::max(maxValue, values[i]);
+      }
+    }
+    const double scale = maxValue > 0 ? 255 / maxValue : 0;
+    const size_t sizeX = values.getSizeX();
+    const size_t sizeY = values.getSizeY();
+    std::vector<unsigned char> image(sizeX * sizeY);
+    //Images start at the top, so the highest row comes first
+    for (size_t y = 0; y < sizeY; ++y) {
+      for (size_t x = 0; x < sizeX; ++x) {
+        const double value = mask(x, y) ? 0 : values(x, y) * scale;
+        image[(sizeY - 1 - y) * sizeX + x] = static_cast<unsigned char>(std::max(0.0, std::min(value, 255.0)) + 0.5);
+      }
+    }
+    std::ofstream output(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output) {
+      throw Exception("Could not open image file " + filename);
+    }
+    output << "P5\n" << sizeX << " " << sizeY << "\n255\n";
+    if (!image.empty()) output.write((char*)&image.front(), image.size());
+    output.close();
+    if (output.fail()) {
+      throw Exception("Error writing image file " + filename);
+    }
+  }
+
+  void FrameStack::open(const std::string& filename, size_t sizeX, size_t sizeY)
+  {
+    m_filename = filename;
+    m_images = 0;
+    m_output.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_output) {
+      throw Exception("Could not open frame stack " + filename);
+    }
+    memcpy(m_header.magic, "DEPFETFS", sizeof(m_header.magic));
+    m_header.version = VERSION;
+    m_header.sizeX = sizeX;
+    m_header.sizeY = sizeY;
+    m_header.padding = 0;
+    m_output.write((char*)&m_header, sizeof(m_header));
+    m_buffer.resize(sizeX * sizeY);
+  }
+
+  void FrameStack::write(const ValueMatrix<double>& values, const MaskView& mask, uint64_t firstEvent, uint32_t events)
+  {
+    if (values.getSizeX() != m_header.sizeX || values.getSizeY() != m_header.sizeY) {
+      throw Exception("Image size does not match frame stack " + m_filename);
+    }
+    RecordHeader record;
+    record.firstEvent = firstEvent;
+    record.events = events;
+    record.padding = 0;
+    for (size_t i = 0; i < values.getSize(); ++i) {
+      m_buffer[i] = mask[i] ? -1 : values[i];
+    }
+    m_output.write((char*)&record, sizeof(record));
+    if (!m_buffer.empty()) m_output.write((char*)&m_buffer.front(), m_buffer.size() * sizeof(float));
+    if (!m_output) {
+      throw Exception("Error writing frame stack " + m_filename);
+    }
+    ++m_images;
+  }
+
+  void FrameStack::close()
+  {
+    m_output.close();
+    if (m_output.fail()) {
+      throw Exception("Error writing frame stack " + m_filename);
+    }
+  }
+
+}
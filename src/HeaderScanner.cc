@@ -0,0 +1,296 @@
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/Exception.h>
+#include <DEPFETReader/S3AConverter.h>
+#include <DEPFETReader/S3BConverter.h>
+#include <DEPFETReader/DCDConverter.h>
+
+#include <cstring>
+#include <algorithm>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Granularity of reads from the file */
+    const uint64_t PAGE_SIZE = 4096;
+    /** Size of the blocks searched for the next event after an invalid record */
+    const size_t RESYNC_BLOCK_SIZE = 1 << 20;
+  }
+
+  HeaderScanner::HeaderScanner():
+    m_fd(-1), m_fileSize(0), m_position(0), m_pageOffset(0), m_pageSize(0), m_bytesRead(0), m_offset(0),
+    m_eventSize(0), m_triggerNr(0), m_runNumber(-1), m_damaged(false), m_runBegins(0), m_runEnds(0),
+    m_otherRecords(0), m_recover(false), m_verified(0)
+  {}
+
+  size_t HeaderScanner::getFrameWords(int deviceType)
+  {
+    //Take the sizes from the converters so both always agree. The fold
+    //only changes the order of the pixels, not the size of the frame
+    switch (deviceType) {
+      case DEVICETYPE_DEPFET:
+        return S3AConverter::FRAME_WORDS;
+      case DEVICETYPE_DEPFET_128:
+        return S3BConverter2Fold::FRAME_WORDS;
+      case DEVICETYPE_DEPFET_DCD:
+        return DCDConverter2Fold::FRAME_WORDS;
+      default:
+        return 0;
+    }
+  }
+
+  void HeaderScanner::open(const std::string& filename)
+  {
+    close();
+    m_fd = ::open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+      throw Exception("Error opening file " + filename);
+    }
+    struct stat info;
+    if (fstat(m_fd, &info) != 0) {
+      close();
+      throw Exception("Error opening file " + filename);
+    }
+#ifdef POSIX_FADV_RANDOM
+    //Only the pages containing headers are needed, reading ahead would read the whole file
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    m_filename = filename;
+    m_fileSize = info.st_size;
+    m_position = 0;
+    m_verified = 0;
+    m_pageSize = 0;
+    m_bytesRead = 0;
+    m_runNumber = -1;
+    m_damaged = false;
+    m_runBegins = 0;
+    m_runEnds = 0;
+    m_otherRecords = 0;
+    m_modules.clear();
+    m_skipped.clear();
+  }
+
+  void HeaderScanner::close()
+  {
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+  }
+
+  bool HeaderScanner::read(uint64_t offset, void* buffer, size_t size)
+  {
+    if (offset + size > m_fileSize) return false;
+    if (offset < m_pageOffset || offset + size > m_pageOffset + m_pageSize) {
+      //Read all pages containing the requested range
+      const uint64_t start = offset / PAGE_SIZE * PAGE_SIZE;
+      const uint64_t end = std::min(m_fileSize, (offset + size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE);
+      m_page.resize(end - start);
+      const ssize_t result = pread(m_fd, &m_page.front(), end - start, start);
+      if (result < (ssize_t)(offset + size - start)) {
+        throw Exception("Error reading from file " + m_filename);
+      }
+      m_pageOffset = start;
+      m_pageSize = result;
+      m_bytesRead += result;
+    }
+    std::memcpy(buffer, &m_page[offset - m_pageOffset], size);
+    return true;
+  }
+
+  bool HeaderScanner::isKnownDeviceType(int deviceType)
+  {
+    switch (deviceType) {
+      case DEVICETYPE_GROUP:
+      case DEVICETYPE_DEPFET:
+      case DEVICETYPE_DEPFET_128:
+      case DEVICETYPE_DEPFET_DCD:
+      case DEVICETYPE_BAT:
+      case DEVICETYPE_TPLL:
+      case DEVICETYPE_UNKNOWN:
+      case DEVICETYPE_TLU:
+      case DEVICETYPE_INFO:
+      case DEVICETYPE_OTHER:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool HeaderScanner::isValidModule(const RawData::Header& module)
+  {
+    //Header, info word and a whole number of frames
+    const size_t frameWords = getFrameWords(module.deviceType);
+    return frameWords > 0 && module.eventType == EVENTTYPE_DATA && module.eventSize > 3 &&
+           (module.eventSize - 3) % frameWords == 0;
+  }
+
+  bool HeaderScanner::isPlausibleEvent(const RawData::Header& group, const RawData::Header& module)
+  {
+    return group.deviceType == DEVICETYPE_GROUP && group.eventType == EVENTTYPE_DATA &&
+           isValidModule(module) && module.eventSize + 2 <= group.eventSize;
+  }
+
+  size_t HeaderScanner::findEvent(const char* data, size_t size)
+  {
+    RawData::Header group, module;
+    //Corruption can shift the data by any number of bytes, so check every byte position
+    for (size_t pos = 0; pos + sizeof(group) + sizeof(module) <= size; ++pos) {
+      std::memcpy(&group, data + pos, sizeof(group));
+      if (group.deviceType != DEVICETYPE_GROUP || group.eventType != EVENTTYPE_DATA) continue;
+      std::memcpy(&module, data + pos + sizeof(group), sizeof(module));
+      if (isPlausibleEvent(group, module)) return pos;
+    }
+    return size;
+  }
+
+  uint64_t HeaderScanner::findEvent(std::istream& stream)
+  {
+    const size_t overlap = 2 * sizeof(RawData::Header) - 1;
+    std::vector<char> buffer(RESYNC_BLOCK_SIZE);
+    uint64_t skipped(0);
+    while (true) {
+      stream.read(&buffer.front(), buffer.size());
+      const size_t size = stream.gcount();
+      const size_t pos = findEvent(&buffer.front(), size);
+      stream.clear();
+      if (pos < size) {
+        stream.seekg(pos - (int64_t) size, std::ios::cur);
+        return skipped + pos;
+      }
+      if (size < buffer.size()) {
+        //End of stream: the last bytes cannot contain a complete event start
+        return skipped + size;
+      }
+      //Keep the last bytes as they might contain the beginning of an event
+      stream.seekg(-(int64_t) overlap, std::ios::cur);
+      skipped += size - overlap;
+    }
+  }
+
+  bool HeaderScanner::readHeader(uint64_t offset, RawData::Header& header)
+  {
+    if (!read(offset, &header, sizeof(header))) return false;
+    if (!isKnownDeviceType(header.deviceType)) return false;
+    //Info records only consist of the header
+    if (header.deviceType == DEVICETYPE_INFO) return true;
+    return header.eventSize >= 2 && offset + header.eventSize * sizeof(RawData::value_type) <= m_fileSize;
+  }
+
+  HeaderScanner::RecordType HeaderScanner::readRecord()
+  {
+    if (m_position >= m_fileSize) return END;
+    RawData::Header header;
+    if (!readHeader(m_position, header)) return INVALID;
+
+    const uint64_t recordOffset = m_position;
+    //Run begin and end can be written as info or as group records
+    if (header.deviceType == DEVICETYPE_INFO || header.deviceType == DEVICETYPE_GROUP) {
+      if (header.eventType == EVENTTYPE_RUN_BEGIN) ++m_runBegins;
+      if (header.eventType == EVENTTYPE_RUN_END) ++m_runEnds;
+    }
+    if (header.deviceType == DEVICETYPE_INFO) {
+      m_runNumber = header.triggerNumber;
+      m_position += sizeof(header);
+      return OTHER;
+    }
+    const uint64_t recordEnd = recordOffset + header.eventSize * sizeof(RawData::value_type);
+    if (header.deviceType != DEVICETYPE_GROUP) {
+      ++m_otherRecords;
+      m_position = recordEnd;
+      return OTHER;
+    }
+    if (header.eventType != EVENTTYPE_DATA) {
+      m_position = recordEnd;
+      return OTHER;
+    }
+
+    //Data event: collect the headers of all module records
+    uint64_t moduleOffset = recordOffset + sizeof(header);
+    while (moduleOffset < recordEnd) {
+      RawData::Header moduleHeader;
+      RawData::InfoWord infoWord;
+      if (!readHeader(moduleOffset, moduleHeader) || !isValidModule(moduleHeader) ||
+          moduleOffset + moduleHeader.eventSize * sizeof(RawData::value_type) > recordEnd ||
+          !read(moduleOffset + sizeof(moduleHeader), &infoWord, sizeof(infoWord))) {
+        m_modules.clear();
+        return INVALID;
+      }
+      ModuleHeader module;
+      module.moduleNr = moduleHeader.moduleNo;
+      module.deviceType = moduleHeader.deviceType;
+      module.startGate = infoWord.startGate;
+      module.temperature = infoWord.temperature / 4.0;
+      module.frames = (moduleHeader.eventSize - 3) / getFrameWords(moduleHeader.deviceType);
+      module.size = moduleHeader.eventSize * sizeof(RawData::value_type);
+      m_modules.push_back(module);
+      moduleOffset += module.size;
+    }
+    m_offset = recordOffset;
+    m_eventSize = recordEnd - recordOffset;
+    m_triggerNr = header.triggerNumber;
+    m_position = recordEnd;
+    m_verified = recordEnd;
+    return EVENT;
+  }
+
+  bool HeaderScanner::resync()
+  {
+    SkippedRange skipped;
+    skipped.filename = m_filename;
+    skipped.offset = m_verified;
+
+    //Search block by block for the next event start, beginning one byte after the last complete event
+    const size_t overlap = 2 * sizeof(RawData::Header) - 1;
+    std::vector<char> buffer(RESYNC_BLOCK_SIZE);
+    uint64_t position = m_verified + 1;
+    bool found(false);
+    while (position < m_fileSize) {
+      const size_t size = std::min<uint64_t>(buffer.size(), m_fileSize - position);
+      const ssize_t result = pread(m_fd, &buffer.front(), size, position);
+      if (result != (ssize_t) size) {
+        throw Exception("Error reading from file " + m_filename);
+      }
+      m_bytesRead += size;
+      const size_t pos = findEvent(&buffer.front(), size);
+      if (pos < size) {
+        position += pos;
+        found = true;
+        break;
+      }
+      if (position + size >= m_fileSize) break;
+      position += size - overlap;
+    }
+    if (!found) position = m_fileSize;
+
+    skipped.size = position - skipped.offset;
+    m_skipped.push_back(skipped);
+    m_position = position;
+    m_verified = position;
+    return found;
+  }
+
+  bool HeaderScanner::next()
+  {
+    m_modules.clear();
+    if (m_fd < 0 || m_damaged) return false;
+
+    while (true) {
+      switch (readRecord()) {
+        case EVENT:
+          return true;
+        case OTHER:
+          continue;
+        case END:
+          return false;
+        case INVALID:
+          if (!m_recover) {
+            m_damaged = true;
+            return false;
+          }
+          if (!resync()) return false;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,50 @@
+#include <DEPFETReader/HotPixelTracker.h>
+#include <DEPFETReader/Exception.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace DEPFET {
+
+  int HotPixelTracker::update(size_t sizeY)
+  {
+    //Median hit count of all pixels still in use
+    std::vector<int> counts;
+    counts.reserve(m_hits.size());
+    for (size_t i = 0; i < m_hits.size(); ++i) {
+      if ((*m_mask)[i] == 0) counts.push_back(m_hits[i]);
+    }
+    int masked(0);
+    if (!counts.empty()) {
+      std::nth_element(counts.begin(), counts.begin() + counts.size() / 2, counts.end());
+      const double limit = m_threshold * std::max(counts[counts.size() / 2], 1);
+      for (size_t i = 0; i < m_hits.size(); ++i) {
+        if ((*m_mask)[i] != 0 || m_hits[i] <= limit) continue;
+        (*m_mask)[i] = 1;
+        m_hotPixels.push_back(std::make_pair(i / sizeY, i % sizeY));
+        ++masked;
+      }
+    }
+    clear();
+    return masked;
+  }
+
+  void HotPixelTracker::write(const std::string& filename) const
+  {
+    std::ofstream output(filename.c_str());
+    if (!output) {
+      throw Exception("Could not open mask file " + filename);
+    }
+    output << "# column row of masked pixels, " << m_hotPixels.size() << " of them found as hot pixels" << std::endl;
+    for (size_t x = 0; m_mask && x < m_mask->getSizeX(); ++x) {
+      for (size_t y = 0; y < m_mask->getSizeY(); ++y) {
+        if ((*m_mask)(x, y)) output << x << " " << y << std::endl;
+      }
+    }
+    output.close();
+    if (output.fail()) {
+      throw Exception("Error writing mask file " + filename);
+    }
+  }
+
+}
@@ -0,0 +1,233 @@
+#include <DEPFETReader/NoiseHistograms.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Solve the 3x3 system a*x = b by Gauss elimination with pivoting, returns false if it is singular */
+    bool solve3(double a[3][3], double b[3], double x[3])
+    {
+      for (int i = 0; i < 3; ++i) {
+        int pivot = i;
+        for (int j = i + 1; j < 3; ++j) {
+          if (std::fabs(a[j][i]) > std::fabs(a[pivot][i])) pivot = j;
+        }
+        if (a[pivot][i] == 0) return false;
+        std::swap_ranges(a[i], a[i] + 3, a[pivot]);
+        std::swap(b[i], b[pivot]);
+        for (int j = i + 1; j < 3; ++j) {
+          const double factor = a[j][i] / a[i][i];
+          for (int k = i; k < 3; ++k) a[j][k] -= factor * a[i][k];
+          b[j] -= factor * b[i];
+        }
+      }
+      for (int i = 2; i >= 0; --i) {
+        x[i] = b[i];
+        for (int k = i + 1; k < 3; ++k) x[i] -= a[i][k] * x[k];
+        x[i] /= a[i][i];
+      }
+      return true;
+    }
+
+    /** Return the chi2 of a Gaussian with the given amplitude, mean and sigma
+     * to the nonempty bins, using the bin content as variance */
+    double getChi2(const std::vector<double>& x, const std::vector<double>& y, const double* p)
+    {
+      double chi2(0);
+      for (size_t i = 0; i < x.size(); ++i) {
+        const double t = (x[i] - p[1]) / p[2];
+        const double r = y[i] - p[0] * std::exp(-0.5 * t * t);
+        chi2 += r * r / y[i];
+      }
+      return chi2;
+    }
+  }
+
+  void NoiseHistograms::setRange(const PixelAccumulator& pedestals, double sigmaCut)
+  {
+    m_sizeX = pedestals.getSizeX();
+    m_sizeY = pedestals.getSizeY();
+    m_width.resize(pedestals.getSize());
+    for (size_t i = 0; i < m_width.size(); ++i) {
+      const double width = (pedestals.getEntries(i) > 0) ? sigmaCut * pedestals.getSigma(i) : 0;
+      m_width[i] = (width > 0) ? width : 1;
+    }
+    m_bins.assign(m_width.size() * BINS, 0);
+  }
+
+  void NoiseHistograms::fill(size_t x, size_t y, double value)
+  {
+    const size_t index = x * m_sizeY + y;
+    const double width = m_width[index];
+    if (!(std::fabs(value) <= width)) return;
+    const int bin = std::min((int)((value + width) / (2 * width) * BINS), (int)BINS - 1);
+    ++m_bins[index * BINS + bin];
+  }
+
+  double NoiseHistograms::getEntries(size_t x, size_t y) const
+  {
+    const double* bins = &m_bins[(x * m_sizeY + y) * BINS];
+    double entries(0);
+    for (int i = 0; i < BINS; ++i) entries += bins[i];
+    return entries;
+  }
+
+  void NoiseHistograms::rebin(const double* from, double fromWidth, double* to, double toWidth)
+  {
+    const double fromBin = 2 * fromWidth / BINS;
+    const double toBin = 2 * toWidth / BINS;
+    for (int i = 0; i < BINS; ++i) {
+      if (from[i] == 0) continue;
+      const double lower = -fromWidth + i * fromBin;
+      const double upper = lower + fromBin;
+      const int first = std::max(0, (int)std::floor((lower + toWidth) / toBin));
+      const int last = std::min((int)BINS - 1, (int)std::floor((upper + toWidth) / toBin));
+      for (int j = first; j <= last; ++j) {
+        const double overlap = std::min(upper, -toWidth + (j + 1) * toBin) - std::max(lower, -toWidth + j * toBin);
+        if (overlap > 0) to[j] += from[i] * overlap / fromBin;
+      }
+    }
+  }
+
+  void NoiseHistograms::merge(const NoiseHistograms& other)
+  {
+    if (!other) return;
+    if (!*this) {
+      *this = other;
+      return;
+    }
+    if (other.m_sizeX != m_sizeX || other.m_sizeY != m_sizeY) {
+      throw Exception("Dimensions do not match");
+    }
+    std::vector<double> bins(BINS);
+    for (size_t i = 0; i < m_width.size(); ++i) {
+      double* own = &m_bins[i * BINS];
+      const double* add = &other.m_bins[i * BINS];
+      if (other.m_width[i] == m_width[i]) {
+        for (int j = 0; j < BINS; ++j) own[j] += add[j];
+        continue;
+      }
+      const double width = std::max(m_width[i], other.m_width[i]);
+      std::fill(bins.begin(), bins.end(), 0);
+      rebin(own, m_width[i], &bins[0], width);
+      rebin(add, other.m_width[i], &bins[0], width);
+      std::copy(bins.begin(), bins.end(), own);
+      m_width[i] = width;
+    }
+  }
+
+  double NoiseHistograms::getNoise(size_t x, size_t y, double fraction, double* chi2, int* ndf) const
+  {
+    if (chi2) *chi2 = 0;
+    if (ndf) *ndf = 0;
+    const size_t index = x * m_sizeY + y;
+    const double* bins = &m_bins[index * BINS];
+    const double width = m_width[index];
+    const double binWidth = 2 * width / BINS;
+
+    //Find the bins around the mean containing the requested fraction of entries
+    double entries(0);
+    double sum(0);
+    for (int i = 0; i < BINS; ++i) {
+      entries += bins[i];
+      sum += bins[i] * (-width + (i + 0.5) * binWidth);
+    }
+    const double maxEntries = entries * fraction;
+    if (maxEntries < 1) return 0;
+    int binLeft = std::min((int)((sum / entries + width) / binWidth), (int)BINS - 1);
+    int binRight = binLeft;
+    double inside = bins[binLeft];
+    while (inside < maxEntries && (binLeft > 0 || binRight < BINS - 1)) {
+      if (--binLeft >= 0) inside += bins[binLeft];
+      if (++binRight < BINS) inside += bins[binRight];
+    }
+    binLeft = std::max(binLeft, 0);
+    binRight = std::min(binRight, (int)BINS - 1);
+
+    //Start values from the moments of the selected bins
+    std::vector<double> centers;
+    std::vector<double> contents;
+    double mean(0), meanSq(0), maxContent(0);
+    for (int i = binLeft; i <= binRight; ++i) {
+      const double center = -width + (i + 0.5) * binWidth;
+      mean += bins[i] * center;
+      meanSq += bins[i] * center * center;
+      maxContent = std::max(maxContent, bins[i]);
+      if (bins[i] <= 0) continue;
+      centers.push_back(center);
+      contents.push_back(bins[i]);
+    }
+    mean /= inside;
+    const double rms = std::sqrt(std::max(0.0, meanSq / inside - mean * mean));
+    double p[3] = {maxContent, mean, (rms > 0) ? rms : binWidth};
+    if (centers.size() < 3) return p[2];
+
+    //Least squares fit of a Gaussian using Levenberg-Marquardt
+    double lambda(1e-3);
+    double current = getChi2(centers, contents, p);
+    for (int iteration = 0; iteration < 200; ++iteration) {
+      double a[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+      double b[3] = {0, 0, 0};
+      for (size_t i = 0; i < centers.size(); ++i) {
+        const double t = (centers[i] - p[1]) / p[2];
+        const double e = std::exp(-0.5 * t * t);
+        const double derivative[3] = {e, p[0] * e * t / p[2], p[0] * e * t * t / p[2]};
+        const double weight = 1 / contents[i];
+        const double residual = contents[i] - p[0] * e;
+        for (int j = 0; j < 3; ++j) {
+          b[j] += weight * derivative[j] * residual;
+          for (int k = 0; k < 3; ++k) a[j][k] += weight * derivative[j] * derivative[k];
+        }
+      }
+      for (int j = 0; j < 3; ++j) a[j][j] *= 1 + lambda;
+      double step[3];
+      if (!solve3(a, b, step)) break;
+      const double next[3] = {p[0] + step[0], p[1] + step[1], p[2] + step[2]};
+      const double nextChi2 = (next[2] != 0) ? getChi2(centers, contents, next) : current;
+      if (nextChi2 < current) {
+        const bool converged = current - nextChi2 < 1e-10 * current;
+        std::copy(next, next + 3, p);
+        current = nextChi2;
+        lambda /= 10;
+        if (converged) break;
+      } else {
+        lambda *= 10;
+        if (lambda > 1e10) break;
+      }
+    }
+    if (chi2) *chi2 = current;
+    if (ndf) *ndf = centers.size() - 3;
+    return std::fabs(p[2]);
+  }
+
+  void NoiseHistograms::write(std::ostream& output) const
+  {
+    const uint32_t size[2] = {(uint32_t) m_sizeX, (uint32_t) m_sizeY};
+    output.write((const char*) size, sizeof(size));
+    if (!m_width.empty()) {
+      output.write((const char*) &m_width.front(), m_width.size() * sizeof(double));
+      output.write((const char*) &m_bins.front(), m_bins.size() * sizeof(double));
+    }
+  }
+
+  void NoiseHistograms::read(std::istream& input)
+  {
+    uint32_t size[2] = {0, 0};
+    input.read((char*) size, sizeof(size));
+    if (!input) throw Exception("Error reading noise histograms");
+    m_sizeX = size[0];
+    m_sizeY = size[1];
+    m_width.resize(m_sizeX * m_sizeY);
+    m_bins.resize(m_width.size() * BINS);
+    if (!m_width.empty()) {
+      input.read((char*) &m_width.front(), m_width.size() * sizeof(double));
+      input.read((char*) &m_bins.front(), m_bins.size() * sizeof(double));
+    }
+    if (!input) throw Exception("Error reading noise histograms");
+  }
+
+}
@@ -0,0 +1,194 @@
+#include <DEPFETReader/PartialResult.h>
+#include <DEPFETReader/Exception.h>
+
+#include <fstream>
+#include <cstring>
+
+namespace DEPFET {
+
+  namespace {
+    /** Magic bytes at the beginning of a partial result file */
+    const char PARTIAL_MAGIC[8] = {'D', 'E', 'P', 'F', 'E', 'T', 'P', 'R'};
+
+    /** Write the size and the values of a matrix */
+    template<class T> void writeMatrix(std::ostream& output, const ValueMatrix<T>& matrix)
+    {
+      const uint32_t size[2] = {(uint32_t) matrix.getSizeX(), (uint32_t) matrix.getSizeY()};
+      output.write((const char*) size, sizeof(size));
+      if (!!matrix) output.write((const char*) matrix.getData(), matrix.getSize() * sizeof(T));
+    }
+
+    /** Read the dimensions of the per pixel data at the current position
+     * without consuming them. Throws an Exception if they do not match the
+     * expected dimensions, or if no dimensions are expected, if the rest of
+     * the file is too short to hold bytesPerPixel for each pixel */
+    void checkSize(std::istream& input, size_t& sizeX, size_t& sizeY, uint64_t bytesPerPixel)
+    {
+      uint32_t size[2] = {0, 0};
+      const std::streampos start = input.tellg();
+      input.read((char*) size, sizeof(size));
+      input.seekg(0, std::ios::end);
+      const std::streamoff remaining = input.tellg() - start - (std::streamoff) sizeof(size);
+      input.seekg(start);
+      if (!input) throw Exception("Unexpected end of file");
+      if (sizeX == 0 && sizeY == 0) {
+        if (remaining < 0 || (uint64_t) size[0] * size[1] * bytesPerPixel > (uint64_t) remaining) {
+          throw Exception("Dimensions do not match the file size");
+        }
+        sizeX = size[0];
+        sizeY = size[1];
+      } else if (size[0] != sizeX || size[1] != sizeY) {
+        throw Exception("Dimensions do not match");
+      }
+    }
+
+    /** Read a matrix written by writeMatrix, see checkSize() for the meaning of sizeX and sizeY */
+    template<class T> void readMatrix(std::istream& input, ValueMatrix<T>& matrix, size_t& sizeX, size_t& sizeY)
+    {
+      checkSize(input, sizeX, sizeY, sizeof(T));
+      uint32_t size[2];
+      input.read((char*) size, sizeof(size));
+      matrix.setSize(size[0], size[1]);
+      if (!!matrix) input.read((char*) &matrix[0], matrix.getSize() * sizeof(T));
+      if (!input) throw Exception("Unexpected end of file");
+    }
+
+    /** Combine two masks, masking a pixel if it is masked in either */
+    void mergeMask(PixelMask& mask, const PixelMask& other)
+    {
+      if (other.getSizeX() != mask.getSizeX() || other.getSizeY() != mask.getSizeY()) {
+        throw Exception("Dimensions do not match");
+      }
+      for (size_t i = 0; i < mask.getSize(); ++i) mask[i] |= other[i];
+    }
+
+    /** Open a file for writing and write the header */
+    void openOutput(std::ofstream& file, const std::string& filename, PartialResult::Type type)
+    {
+      file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file) {
+        throw Exception("Error opening partial result file " + filename + " for writing");
+      }
+      PartialResult::FileHeader header;
+      std::memcpy(header.magic, PARTIAL_MAGIC, sizeof(header.magic));
+      header.version = PartialResult::VERSION;
+      header.type = type;
+      file.write((const char*) &header, sizeof(header));
+    }
+
+    /** Open a file for reading and check the header */
+    void openInput(std::ifstream& file, const std::string& filename, PartialResult::Type type)
+    {
+      if (PartialResult::getType(filename) != type) {
+        throw Exception(filename + " is not a partial result file of the expected type");
+      }
+      file.open(filename.c_str(), std::ios::in | std::ios::binary);
+      file.seekg(sizeof(PartialResult::FileHeader));
+    }
+  }
+
+  void PartialHitmap::merge(const PartialHitmap& other)
+  {
+    if (!sums) {
+      *this = other;
+      return;
+    }
+    mergeMask(mask, other.mask);
+    sums.add(other.sums);
+    events += other.events;
+    frames += other.frames;
+  }
+
+  void PartialCalibration::merge(const PartialCalibration& other)
+  {
+    if (!mask) {
+      *this = other;
+      return;
+    }
+    if (other.moduleNr != moduleNr) {
+      throw Exception("Cannot merge calibrations of different modules");
+    }
+    mergeMask(mask, other.mask);
+    pedestals.merge(other.pedestals);
+    noise.merge(other.noise);
+    events += other.events;
+  }
+
+  PartialResult::Type PartialResult::getType(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    FileHeader header;
+    file.read((char*) &header, sizeof(header));
+    if (!file || std::memcmp(header.magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) != 0) return UNKNOWN;
+    if (header.version != VERSION) {
+      throw Exception("Unsupported partial result file version in " + filename);
+    }
+    if (header.type != HITMAP && header.type != CALIBRATION) return UNKNOWN;
+    return (Type) header.type;
+  }
+
+  void PartialResult::write(const std::string& filename, const PartialHitmap& hitmap)
+  {
+    std::ofstream file;
+    openOutput(file, filename, HITMAP);
+    const uint64_t counts[2] = {hitmap.events, hitmap.frames};
+    file.write((const char*) counts, sizeof(counts));
+    writeMatrix(file, hitmap.mask);
+    writeMatrix(file, hitmap.sums);
+    if (!file) {
+      throw Exception("Error writing partial result file " + filename);
+    }
+  }
+
+  void PartialResult::write(const std::string& filename, const PartialCalibration& calibration)
+  {
+    std::ofstream file;
+    openOutput(file, filename, CALIBRATION);
+    const int64_t counts[2] = {calibration.moduleNr, (int64_t) calibration.events};
+    file.write((const char*) counts, sizeof(counts));
+    writeMatrix(file, calibration.mask);
+    calibration.pedestals.write(file);
+    calibration.noise.write(file);
+    if (!file) {
+      throw Exception("Error writing partial result file " + filename);
+    }
+  }
+
+  void PartialResult::read(const std::string& filename, PartialHitmap& hitmap)
+  {
+    std::ifstream file;
+    openInput(file, filename, HITMAP);
+    uint64_t counts[2];
+    file.read((char*) counts, sizeof(counts));
+    hitmap.events = counts[0];
+    hitmap.frames = counts[1];
+    try {
+      size_t sizeX(0), sizeY(0);
+      readMatrix(file, hitmap.mask, sizeX, sizeY);
+      readMatrix(file, hitmap.sums, sizeX, sizeY);
+    } catch (std::runtime_error& e) {
+      throw Exception("Error reading partial result file " + filename + ": " + e.what());
+    }
+  }
+
+  void PartialResult::read(const std::string& filename, PartialCalibration& calibration)
+  {
+    std::ifstream file;
+    openInput(file, filename, CALIBRATION);
+    int64_t counts[2];
+    file.read((char*) counts, sizeof(counts));
+    calibration.moduleNr = counts[0];
+    calibration.events = counts[1];
+    try {
+      size_t sizeX(0), sizeY(0);
+      readMatrix(file, calibration.mask, sizeX, sizeY);
+      checkSize(file, sizeX, sizeY, 6 * sizeof(double));
+      calibration.pedestals.read(file);
+      checkSize(file, sizeX, sizeY, (NoiseHistograms::BINS + 1) * sizeof(double));
+      calibration.noise.read(file);
+    } catch (std::runtime_error& e) {
+      throw Exception("Error reading partial result file " + filename + ": " + e.what());
+    }
+  }
+
+}
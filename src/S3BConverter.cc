@@ -4,7 +4,7 @@ namespace DEPFET {
 
   size_t S3BConverter2Fold::operator()(const RawData& rawData, ADCValues& adcValues)
   {
-    adcValues.setSize(64, 256);
+    adcValues.setSize(SIZEX, SIZEY);
     DataView<short> data = rawData.getView<short>(128, 128);
 
     for (int gate = 0; gate < 128; ++gate) {
@@ -22,12 +22,12 @@ namespace DEPFET {
         adcValues(col + 1,  rgate + 1 - odderon) = data(gate, (col * 4) + 7) & 0xffff;
       }
     }
-    return rawData.getFrameSize<short>(64, 256);
+    return rawData.getFrameSize<short>(SIZEX, SIZEY);
   }
 
   size_t S3BConverter4Fold::operator()(const RawData& rawData, ADCValues& adcValues)
   {
-    adcValues.setSize(32, 512);
+    adcValues.setSize(SIZEX, SIZEY);
     DataView<short> data = rawData.getView<short>(128, 128);
     for (int gate = 0; gate < 128; ++gate)  {
       int readout_gate = (rawData.getStartGate() + gate) % 128;
@@ -43,6 +43,6 @@ namespace DEPFET {
         adcValues(col,      rgate + 3) = data(gate, (col * 8) + 7) & 0xffff;
       }
     }
-    return rawData.getFrameSize<short>(32, 512);
+    return rawData.getFrameSize<short>(SIZEX, SIZEY);
   }
 }
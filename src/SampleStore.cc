@@ -0,0 +1,121 @@
+#include <DEPFETReader/SampleStore.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace DEPFET {
+
+  void SampleWriter::open(const std::string& filename, size_t sizeX, size_t sizeY, size_t blockFrames)
+  {
+    if (blockFrames == 0) {
+      throw Exception("Number of frames per block must be positive");
+    }
+    m_filename = filename;
+    m_frames = 0;
+    m_totalFrames = 0;
+    m_output.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_output) {
+      throw Exception("Could not open sample file " + filename);
+    }
+    memcpy(m_header.magic, "DEPFETRS", sizeof(m_header.magic));
+    m_header.version = SampleStore::VERSION;
+    m_header.sizeX = sizeX;
+    m_header.sizeY = sizeY;
+    m_header.blockFrames = blockFrames;
+    m_output.write((char*)&m_header, sizeof(m_header));
+    m_buffer.resize(sizeX * sizeY * blockFrames);
+  }
+
+  void SampleWriter::add(const ValueMatrix<double>& data)
+  {
+    if (data.getSizeX() != m_header.sizeX || data.getSizeY() != m_header.sizeY) {
+      throw Exception("Frame size does not match sample file " + m_filename);
+    }
+    //Each pixel owns blockFrames consecutive samples in the buffer
+    int16_t* samples = &m_buffer.front() + m_frames;
+    for (size_t i = 0; i < data.getSize(); ++i, samples += m_header.blockFrames) {
+      *samples = static_cast<int16_t>(std::max(-32768.0, std::min(std::floor(data[i] + 0.5), 32767.0)));
+    }
+    ++m_totalFrames;
+    if (++m_frames == m_header.blockFrames) writeBlock();
+  }
+
+  void SampleWriter::writeBlock()
+  {
+    if (m_frames == 0) return;
+    const size_t pixels = (size_t)m_header.sizeX * m_header.sizeY;
+    //The last block may be incomplete, remove the unused samples of each pixel
+    if (m_frames < m_header.blockFrames) {
+      for (size_t i = 1; i < pixels; ++i) {
+        memmove(&m_buffer[i * m_frames], &m_buffer[i * m_header.blockFrames], m_frames * sizeof(int16_t));
+      }
+    }
+    SampleStore::BlockHeader block;
+    block.firstFrame = m_totalFrames - m_frames;
+    block.frames = m_frames;
+    block.padding = 0;
+    m_output.write((char*)&block, sizeof(block));
+    m_output.write((char*)&m_buffer.front(), pixels * m_frames * sizeof(int16_t));
+    if (!m_output) {
+      throw Exception("Error writing sample file " + m_filename);
+    }
+    m_frames = 0;
+  }
+
+  void SampleWriter::close()
+  {
+    writeBlock();
+    m_output.close();
+    if (m_output.fail()) {
+      throw Exception("Error writing sample file " + m_filename);
+    }
+  }
+
+  void SampleReader::open(const std::string& filename)
+  {
+    m_filename = filename;
+    m_blocks.clear();
+    m_frames = 0;
+    m_input.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!m_input) {
+      throw Exception("Could not open sample file " + filename);
+    }
+    m_input.read((char*)&m_header, sizeof(m_header));
+    if (!m_input || memcmp(m_header.magic, "DEPFETRS", sizeof(m_header.magic)) != 0 || m_header.version != SampleStore::VERSION) {
+      throw Exception(filename + " is not a sample file");
+    }
+    //Collect the position of all blocks
+    const std::streamoff pixels = (std::streamoff)m_header.sizeX * m_header.sizeY;
+    SampleStore::BlockHeader block;
+    while (m_input.read((char*)&block, sizeof(block))) {
+      const std::streamoff offset = m_input.tellg();
+      m_blocks.push_back(std::make_pair(offset, block.frames));
+      m_frames += block.frames;
+      m_input.seekg(offset + pixels * block.frames * (std::streamoff)sizeof(int16_t));
+    }
+    m_input.clear();
+  }
+
+  void SampleReader::readPixel(size_t x, size_t y, std::vector<int16_t>& samples)
+  {
+    if (x >= m_header.sizeX || y >= m_header.sizeY) {
+      throw Exception("Pixel outside of the matrix in sample file " + m_filename);
+    }
+    const std::streamoff pixel = x * m_header.sizeY + y;
+    samples.resize(m_frames);
+    size_t frame(0);
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+      const uint32_t frames = m_blocks[i].second;
+      m_input.seekg(m_blocks[i].first + pixel * frames * (std::streamoff)sizeof(int16_t));
+      m_input.read((char*)&samples[frame], frames * sizeof(int16_t));
+      if (!m_input) {
+        m_input.clear();
+        throw Exception("Error reading sample file " + m_filename);
+      }
+      frame += frames;
+    }
+  }
+
+}
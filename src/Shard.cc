@@ -0,0 +1,64 @@
+#include <DEPFETReader/Shard.h>
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/Exception.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace DEPFET {
+
+  Shard Shard::parse(const std::string& spec)
+  {
+    std::istringstream input(spec);
+    int index(-1), count(0);
+    char separator(0);
+    input >> index >> separator >> count;
+    if (input.fail() || !input.eof() || separator != '/' || count < 1 || index < 0 || index >= count) {
+      throw Exception("Invalid shard '" + spec + "', expected i/N with 0 <= i < N");
+    }
+    return Shard(index, count);
+  }
+
+  std::string Shard::toString() const
+  {
+    std::ostringstream output;
+    output << m_index << "/" << m_count;
+    return output.str();
+  }
+
+  int Shard::selectEvents(const std::vector<std::string>& filenames, int& skipEvents, int& nEvents, bool recover) const
+  {
+    //Count the events of all files, reading only the headers
+    int available(0);
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      HeaderScanner scanner;
+      scanner.setRecovery(recover);
+      scanner.open(filenames[i]);
+      while (scanner.next()) ++available;
+    }
+    int total = std::max(0, available - skipEvents);
+    if (nEvents > 0) total = std::min(total, nEvents);
+
+    //The first total % count shards get one event more
+    const int size = total / m_count + (m_index < total % m_count ? 1 : 0);
+    const int start = m_index * (total / m_count) + std::min(m_index, total % m_count);
+    skipEvents += start;
+    nEvents = size;
+    //A limit of 0 means all events, so skip everything instead
+    if (size == 0) {
+      skipEvents = available;
+      nEvents = -1;
+    }
+    return size;
+  }
+
+  int Shard::select(const std::string& spec, const std::vector<std::string>& filenames, int& skipEvents, int& nEvents,
+                    bool recover, std::ostream& output)
+  {
+    const Shard shard = parse(spec);
+    const int size = shard.selectEvents(filenames, skipEvents, nEvents, recover);
+    output << "Shard " << shard.toString() << ": " << size << " events starting at event " << skipEvents << std::endl;
+    return size;
+  }
+
+}
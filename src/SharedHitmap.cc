@@ -0,0 +1,76 @@
+#include <DEPFETReader/SharedHitmap.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  void SharedHitmap::create(const std::string& name, int moduleNr, size_t sizeX, size_t sizeY)
+  {
+    close();
+    //POSIX shared memory names have to start with a slash
+    const std::string shmName = (name.empty() || name[0] != '/') ? "/" + name : name;
+    shm_unlink(shmName.c_str());
+    m_fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (m_fd < 0) {
+      throw Exception("Could not create shared memory " + shmName + ": " + strerror(errno));
+    }
+    m_size = sizeof(Header) + sizeX * sizeY * sizeof(double);
+    if (ftruncate(m_fd, m_size) != 0) {
+      const std::string error = strerror(errno);
+      close();
+      throw Exception("Could not resize shared memory " + shmName + ": " + error);
+    }
+    void* memory = mmap(0, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (memory == MAP_FAILED) {
+      const std::string error = strerror(errno);
+      m_size = 0;
+      close();
+      throw Exception("Could not map shared memory " + shmName + ": " + error);
+    }
+    m_header = static_cast<Header*>(memory);
+    m_data = reinterpret_cast<double*>(m_header + 1);
+    //The segment is new and filled with zeros, so readers see an empty hitmap until the header is complete
+    memcpy(m_header->magic, "DEPFETSM", sizeof(m_header->magic));
+    m_header->version = VERSION;
+    m_header->headerSize = sizeof(Header);
+    m_header->moduleNr = moduleNr;
+    m_header->sizeX = sizeX;
+    m_header->sizeY = sizeY;
+    m_header->padding = 0;
+    m_header->sequence = 0;
+    m_header->summary = HitmapSummary();
+  }
+
+  void SharedHitmap::close()
+  {
+    if (m_header) munmap(m_header, m_size);
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+    m_size = 0;
+    m_header = 0;
+    m_data = 0;
+  }
+
+  void SharedHitmap::publish(const ValueMatrix<double>& hitmap, const HitmapSummary& summary)
+  {
+    if (!m_header) return;
+    if (hitmap.getSizeX() != m_header->sizeX || hitmap.getSizeY() != m_header->sizeY) {
+      throw Exception("Hitmap size does not match the shared memory segment");
+    }
+    //Odd sequence number tells readers that an update is in progress
+    ++m_header->sequence;
+    __sync_synchronize();
+    if (!!hitmap) std::copy(hitmap.getData(), hitmap.getData() + hitmap.getSize(), m_data);
+    m_header->summary = summary;
+    __sync_synchronize();
+    ++m_header->sequence;
+  }
+
+}
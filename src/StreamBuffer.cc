@@ -0,0 +1,134 @@
+#include <DEPFETReader/StreamBuffer.h>
+#include <DEPFETReader/Exception.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Prefix of TCP addresses */
+    const std::string tcpPrefix = "tcp://";
+
+    /** Connect to a TCP server given as host:port and return the socket */
+    int connectTCP(const std::string& address)
+    {
+      const size_t colon = address.rfind(':');
+      if (colon == std::string::npos) {
+        throw Exception("Invalid TCP address " + address + ", expected host:port");
+      }
+      const std::string host = address.substr(0, colon);
+      const std::string port = address.substr(colon + 1);
+      addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo* result(0);
+      const int error = getaddrinfo(host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &result);
+      if (error != 0) {
+        throw Exception("Could not resolve " + address + ": " + gai_strerror(error));
+      }
+      int fd(-1);
+      for (addrinfo* info = result; info; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) break;
+        ::close(fd);
+        fd = -1;
+      }
+      freeaddrinfo(result);
+      if (fd < 0) {
+        throw Exception("Could not connect to " + address + ": " + strerror(errno));
+      }
+      return fd;
+    }
+
+    /** Read up to size bytes, retrying if interrupted. Returns the number of bytes read, 0 at the end and -1 on error */
+    ssize_t readData(int fd, char* buffer, size_t size)
+    {
+      while (true) {
+        const ssize_t n = ::read(fd, buffer, size);
+        if (n >= 0 || errno != EINTR) return n;
+      }
+    }
+  }
+
+  void StreamBuffer::open(const std::string& name)
+  {
+    close();
+    if (name == "-") {
+      m_fd = 0;
+    } else if (name.compare(0, tcpPrefix.size(), tcpPrefix) == 0) {
+      m_fd = connectTCP(name.substr(tcpPrefix.size()));
+      m_close = true;
+    } else {
+      m_fd = ::open(name.c_str(), O_RDONLY);
+      if (m_fd < 0) {
+        throw Exception("Error opening file " + name);
+      }
+      m_close = true;
+    }
+  }
+
+  void StreamBuffer::close()
+  {
+    if (m_close) ::close(m_fd);
+    m_fd = -1;
+    m_close = false;
+    m_position = 0;
+    setg(0, 0, 0);
+  }
+
+  bool StreamBuffer::isStream(const std::string& name)
+  {
+    if (name == "-" || name.compare(0, tcpPrefix.size(), tcpPrefix) == 0) return true;
+    struct stat info;
+    return stat(name.c_str(), &info) == 0 && !S_ISREG(info.st_mode);
+  }
+
+  StreamBuffer::int_type StreamBuffer::underflow()
+  {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (m_fd < 0) return traits_type::eof();
+    const ssize_t n = readData(m_fd, &m_buffer.front(), m_buffer.size());
+    if (n <= 0) return traits_type::eof();
+    m_position += n;
+    setg(&m_buffer.front(), &m_buffer.front(), &m_buffer.front() + n);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  StreamBuffer::pos_type StreamBuffer::seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which)
+  {
+    if (way != std::ios_base::cur || !(which & std::ios_base::in) || off < 0 || m_fd < 0) return pos_type(off_type(-1));
+    //Skip the buffered data first, then read and discard the rest in blocks
+    const off_type buffered = egptr() - gptr();
+    if (off <= buffered) {
+      gbump(off);
+    } else {
+      off -= buffered;
+      setg(0, 0, 0);
+      while (off > 0) {
+        const ssize_t n = readData(m_fd, &m_buffer.front(), std::min<off_type>(off, m_buffer.size()));
+        if (n <= 0) return pos_type(off_type(-1));
+        m_position += n;
+        off -= n;
+      }
+    }
+    return pos_type(m_position - (egptr() - gptr()));
+  }
+
+  StreamBuffer::pos_type StreamBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+  {
+    const pos_type current = seekoff(0, std::ios_base::cur, which);
+    if (current != pos) return pos_type(off_type(-1));
+    return current;
+  }
+
+}
@@ -0,0 +1,133 @@
+#include <DEPFETReader/TraceRecorder.h>
+#include <DEPFETReader/ProcessingStats.h>
+#include <DEPFETReader/Exception.h>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+namespace DEPFET {
+
+  namespace {
+    /** Maximum number of spans per thread, about 24 bytes each */
+    const size_t MAX_SPANS = 1 << 24;
+
+    /** Buffer of the current thread */
+    __thread void* t_buffer = 0;
+
+    /** Escape a string for use in JSON */
+    std::string escape(const std::string& text)
+    {
+      std::ostringstream result;
+      for (size_t i = 0; i < text.size(); ++i) {
+        const char c = text[i];
+        if (c == '"' || c == '\\') {
+          result << '\\' << c;
+        } else if ((unsigned char) c < 0x20) {
+          result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+        } else {
+          result << c;
+        }
+      }
+      return result.str();
+    }
+  }
+
+  bool TraceRecorder::s_enabled = false;
+  double TraceRecorder::s_startTime = 0;
+  std::vector<TraceRecorder::ThreadBuffer*> TraceRecorder::s_buffers;
+  pthread_mutex_t TraceRecorder::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+  void TraceRecorder::enable()
+  {
+    if (s_enabled) return;
+    s_startTime = StageTimer::getTime();
+    s_enabled = true;
+  }
+
+  TraceRecorder::ThreadBuffer* TraceRecorder::getBuffer()
+  {
+    ThreadBuffer* buffer = static_cast<ThreadBuffer*>(t_buffer);
+    if (buffer) return buffer;
+
+    buffer = new ThreadBuffer();
+    buffer->dropped = 0;
+    buffer->spans.reserve(4096);
+    pthread_mutex_lock(&s_mutex);
+    buffer->tid = s_buffers.size() + 1;
+    s_buffers.push_back(buffer);
+    pthread_mutex_unlock(&s_mutex);
+    std::ostringstream name;
+    name << "thread " << buffer->tid;
+    buffer->name = name.str();
+    t_buffer = buffer;
+    return buffer;
+  }
+
+  void TraceRecorder::add(const char* name, double start, double end)
+  {
+    ThreadBuffer* buffer = getBuffer();
+    if (buffer->spans.size() >= MAX_SPANS) {
+      ++buffer->dropped;
+      return;
+    }
+    Span span = {name, start, end};
+    buffer->spans.push_back(span);
+  }
+
+  void TraceRecorder::setThreadName(const std::string& name)
+  {
+    if (!s_enabled) return;
+    getBuffer()->name = name;
+  }
+
+  void TraceRecorder::write(const std::string& filename)
+  {
+    std::ofstream output(filename.c_str());
+    if (!output) {
+      throw Exception("Could not open trace file " + filename);
+    }
+
+    const int pid = getpid();
+    bool first(true);
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    pthread_mutex_lock(&s_mutex);
+    for (size_t i = 0; i < s_buffers.size(); ++i) {
+      const ThreadBuffer& buffer = *s_buffers[i];
+      if (!first) output << ",\n";
+      first = false;
+      output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+             << ",\"args\":{\"name\":\"" << escape(buffer.name) << "\"}}";
+      if (buffer.dropped > 0) {
+        output << ",\n{\"name\":\"dropped " << buffer.dropped << " spans\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << pid
+               << ",\"tid\":" << buffer.tid << ",\"ts\":0}";
+      }
+      //Chrome trace timestamps are in microseconds
+      for (size_t j = 0; j < buffer.spans.size(); ++j) {
+        const Span& span = buffer.spans[j];
+        output << ",\n{\"name\":\"" << escape(span.name) << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+               << ",\"ts\":" << (span.start - s_startTime) * 1e6
+               << ",\"dur\":" << (span.end - span.start) * 1e6 << "}";
+      }
+    }
+    pthread_mutex_unlock(&s_mutex);
+    output << "\n]}\n";
+    if (!output) {
+      throw Exception("Could not write trace file " + filename);
+    }
+  }
+
+  TraceSpan::TraceSpan(const char* name): m_name(name), m_start(0)
+  {
+    if (TraceRecorder::isEnabled()) m_start = StageTimer::getTime();
+  }
+
+  TraceSpan::~TraceSpan()
+  {
+    //Spans started before tracing was enabled have no start time
+    if (m_start > 0) TraceRecorder::record(m_name, m_start, StageTimer::getTime());
+  }
+
+}
@@ -0,0 +1,357 @@
+#include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/EventBuilder.h>
+#include <DEPFETReader/Shard.h>
+#include <DEPFETReader/CommonMode.h>
+#include <DEPFETReader/PedestalTracker.h>
+#include <DEPFETReader/HotPixelTracker.h>
+#include <DEPFETReader/CalibrationStore.h>
+#include <DEPFETReader/FrameConsumer.h>
+
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+bool showProgress(int event, int minOrder = 0, int maxOrder = 3)
+{
+  int order = (event == 0) ? 1 : max(min((int)log10(event), maxOrder), minOrder);
+  int interval = static_cast<int>(pow(10., order));
+  return (event % interval == 0);
+}
+
+//Publish snapshots of the analyses in regular intervals and whenever the reader caught up with the data
+class SnapshotPublisher: public DEPFET::FollowHandler {
+public:
+  SnapshotPublisher(const vector<DEPFET::FrameConsumer*>& consumers, double interval):
+    m_consumers(consumers), m_interval(interval), m_last(DEPFET::StageTimer::getTime()), m_pending(false) {}
+
+  //Called after each event, publishes if the interval has passed
+  void eventDone() {
+    m_pending = true;
+    if (m_interval > 0 && DEPFET::StageTimer::getTime() - m_last >= m_interval) publish();
+  }
+
+  //Called by the reader before waiting for new data
+  virtual void waitingForData() {
+    if (m_interval > 0 && m_pending) publish();
+  }
+
+protected:
+  void publish() {
+    BOOST_FOREACH(DEPFET::FrameConsumer * consumer, m_consumers) {
+      try {
+        consumer->snapshot();
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+      }
+    }
+    m_last = DEPFET::StageTimer::getTime();
+    m_pending = false;
+  }
+
+  const vector<DEPFET::FrameConsumer*>& m_consumers;
+  double m_interval;
+  double m_last;
+  bool m_pending;
+};
+
+//Calibration and pedestal tracking of one module
+struct ModuleState {
+  DEPFET::CalibrationView calibration;
+  DEPFET::PedestalTracker pedestalTracker;
+  DEPFET::HotPixelTracker hotPixelTracker;
+};
+
+//Return the calibration for the module of a frame, loading it on first use. Returns 0 on error
+ModuleState* loadCalibration(map<int, ModuleState>& modules, DEPFET::CalibrationStore& store, const string& filename,
+                             const DEPFET::ADCValues& data, double sigmaCut, int trackInterval, int hotWindow, double hotThreshold)
+{
+  map<int, ModuleState>::iterator it = modules.find(data.getModuleNr());
+  if (it != modules.end()) return &it->second;
+
+  ModuleState& module = modules[data.getModuleNr()];
+  try {
+    module.calibration.load(store, filename, data.getModuleNr(), data.getSizeX(), data.getSizeY());
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    modules.erase(data.getModuleNr());
+    return 0;
+  }
+  //Only the values changed during the run need a private copy, the rest is read from the mapped calibration
+  if (trackInterval > 0) module.calibration.copyPedestals();
+  module.pedestalTracker = DEPFET::PedestalTracker(trackInterval);
+  module.hotPixelTracker = DEPFET::HotPixelTracker(hotWindow, hotThreshold);
+  if (hotWindow > 0) module.hotPixelTracker.setMask(&module.calibration.copyMask());
+  module.hotPixelTracker.setNoise(sigmaCut, module.calibration.getNoise());
+  module.pedestalTracker.setMask(module.calibration.getMask());
+  module.pedestalTracker.setNoise(sigmaCut, module.calibration.getNoise());
+  return &module;
+}
+
+int main(int argc, char* argv[])
+{
+  int skipEvents(0);
+  int maxEvents(-1);
+  vector<string> inputFiles;
+  vector<string> configFiles;
+  string traceFile;
+  string shardSpec;
+  string calibrationFile;
+  double sigmaCut(5.0);
+  int frameNr(-1);
+  int trackInterval(0);
+  int hotWindow(0);
+  double hotThreshold(20);
+  string hotMaskFile;
+  double followTimeout(0);
+  double snapshotInterval(0);
+  string hitmapFile;
+  string hitmapPartialFile;
+  string dumpFile;
+  string hitsFile;
+  string occupancyFile;
+  string shmName;
+  string clusterFile;
+  string summaryFile;
+
+  //Parse program arguments
+  po::options_description desc("Read the data once and run several analyses on the corrected frames.\n"
+                               "Each analysis is enabled by giving its output file. All options can also be\n"
+                               "given in config files as \"option = value\" lines.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("config", po::value< vector<string> >(&configFiles)->composing(), "Read options from this file, options on the command line take precedence")
+  ("skip,s", po::value<int>(&skipEvents)->default_value(0), "Number of events to skip before reading")
+  ("sigma", po::value<double>(&sigmaCut)->default_value(5.0), "Sigma cut to apply to data")
+  ("nevents,n", po::value<int>(&maxEvents)->default_value(-1), "Max. number of events")
+  ("calibration,c", po::value<string>(&calibrationFile), "Calibration File")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Input files")
+  ("4fold", "If set, data is read out in 4fold mode, otherwise 2fold")
+  ("dcd", "If set, common mode corretion is set to DCD mode (4 full rows), otherwise curo topology is used (two half rows")
+  ("frame,f", po::value<int>(&frameNr)->default_value(frameNr), "Set the frame number to be used: -1=all, 0=original, 1=1st tailing, ...")
+  ("merge", "Read the input files at the same time and merge them by trigger number, each file containing different modules")
+  ("shard", po::value<string>(&shardSpec), "Process only part i of N consecutive parts of the selected events, e.g. 0/4")
+  ("recover", "Continue after corrupted data by searching for the next valid event instead of aborting")
+  ("stats", "Print time and throughput of each processing stage at the end")
+  ("trace", po::value<string>(&traceFile), "Write a timeline of the processing stages in Chrome trace format to this file")
+  ("follow", po::value<double>(&followTimeout), "Follow the last input file while it is written, stopping after this many seconds without new data, 0=never stop")
+  ("snapshot", po::value<double>(&snapshotInterval)->default_value(snapshotInterval), "Write the current hitmap and occupancy every N seconds and whenever all available data is processed, 0=only at the end")
+  ("track-pedestals", po::value<int>(&trackInterval)->default_value(trackInterval), "Follow pedestal drifts by updating the pedestals from signal free pixels every N frames, 0=disabled")
+  ("hot-pixels", po::value<int>(&hotWindow)->default_value(hotWindow), "Mask pixels which fire far more often than the median pixel, checked every N frames, 0=disabled")
+  ("hot-threshold", po::value<double>(&hotThreshold)->default_value(hotThreshold), "Factor above the median number of hits for a pixel to be hot")
+  ("hot-mask", po::value<string>(&hotMaskFile), "Write the mask including the hot pixels to this file to be used for later runs, %1% is replaced by the module number")
+  ("hitmap", po::value<string>(&hitmapFile), "Write the sum of all hits per pixel like depfetHitmap to this file, %1% is replaced by the module number")
+  ("hitmap-partial", po::value<string>(&hitmapPartialFile), "Also write the hitmap as partial result for depfetMerge to this file, %1% is replaced by the module number")
+  ("dump", po::value<string>(&dumpFile), "Write all frames like depfetDump to this file")
+  ("hits", po::value<string>(&hitsFile), "Write one \"event module frame column row signal\" line per hit to this file")
+  ("occupancy", po::value<string>(&occupancyFile), "Write the number of hits per frame and the hit fraction of each pixel to this file")
+  ("clusters", po::value<string>(&clusterFile), "Find clusters of neighbouring hits and write them as binary records to this file, see FrameConsumer.h for the format")
+  ("summary", po::value<string>(&summaryFile), "Write mean, RMS, occupancy, common mode range, start gate and temperature of each frame as binary records to this file, see FrameConsumer.h for the format")
+  ("shm", po::value<string>(&shmName), "Publish the hitmap and hit statistics in the POSIX shared memory segment with this name at every snapshot, %1% is replaced by the module number")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+  //Values from the command line are stored first and are not overwritten by the config files
+  if (vm.count("config")) {
+    BOOST_FOREACH(const string & filename, vm["config"].as< vector<string> >()) {
+      ifstream config(filename.c_str());
+      if (!config) {
+        cerr << "Could not open config file " << filename << endl;
+        return 2;
+      }
+      po::store(po::parse_config_file(config, desc), vm);
+    }
+  }
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+  if (!shardSpec.empty() && vm.count("merge")) {
+    cerr << "Shards cannot be used when merging files" << endl;
+    return 2;
+  }
+  if (calibrationFile.empty()) {
+    cerr << "No calibration file given" << endl;
+    return 4;
+  }
+  if (!traceFile.empty()) {
+    DEPFET::TraceRecorder::enable();
+    DEPFET::TraceRecorder::setThreadName("main");
+  }
+
+  //Common mode correction: row wise correction using two half rows and one column
+  DEPFET::CommonMode commonMode(2, 1, 2, 1);
+  if (vm.count("dcd")) {
+    commonMode = DEPFET::CommonMode(4, 0, 1, 1);
+  }
+
+  //Create all requested analyses
+  vector<DEPFET::FrameConsumer*> consumers;
+  try {
+    if (!hitmapFile.empty()) consumers.push_back(new DEPFET::HitmapConsumer(hitmapFile, sigmaCut, hitmapPartialFile));
+    if (!dumpFile.empty()) consumers.push_back(new DEPFET::DumpConsumer(dumpFile, sigmaCut));
+    if (!hitsFile.empty()) consumers.push_back(new DEPFET::HitListConsumer(hitsFile, sigmaCut));
+    if (!occupancyFile.empty()) consumers.push_back(new DEPFET::OccupancyConsumer(occupancyFile, sigmaCut));
+    if (!shmName.empty()) consumers.push_back(new DEPFET::SharedHitmapConsumer(shmName, sigmaCut));
+    if (!clusterFile.empty()) consumers.push_back(new DEPFET::ClusterConsumer(clusterFile, sigmaCut));
+    if (!summaryFile.empty()) consumers.push_back(new DEPFET::FrameSummaryConsumer(summaryFile, sigmaCut, &commonMode));
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    return 3;
+  }
+  if (consumers.empty()) {
+    cerr << "No analysis selected, give at least one of --hitmap, --dump, --hits, --occupancy, --clusters, --summary or --shm" << endl;
+    return 2;
+  }
+
+  DEPFET::DataReader reader;
+  reader.setReadoutFold(2);
+  reader.setUseDCDBMapping(true);
+  reader.setRecovery(vm.count("recover"));
+  reader.setMergeFiles(vm.count("merge"));
+  SnapshotPublisher publisher(consumers, snapshotInterval);
+  reader.setFollow(vm.count("follow"), followTimeout, &publisher);
+  if (vm.count("4fold")) {
+    reader.setReadoutFold(4);
+  }
+
+  //Restrict the events to the selected part of the input
+  if (!shardSpec.empty()) {
+    try {
+      DEPFET::Shard::select(shardSpec, inputFiles, skipEvents, maxEvents, vm.count("recover"), cout);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 2;
+    }
+  }
+
+  //The calibration of each module is loaded when it first appears
+  DEPFET::CalibrationStore calibrationStore;
+  map<int, ModuleState> modules;
+  DEPFET::ProcessingStats stats;
+  int eventNr(1);
+  reader.open(inputFiles, maxEvents);
+  reader.skip(skipEvents);
+  while (reader.next()) {
+    DEPFET::Event& event = reader.getEvent();
+    BOOST_FOREACH(DEPFET::FrameConsumer * consumer, consumers) {
+      consumer->beginEvent(event);
+    }
+    BOOST_FOREACH(DEPFET::ADCValues & data, event) {
+      if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
+      ModuleState* module = loadCalibration(modules, calibrationStore, calibrationFile, data, sigmaCut, trackInterval, hotWindow, hotThreshold);
+      if (!module) return 5;
+      const DEPFET::MaskView mask = module->calibration.getMask();
+      const DEPFET::ValueView noise = module->calibration.getNoise();
+      commonMode.setMask(mask);
+      commonMode.setNoise(sigmaCut, noise);
+      //Pedestal substraction
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        data.substract(module->calibration.getPedestals());
+        stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
+      }
+      //Common Mode correction
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::COMMONMODE);
+        commonMode.apply(data);
+        stats[DEPFET::ProcessingStats::COMMONMODE].countFrame(data);
+      }
+      //Follow pedestal drifts using the signal free pixels
+      if (trackInterval > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        module->pedestalTracker.add(data, module->calibration.copyPedestals());
+      }
+      //Mask pixels firing much more often than the others
+      if (hotWindow > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        module->hotPixelTracker.add(data);
+      }
+      //Pass the corrected frame to all analyses
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      stats[DEPFET::ProcessingStats::OUTPUT].countFrame(data);
+      try {
+        BOOST_FOREACH(DEPFET::FrameConsumer * consumer, consumers) {
+          consumer->processFrame(data, mask, noise);
+        }
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        return 3;
+      }
+    }
+    BOOST_FOREACH(DEPFET::FrameConsumer * consumer, consumers) {
+      consumer->endEvent(event);
+    }
+    ++stats[DEPFET::ProcessingStats::OUTPUT].events;
+    publisher.eventDone();
+    if (showProgress(eventNr)) {
+      cout << "Analysis: " << eventNr << " events processed" << endl;
+    }
+    ++eventNr;
+  }
+
+  //Write the results of all analyses
+  int result(0);
+  {
+    DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+    BOOST_FOREACH(DEPFET::FrameConsumer * consumer, consumers) {
+      try {
+        consumer->finish();
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        result = 3;
+      }
+      delete consumer;
+    }
+  }
+
+  //Write the masks including the hot pixels found
+  if (hotWindow > 0) {
+    for (map<int, ModuleState>::const_iterator it = modules.begin(); it != modules.end(); ++it) {
+      cout << "Module " << it->first << ": masked " << it->second.hotPixelTracker.getHotPixels().size() << " hot pixels" << endl;
+      if (hotMaskFile.empty()) continue;
+      boost::format filename(hotMaskFile);
+      filename.exceptions(boost::io::all_error_bits ^ boost::io::too_many_args_bit);
+      try {
+        it->second.hotPixelTracker.write((filename % it->first).str());
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        return 3;
+      }
+    }
+  }
+
+  DEPFET::ProcessingStats::printSkipped(cerr, reader.getSkippedRanges());
+  if (reader.getEventBuilder()) reader.getEventBuilder()->printSummary(cerr);
+
+  if (vm.count("stats")) {
+    stats.merge(reader.getStats());
+    stats.print(cout);
+  }
+
+  if (!traceFile.empty()) {
+    try {
+      DEPFET::TraceRecorder::write(traceFile);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,339 @@
+#include <DEPFETReader/DataGenerator.h>
+#include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/S3AConverter.h>
+#include <DEPFETReader/S3BConverter.h>
+#include <DEPFETReader/DCDConverter.h>
+#include <DEPFETReader/CommonMode.h>
+#include <DEPFETReader/AdaptivePedestals.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+/** Return a monotonic time in seconds */
+double now()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/** Base class for all benchmarks. run() processes one unit of work and
+ * increases the number of frames and bytes processed accordingly */
+class Benchmark {
+public:
+  Benchmark(const string& name): m_name(name) {}
+  virtual ~Benchmark() {}
+  const string& getName() const { return m_name; }
+  virtual void run(size_t& frames, size_t& bytes) = 0;
+protected:
+  string m_name;
+};
+
+/** Generated raw data for one device configuration */
+struct Configuration {
+  Configuration(const string& name, int deviceType, int fold, bool useDCDBMapping, int nEvents):
+    name(name), deviceType(deviceType), fold(fold), useDCDBMapping(useDCDBMapping)
+  {
+    DEPFET::DataGenerator generator(deviceType, fold, useDCDBMapping);
+    const bool dcd = deviceType == DEPFET::DEVICETYPE_DEPFET_DCD;
+    generator.addModule(0, dcd ? 0 : 3000, dcd ? 20 : 300, dcd ? 1.5 : 10, dcd ? 0.15 : 1);
+    generator.setCommonMode(dcd ? 3 : 20);
+    generator.setHits(10, dcd ? 40 : 500);
+    ostringstream output;
+    generator.writeRunHeader(output);
+    for (int i = 0; i < nEvents; ++i) generator.writeEvent(output);
+    generator.writeRunTrailer(output);
+    data = output.str();
+    calibration = generator.getModules()[0];
+  }
+
+  string name;
+  int deviceType;
+  int fold;
+  bool useDCDBMapping;
+  /** Raw data of the whole run */
+  string data;
+  /** Pedestals and noise used to generate the data */
+  DEPFET::ModuleCalibration calibration;
+};
+
+/** Benchmark converting the first frame of a configuration over and over */
+template<class CONVERTER> class ConverterBenchmark: public Benchmark {
+public:
+  ConverterBenchmark(const string& name, const Configuration& config, CONVERTER converter):
+    Benchmark(name), m_stream(config.data), m_rawData(m_stream), m_converter(converter)
+  {
+    //Find the first module record: skip the run header and the group header
+    while (true) {
+      m_rawData.readHeader();
+      if (!m_stream) throw runtime_error("No data found for " + name);
+      if (m_rawData.getDeviceType() == DEPFET::DEVICETYPE_INFO) continue;
+      if (m_rawData.getDeviceType() == DEPFET::DEVICETYPE_GROUP) continue;
+      break;
+    }
+    m_rawData.readData();
+  }
+  void run(size_t& frames, size_t& bytes) {
+    bytes += m_converter(m_rawData, m_adcValues) * sizeof(DEPFET::RawData::value_type);
+    ++frames;
+  }
+protected:
+  istringstream m_stream;
+  DEPFET::RawData m_rawData;
+  CONVERTER m_converter;
+  DEPFET::ADCValues m_adcValues;
+};
+
+/** Benchmark reading all events of a file with DataReader::next() */
+class ReaderBenchmark: public Benchmark {
+public:
+  ReaderBenchmark(const string& name, const Configuration& config, const string& tempDirectory):
+    Benchmark(name), m_nEvents(0)
+  {
+    //DataReader reads regular files and streams through different buffers,
+    //this measures reading a file, so write the data to a temporary file
+    string filename = tempDirectory + "/depfetBenchmark.XXXXXX";
+    vector<char> buffer(filename.begin(), filename.end());
+    buffer.push_back(0);
+    int fd = mkstemp(&buffer.front());
+    if (fd < 0) throw runtime_error("Could not create temporary file in " + tempDirectory);
+    close(fd);
+    m_filename = &buffer.front();
+    ofstream output(m_filename.c_str(), ios::out | ios::binary | ios::trunc);
+    output.write(config.data.data(), config.data.size());
+    if (!output) throw runtime_error("Could not write temporary file " + m_filename);
+    output.close();
+
+    m_reader.setReadoutFold(config.fold);
+    m_reader.setUseDCDBMapping(config.useDCDBMapping);
+    reopen();
+    while (m_reader.next()) ++m_nEvents;
+    if (m_nEvents == 0) throw runtime_error("No events found for " + name);
+    m_bytesPerEvent = config.data.size() / m_nEvents;
+    reopen();
+  }
+  ~ReaderBenchmark() {
+    std::remove(m_filename.c_str());
+  }
+  void run(size_t& frames, size_t& bytes) {
+    if (!m_reader.next()) {
+      reopen();
+      m_reader.next();
+    }
+    frames += m_reader.getEvent().size();
+    bytes += m_bytesPerEvent;
+  }
+protected:
+  void reopen() {
+    m_reader.open(vector<string>(1, m_filename));
+  }
+  string m_filename;
+  DEPFET::DataReader m_reader;
+  int m_nEvents;
+  size_t m_bytesPerEvent;
+};
+
+/** Benchmark applying common mode correction to a pedestal corrected frame.
+ * The frame is copied before each correction, which is included in the time */
+class CommonModeBenchmark: public Benchmark {
+public:
+  CommonModeBenchmark(const string& name, const DEPFET::ADCValues& frame, DEPFET::CommonMode commonMode):
+    Benchmark(name), m_frame(frame), m_commonMode(commonMode) {}
+  void run(size_t& frames, size_t& bytes) {
+    m_data = m_frame;
+    m_commonMode.apply(m_data);
+    ++frames;
+    bytes += m_data.getSize() * sizeof(DEPFET::ADCValues::value_type);
+  }
+protected:
+  DEPFET::ADCValues m_frame;
+  DEPFET::ADCValues m_data;
+  DEPFET::CommonMode m_commonMode;
+};
+
+/** Benchmark substracting pedestals from a frame */
+class SubstractBenchmark: public Benchmark {
+public:
+  SubstractBenchmark(const string& name, const DEPFET::ADCValues& frame, const DEPFET::ValueMatrix<double>& pedestals):
+    Benchmark(name), m_data(frame), m_pedestals(pedestals) {}
+  void run(size_t& frames, size_t& bytes) {
+    m_data.substract(m_pedestals);
+    ++frames;
+    bytes += m_data.getSize() * sizeof(DEPFET::ADCValues::value_type);
+  }
+protected:
+  DEPFET::ADCValues m_data;
+  DEPFET::ValueMatrix<double> m_pedestals;
+};
+
+/** Benchmark feeding a frame into one AdaptivePedestal per pixel */
+class AdaptivePedestalBenchmark: public Benchmark {
+public:
+  AdaptivePedestalBenchmark(const string& name, const DEPFET::ADCValues& frame):
+    Benchmark(name), m_frame(frame), m_pedestals(frame.getSize()) {}
+  void run(size_t& frames, size_t& bytes) {
+    for (size_t i = 0; i < m_frame.getSize(); ++i) {
+      m_pedestals[i].addRaw((int) m_frame[i]);
+    }
+    ++frames;
+    bytes += m_frame.getSize() * sizeof(DEPFET::ADCValues::value_type);
+  }
+protected:
+  DEPFET::ADCValues m_frame;
+  vector<DEPFET::AdaptivePedestal> m_pedestals;
+};
+
+/** Run a benchmark for at least minTime seconds and print the result */
+void measure(Benchmark& benchmark, double minTime, ostream& output)
+{
+  size_t frames(0), bytes(0);
+  //Warm up caches and lazy initialization
+  benchmark.run(frames, bytes);
+  frames = 0;
+  bytes = 0;
+
+  const double start = now();
+  double elapsed(0);
+  do {
+    for (int i = 0; i < 16; ++i) benchmark.run(frames, bytes);
+    elapsed = now() - start;
+  } while (elapsed < minTime);
+
+  output << boost::format("%-32s %10d %10.4f %14.1f %14.1f\n")
+         % benchmark.getName() % frames % elapsed % (frames / elapsed) % (bytes / elapsed);
+  output.flush();
+}
+
+/** Return the first frame of a configuration, converted and with pedestals substracted */
+DEPFET::ADCValues getFrame(const Configuration& config)
+{
+  DEPFET::DataReader reader;
+  reader.setReadoutFold(config.fold);
+  reader.setUseDCDBMapping(config.useDCDBMapping);
+  istringstream stream(config.data);
+  DEPFET::RawData rawData(stream);
+  do {
+    rawData.readHeader();
+  } while (stream && (rawData.getDeviceType() == DEPFET::DEVICETYPE_INFO ||
+                      rawData.getDeviceType() == DEPFET::DEVICETYPE_GROUP));
+  rawData.readData();
+  DEPFET::ADCValues frame;
+  reader.convertData(rawData, frame);
+  return frame;
+}
+
+int main(int argc, char* argv[])
+{
+  double minTime(0.5);
+  int nEvents(100);
+  string filter;
+  string outputFile;
+  string tempDirectory("/tmp");
+
+  //Parse program arguments
+  po::options_description desc("Measure the throughput of the DEPFETReader components.\n"
+                               "Output is one line per benchmark: name, frames, seconds, frames/s, bytes/s\n"
+                               "Allowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("time,t", po::value<double>(&minTime)->default_value(minTime), "Minimum time in seconds for each benchmark")
+  ("nevents,n", po::value<int>(&nEvents)->default_value(nEvents), "Number of events to generate for each device configuration")
+  ("filter,f", po::value<string>(&filter), "Only run benchmarks whose name contains this string")
+  ("output,o", po::value<string>(&outputFile), "Write results to this file instead of stdout")
+  ("tmpdir", po::value<string>(&tempDirectory)->default_value(tempDirectory), "Directory for temporary data files")
+  ;
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  ofstream outputStream;
+  if (!outputFile.empty()) {
+    outputStream.open(outputFile.c_str());
+    if (!outputStream) {
+      cerr << "Could not open output file " << outputFile << endl;
+      return 3;
+    }
+  }
+  ostream& output = outputFile.empty() ? cout : outputStream;
+
+  vector<Configuration*> configs;
+  vector<Benchmark*> benchmarks;
+  try {
+    configs.push_back(new Configuration("s3a", DEPFET::DEVICETYPE_DEPFET, 2, true, nEvents));
+    configs.push_back(new Configuration("s3b-2fold", DEPFET::DEVICETYPE_DEPFET_128, 2, true, nEvents));
+    configs.push_back(new Configuration("s3b-4fold", DEPFET::DEVICETYPE_DEPFET_128, 4, true, nEvents));
+    configs.push_back(new Configuration("dcd-2fold", DEPFET::DEVICETYPE_DEPFET_DCD, 2, true, nEvents));
+    configs.push_back(new Configuration("dcd-4fold", DEPFET::DEVICETYPE_DEPFET_DCD, 4, true, nEvents));
+    configs.push_back(new Configuration("dcd-2fold-nomap", DEPFET::DEVICETYPE_DEPFET_DCD, 2, false, nEvents));
+    configs.push_back(new Configuration("dcd-4fold-nomap", DEPFET::DEVICETYPE_DEPFET_DCD, 4, false, nEvents));
+    const Configuration& curo = *configs[1];
+    const Configuration& dcd = *configs[4];
+
+    //Converters
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::S3AConverter>("convert/s3a", *configs[0], DEPFET::S3AConverter()));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::S3BConverter2Fold>("convert/s3b-2fold", *configs[1], DEPFET::S3BConverter2Fold()));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::S3BConverter4Fold>("convert/s3b-4fold", *configs[2], DEPFET::S3BConverter4Fold()));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::DCDConverter2Fold>("convert/dcd-2fold", *configs[3], DEPFET::DCDConverter2Fold(true)));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::DCDConverter4Fold>("convert/dcd-4fold", *configs[4], DEPFET::DCDConverter4Fold(true)));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::DCDConverter2Fold>("convert/dcd-2fold-nomap", *configs[5], DEPFET::DCDConverter2Fold(false)));
+    benchmarks.push_back(new ConverterBenchmark<DEPFET::DCDConverter4Fold>("convert/dcd-4fold-nomap", *configs[6], DEPFET::DCDConverter4Fold(false)));
+
+    //Pedestal substraction and common mode on pedestal corrected frames,
+    //using the same configurations as the tools
+    DEPFET::ADCValues curoFrame = getFrame(curo);
+    DEPFET::ADCValues dcdFrame = getFrame(dcd);
+    benchmarks.push_back(new SubstractBenchmark("substract/s3b-2fold", curoFrame, curo.calibration.pedestals));
+    benchmarks.push_back(new SubstractBenchmark("substract/dcd-4fold", dcdFrame, dcd.calibration.pedestals));
+    curoFrame.substract(curo.calibration.pedestals);
+    dcdFrame.substract(dcd.calibration.pedestals);
+
+    DEPFET::CommonMode curoCommonMode(2, 1, 2, 1);
+    DEPFET::CommonMode dcdCommonMode(4, 0, 1, 1);
+    benchmarks.push_back(new CommonModeBenchmark("commonmode/curo", curoFrame, curoCommonMode));
+    benchmarks.push_back(new CommonModeBenchmark("commonmode/dcd", dcdFrame, dcdCommonMode));
+    curoCommonMode.setMask(curo.calibration.mask.getView());
+    curoCommonMode.setNoise(5.0, curo.calibration.noise.getView());
+    dcdCommonMode.setMask(dcd.calibration.mask.getView());
+    dcdCommonMode.setNoise(5.0, dcd.calibration.noise.getView());
+    benchmarks.push_back(new CommonModeBenchmark("commonmode/curo-masked", curoFrame, curoCommonMode));
+    benchmarks.push_back(new CommonModeBenchmark("commonmode/dcd-masked", dcdFrame, dcdCommonMode));
+
+    benchmarks.push_back(new AdaptivePedestalBenchmark("adaptivepedestal/s3b-2fold", getFrame(curo)));
+    benchmarks.push_back(new AdaptivePedestalBenchmark("adaptivepedestal/dcd-4fold", getFrame(dcd)));
+
+    //End to end reading
+    BOOST_FOREACH(const Configuration * config, configs) {
+      benchmarks.push_back(new ReaderBenchmark("reader/" + config->name, *config, tempDirectory));
+    }
+
+    output << boost::format("# %-30s %10s %10s %14s %14s\n") % "name" % "frames" % "seconds" % "frames/s" % "bytes/s";
+    BOOST_FOREACH(Benchmark * benchmark, benchmarks) {
+      if (!filter.empty() && benchmark->getName().find(filter) == string::npos) continue;
+      measure(*benchmark, minTime, output);
+    }
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    BOOST_FOREACH(Benchmark * benchmark, benchmarks) delete benchmark;
+    BOOST_FOREACH(Configuration * config, configs) delete config;
+    return 5;
+  }
+
+  BOOST_FOREACH(Benchmark * benchmark, benchmarks) delete benchmark;
+  BOOST_FOREACH(Configuration * config, configs) delete config;
+}
@@ -1,6 +1,11 @@
 #include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/Shard.h>
 #include <DEPFETReader/CommonMode.h>
-#include <DEPFETReader/IncrementalMean.h>
+#include <DEPFETReader/PixelAccumulator.h>
+#include <DEPFETReader/NoiseHistograms.h>
+#include <DEPFETReader/PartialResult.h>
+#include <DEPFETReader/CalibrationCache.h>
+#include <DEPFETReader/SampleStore.h>
 
 #include <cmath>
 #include <iostream>
@@ -8,6 +13,8 @@
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <boost/iostreams/char_traits.hpp> // EOF, WOULD_BLOCK
 #include <boost/iostreams/concepts.hpp>    // input_filter
 #include <boost/iostreams/operations.hpp>  // get
@@ -18,8 +25,6 @@
 #include <TFile.h>
 #include <TCanvas.h>
 #include <TStyle.h>
-#include <TF1.h>
-#include <TGraph.h>
 #include <TMath.h>
 
 using namespace std;
@@ -57,35 +62,6 @@ private:
   bool m_skip;
 };
 
-double setRangeFraction(TH1* hist, double fraction = 0.9)
-{
-  double mean = hist->GetMean();
-  double maxEntries = hist->GetEntries() * fraction;
-  if (maxEntries < 1) {
-    cerr << hist->GetName() << ": Not enough Entries (" << hist->GetEntries() << ") for RangeFraction (" << fraction << ")\n";
-    return 0;
-  }
-  int binLeft = hist->FindBin(mean);
-  int binRight = binLeft;
-  int binMax = hist->GetNbinsX();
-  double entries = hist->GetBinContent(binLeft);
-  while (entries < maxEntries) {
-    if (--binLeft > 0) {
-      entries += hist->GetBinContent(binLeft);
-    }
-    if (++binRight <= binMax) {
-      entries += hist->GetBinContent(binRight);
-    }
-    if (binLeft <= 0 && binRight > binMax) {
-      cerr << "Did not reach " << fraction << " with " << hist->GetName() << std::endl;
-      break;
-    }
-  }
-  hist->GetXaxis()->SetRange(binLeft, binRight);
-  return entries / hist->GetEntries();
-}
-
-
 bool showProgress(int event, int minOrder = 1, int maxOrder = 3)
 {
   int order = (event == 0) ? 1 : max(min((int)log10(event), maxOrder), minOrder);
@@ -93,9 +69,8 @@ bool showProgress(int event, int minOrder = 1, int maxOrder = 3)
   return (event % interval == 0);
 }
 
-typedef DEPFET::ValueMatrix<DEPFET::IncrementalMean> PixelMean;
-typedef DEPFET::ValueMatrix<TH1D*> HistGrid;
-typedef DEPFET::ValueMatrix<TGraph*> GraphGrid;
+typedef DEPFET::PixelAccumulator PixelMean;
+typedef DEPFET::ValueMatrix<double> PixelValues;
 
 //Output a single value to file
 inline void dumpValue(ostream& output, double value, double scale)
@@ -104,36 +79,185 @@ inline void dumpValue(ostream& output, double value, double scale)
   if (output) output << setprecision(2) << setw(8) << fixed << (value * scale) << " ";
 }
 
+//Settings to stop reading once the pedestals are known well enough
+struct Convergence {
+  Convergence(): pedestalPrecision(0), noisePrecision(0), fraction(0.99), interval(100) {}
+  //Check if early stopping is enabled
+  bool enabled() const { return pedestalPrecision > 0 || noisePrecision > 0; }
+  //Required standard error of the pedestals in ADC units, 0=not checked
+  double pedestalPrecision;
+  //Required relative standard error of the noise, 0=not checked
+  double noisePrecision;
+  //Fraction of unmasked pixels which have to reach the precision
+  double fraction;
+  //Number of events between checks
+  int interval;
+};
+
 //Calculate the pedestals: Determine mean and sigma of every pixel, optionally
-//applying a cut using mean and sigma of a previous run
-void calculatePedestals(DEPFET::DataReader& reader, PixelMean& pedestals, double sigmaCut, DEPFET::PixelMask& masked, int frameNr)
+//applying a cut using mean and sigma of a previous run. If convergence is
+//given, reading stops as soon as enough pixels reach the precision. Returns
+//the number of events read
+int calculatePedestals(DEPFET::DataReader& reader, PixelMean& pedestals, double sigmaCut, const DEPFET::PixelMask& masked, int frameNr,
+                       DEPFET::ProcessingStats& stats, bool verbose = true, const Convergence* convergence = 0)
 {
   PixelMean newPedestals;
   int eventNr(1);
-  while (reader.next()) {
+  bool converged(false);
+  while (!converged && reader.next()) {
     DEPFET::Event& event = reader.getEvent();
     BOOST_FOREACH(DEPFET::ADCValues & data, event) {
       if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
-      if (!newPedestals) newPedestals.setSize(data);
-
-      for (size_t x = 0; x < data.getSizeX(); ++x) {
-        for (size_t y = 0; y < data.getSizeY(); ++y) {
-          if (masked(x, y)) continue;
-          if (sigmaCut > 0) {
-            const double mean = pedestals(x, y).getMean();
-            const double width = pedestals(x, y).getSigma() * sigmaCut;
-            if (std::fabs(data(x, y) - mean) > width) continue;
-          }
-          newPedestals(x, y).add(data(x, y));
-        }
+      if (!newPedestals) {
+        newPedestals.setSize(data);
+        newPedestals.setMask(masked);
+        if (sigmaCut > 0) newPedestals.setCut(pedestals, sigmaCut);
       }
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+      newPedestals.add(data);
+      stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
     }
-    if (showProgress(eventNr)) {
+    if (verbose && showProgress(eventNr)) {
       cout << "Pedestal calculation (" << sigmaCut << " sigma cut): " << eventNr << " events read" << endl;
     }
+    if (convergence && newPedestals.getSize() > 0 && eventNr % convergence->interval == 0) {
+      const double fraction = newPedestals.getConvergedFraction(convergence->pedestalPrecision, convergence->noisePrecision);
+      converged = fraction >= convergence->fraction;
+      if (converged) {
+        cout << "Pedestals converged for " << fraction * 100 << "% of the pixels after " << eventNr << " events" << endl;
+      }
+    }
     ++eventNr;
   }
+  if (convergence && !converged && newPedestals.getSize() > 0) {
+    cout << "Pedestals did not converge, reached the precision for "
+         << newPedestals.getConvergedFraction(convergence->pedestalPrecision, convergence->noisePrecision) * 100
+         << "% of the pixels after " << eventNr - 1 << " events" << endl;
+  }
   swap(newPedestals, pedestals);
+  return eventNr - 1;
+}
+
+//Part of the input to be processed by one thread
+struct EventRange {
+  /** files to read */
+  vector<string> files;
+  /** number of events to skip before reading */
+  int skipEvents;
+  /** number of events to read, -1 for all */
+  int nEvents;
+};
+
+//Split the input into one event range per thread. If all events of all
+//files are requested and there are enough files, each thread reads complete
+//files. Otherwise the selected events are split into consecutive ranges
+vector<EventRange> splitInput(DEPFET::DataReader& reader, const vector<string>& inputFiles, int skipEvents, int maxEvents, int nThreads)
+{
+  vector<EventRange> ranges;
+  if (maxEvents <= 0 && skipEvents == 0 && (int)inputFiles.size() >= nThreads) {
+    ranges.resize(nThreads);
+    for (size_t i = 0; i < inputFiles.size(); ++i) {
+      ranges[i % nThreads].files.push_back(inputFiles[i]);
+    }
+    BOOST_FOREACH(EventRange & range, ranges) {
+      range.skipEvents = 0;
+      range.nEvents = -1;
+    }
+    return ranges;
+  }
+
+  if (nThreads == 1) {
+    EventRange range;
+    range.files = inputFiles;
+    range.skipEvents = skipEvents;
+    range.nEvents = maxEvents;
+    ranges.push_back(range);
+    return ranges;
+  }
+
+  //Count the available events, the input might contain fewer than requested
+  reader.open(inputFiles);
+  reader.skip(skipEvents);
+  int available(0);
+  while (reader.next(true)) ++available;
+  if (maxEvents <= 0 || maxEvents > available) maxEvents = available;
+  nThreads = max(1, min(nThreads, maxEvents));
+  int start = skipEvents;
+  for (int i = 0; i < nThreads; ++i) {
+    EventRange range;
+    range.files = inputFiles;
+    range.skipEvents = start;
+    range.nEvents = maxEvents / nThreads + (i < maxEvents % nThreads ? 1 : 0);
+    start += range.nEvents;
+    ranges.push_back(range);
+  }
+  return ranges;
+}
+
+//Result of one thread of the pedestal calculation
+struct PedestalResult {
+  /** pedestals of the event range */
+  PixelMean pedestals;
+  /** processing statistics of the thread */
+  DEPFET::ProcessingStats stats;
+  /** error message if the thread failed, empty otherwise */
+  string error;
+};
+
+//Calculate the pedestals of one event range using its own reader. Errors
+//are stored in the result as exceptions must not leave the thread
+void calculatePedestalRange(const EventRange& range, int fold, bool recover, PedestalResult& result, double sigmaCut,
+                            const DEPFET::PixelMask& masked, int frameNr, int threadNr)
+{
+  try {
+    DEPFET::TraceRecorder::setThreadName((boost::format("pedestals %1%") % threadNr).str());
+    DEPFET::DataReader reader;
+    reader.setReadoutFold(fold);
+    reader.setUseDCDBMapping(true);
+    reader.setRecovery(recover);
+    reader.open(range.files, range.nEvents);
+    reader.skip(range.skipEvents);
+    calculatePedestals(reader, result.pedestals, sigmaCut, masked, frameNr, result.stats, threadNr == 0);
+    result.stats.merge(reader.getStats());
+  } catch (std::exception& e) {
+    result.error = e.what();
+  }
+}
+
+//Calculate the pedestals using one thread per event range and merge the
+//results. The processing times of all threads are added up. Returns false
+//if one of the threads failed, after printing its error
+bool calculatePedestals(const vector<EventRange>& ranges, int fold, bool recover, PixelMean& pedestals, double sigmaCut, const DEPFET::PixelMask& masked,
+                        int frameNr, DEPFET::ProcessingStats& stats)
+{
+  //Each thread starts with the previous result as reference for the sigma cut
+  vector<PedestalResult> partial(ranges.size());
+  BOOST_FOREACH(PedestalResult & result, partial) {
+    result.pedestals = pedestals;
+  }
+  boost::thread_group threads;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    threads.create_thread(boost::bind(&calculatePedestalRange, boost::cref(ranges[i]), fold, recover, boost::ref(partial[i]),
+                                      sigmaCut, boost::cref(masked), frameNr, (int) i));
+  }
+  threads.join_all();
+  bool success(true);
+  BOOST_FOREACH(const PedestalResult & result, partial) {
+    stats.merge(result.stats);
+    if (!result.error.empty()) {
+      cerr << result.error << endl;
+      success = false;
+    }
+  }
+  if (!success) return false;
+
+  swap(partial[0].pedestals, pedestals);
+  for (size_t i = 1; i < partial.size(); ++i) {
+    if (!partial[i].pedestals) continue;
+    if (!pedestals) swap(partial[i].pedestals, pedestals);
+    else pedestals.merge(partial[i].pedestals);
+  }
+  return true;
 }
 
 int main(int argc, char* argv[])
@@ -144,8 +268,16 @@ int main(int argc, char* argv[])
   double scaleFactor(1.0);
   vector<string> inputFiles;
   string outputFile;
+  string traceFile;
+  string shardSpec;
   string maskFile("MaskCh-Mod%1%.txt");
   int frameNr(-1);
+  int nThreads(1);
+  string cacheDirectory;
+  string partialFile;
+  string rawSampleFile;
+  int rawBlockFrames(1024);
+  Convergence convergence;
 
   //Parse program arguments
   po::options_description desc("Allowed options");
@@ -161,6 +293,19 @@ int main(int argc, char* argv[])
   ("4fold", "If set, data is read out in 4fold mode, otherwise 2fold")
   ("dcd", "If set, common mode corretion is set to DCD mode (4 full rows), otherwise curo topology is used (two half rows")
   ("frame,f", po::value<int>(&frameNr)->default_value(frameNr), "Set the frame number to be used: -1=all, 0=original, 1=1st tailing, ...")
+  ("threads,j", po::value<int>(&nThreads)->default_value(nThreads), "Number of threads used for the pedestal calculation. If the pedestals are checked for convergence, the first pass is read by one thread")
+  ("shard", po::value<string>(&shardSpec), "Process only part i of N consecutive parts of the selected events, e.g. 0/4. The calibration is determined from this part only")
+  ("recover", "Continue after corrupted data by searching for the next valid event instead of aborting")
+  ("stats", "Print time and throughput of each processing stage at the end. Times of parallel passes are added up over all threads")
+  ("trace", po::value<string>(&traceFile), "Write a timeline of the processing stages in Chrome trace format to this file")
+  ("partial", po::value<string>(&partialFile), "Also write the pedestal accumulator and the noise histograms to this binary file, to be combined with the results of other jobs by depfetMerge")
+  ("raw-samples", po::value<string>(&rawSampleFile), "Write the raw adc values of all frames of the noise pass transposed to this file, so the history of single pixels can be read quickly, see SampleStore.h for the format. Disables the cache")
+  ("raw-block", po::value<int>(&rawBlockFrames)->default_value(rawBlockFrames), "Number of frames kept in memory per block of the raw sample file")
+  ("converge-pedestal", po::value<double>(&convergence.pedestalPrecision)->default_value(0), "Stop reading once the standard error of the pedestals is below this value for enough pixels, nevents becomes the upper limit. The first pass then runs on one thread only. 0=always read nevents")
+  ("converge-noise", po::value<double>(&convergence.noisePrecision)->default_value(0), "Stop reading once the relative standard error of the noise is below this value for enough pixels, e.g. 0.02. The first pass then runs on one thread only. 0=always read nevents")
+  ("converge-fraction", po::value<double>(&convergence.fraction)->default_value(convergence.fraction), "Fraction of unmasked pixels which have to reach the precision to stop reading")
+  ("converge-interval", po::value<int>(&convergence.interval)->default_value(convergence.interval), "Number of events between checks of the precision")
+  ("cache", po::value<string>(&cacheDirectory), "Directory to cache results in. If the same input was calibrated with the same settings before, the cached result is returned")
   ;
 
   po::variables_map vm;
@@ -179,10 +324,30 @@ int main(int argc, char* argv[])
     cerr << "No input files given" << endl;
     return 2;
   }
+  //The calibration needs several passes over the data
+  BOOST_FOREACH(const string & filename, inputFiles) {
+    if (DEPFET::StreamBuffer::isStream(filename)) {
+      cerr << "Cannot read " << filename << ": the calibration needs to read the input several times, streams are not supported" << endl;
+      return 2;
+    }
+  }
+  if (convergence.interval <= 0) {
+    cerr << "Number of events between precision checks must be positive" << endl;
+    return 2;
+  }
+  if (rawBlockFrames <= 0) {
+    cerr << "Number of frames per raw sample block must be positive" << endl;
+    return 2;
+  }
+  if (!traceFile.empty()) {
+    DEPFET::TraceRecorder::enable();
+    DEPFET::TraceRecorder::setThreadName("main");
+  }
 
   DEPFET::DataReader reader;
   reader.setReadoutFold(2);
   reader.setUseDCDBMapping(true);
+  reader.setRecovery(vm.count("recover"));
   //Common mode correction: row wise correction using two half rows and one column
   DEPFET::CommonMode commonMode(2, 1, 2, 1);
   if (vm.count("4fold")) {
@@ -193,8 +358,7 @@ int main(int argc, char* argv[])
   }
 
   PixelMean pedestals;
-  HistGrid noise;
-  GraphGrid raw;
+  DEPFET::NoiseHistograms noise;
   DEPFET::PixelMask  masked;
 
   reader.open(inputFiles, maxEvents);
@@ -205,8 +369,7 @@ int main(int argc, char* argv[])
   DEPFET::Event& event = reader.getEvent();
   boost::format maskFileFormat(maskFile);
   DEPFET::ADCValues& data = event[0];
-  noise.setSize(data);
-  raw.setSize(data);
+  const int moduleNr = data.getModuleNr();
   masked.setSize(data);
   if (!maskFile.empty()) {
     io::filtering_istream maskStream;
@@ -235,25 +398,74 @@ int main(int argc, char* argv[])
     }
   }
 
-  gStyle->SetOptFit(11111);
-  boost::format name("noise-%02dx%02d");
-  for (unsigned int col = 0; col < noise.getSizeX(); ++col) {
-    for (unsigned int row = 0; row < noise.getSizeY(); ++row) {
-      noise(col, row) = new TH1D((name % col % row).str().c_str(), "", 80, 0, -1);
-      noise(col, row)->SetBuffer(1000);
-      //raw(col, row) = new TGraph(1000);
+  //Restrict the events to the selected part of the input
+  if (!shardSpec.empty()) {
+    try {
+      DEPFET::Shard::select(shardSpec, inputFiles, skipEvents, maxEvents, vm.count("recover"), cout);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 2;
+    }
+  }
+
+  //Return the cached result if the same input was calibrated with the same settings
+  DEPFET::CalibrationCache cache(cacheDirectory);
+  vector<string> results;
+  results.push_back(outputFile);
+  results.push_back("noise.root");
+  if (!partialFile.empty()) results.push_back(partialFile);
+  //Raw sample files are too large to be cached, they are always written anew
+  if (!rawSampleFile.empty()) cacheDirectory.clear();
+  if (!cacheDirectory.empty()) {
+    BOOST_FOREACH(const string & filename, inputFiles) {
+      cache.addFile(filename);
+    }
+    if (!maskFile.empty()) cache.addSmallFile((boost::format(maskFile) % data.getModuleNr()).str());
+    cache.addParameter("skip", skipEvents);
+    cache.addParameter("nevents", maxEvents);
+    cache.addParameter("sigma", sigmaCut);
+    cache.addParameter("scale", scaleFactor);
+    cache.addParameter("4fold", vm.count("4fold"));
+    cache.addParameter("dcd", vm.count("dcd"));
+    cache.addParameter("frame", frameNr);
+    cache.addParameter("recover", vm.count("recover"));
+    if (convergence.enabled()) {
+      cache.addParameter("converge-pedestal", convergence.pedestalPrecision);
+      cache.addParameter("converge-noise", convergence.noisePrecision);
+      cache.addParameter("converge-fraction", convergence.fraction);
+      cache.addParameter("converge-interval", convergence.interval);
+    }
+    if (cache.fetch(results)) {
+      cout << "Using cached calibration " << cache.getHash() << " from " << cacheDirectory << endl;
+      return 0;
     }
   }
 
+  gStyle->SetOptFit(11111);
+
   //Calibration: Calculate pedestals, first run: determine mean and sigma for each pixel
-  reader.open(inputFiles, maxEvents);
-  reader.skip(skipEvents);
-  calculatePedestals(reader, pedestals, 0, masked, frameNr);
+  DEPFET::ProcessingStats stats;
+  if (convergence.enabled()) {
+    //Read sequentially until the pedestals are precise enough, the following passes use the same events
+    if (nThreads > 1) {
+      cout << "Checking the convergence needs the events in order, the first pass uses one thread" << endl;
+    }
+    DEPFET::TraceSpan span("pedestals, first pass until converged");
+    reader.open(inputFiles, maxEvents);
+    reader.skip(skipEvents);
+    maxEvents = calculatePedestals(reader, pedestals, 0, masked, frameNr, stats, true, &convergence);
+  }
+  vector<EventRange> ranges = splitInput(reader, inputFiles, skipEvents, maxEvents, max(1, nThreads));
+  if (!convergence.enabled()) {
+    DEPFET::TraceSpan span("pedestals, first pass");
+    if (!calculatePedestals(ranges, vm.count("4fold") ? 4 : 2, vm.count("recover"), pedestals, 0, masked, frameNr, stats)) return 5;
+  }
 
   //Second run, this time exclude values outside of sigmaCut * pedestal spread
-  reader.open(inputFiles, maxEvents);
-  reader.skip(skipEvents);
-  calculatePedestals(reader, pedestals, sigmaCut, masked, frameNr);
+  {
+    DEPFET::TraceSpan span("pedestals, second pass");
+    if (!calculatePedestals(ranges, vm.count("4fold") ? 4 : 2, vm.count("recover"), pedestals, sigmaCut, masked, frameNr, stats)) return 5;
+  }
 
   //Third run to determine noise level of pixels
   reader.open(inputFiles, maxEvents);
@@ -264,21 +476,56 @@ int main(int argc, char* argv[])
   TH1D* cMCHist = new TH1D("commonModeC", "common mode, column wise", 160, 0, -1);
   TH1D* rawHist = new TH1D("raw", "Raw adc values", 256, 0, -1);
   TH1D* adcHist = new TH1D("adc", "Corrected adc values", 256, 0, -1);
-  commonMode.setMask(&masked);
+  PixelValues pedestalValues;
+  pedestals.getMeans(pedestalValues);
+  //Histograms of the signals inside the noise cut, their range does not
+  //depend on the data so the partial results of several jobs can be merged
+  noise.setRange(pedestals, sigmaCut);
+  //Raw samples of all frames, transposed to be read pixel by pixel
+  DEPFET::SampleWriter rawSamples;
+  if (!rawSampleFile.empty()) {
+    try {
+      rawSamples.open(rawSampleFile, pedestals.getSizeX(), pedestals.getSizeY(), rawBlockFrames);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+  commonMode.setMask(masked.getView());
   while (reader.next()) {
     DEPFET::Event& event = reader.getEvent();
     BOOST_FOREACH(DEPFET::ADCValues & data, event) {
       if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
-      for (size_t x = 0; x < data.getSizeX(); ++x) {
-        for (size_t y = 0; y < data.getSizeY(); ++y) {
-          //raw(x, y)->SetPoint(eventNr - 1, eventNr, data(x, y));
-          rawHist->Fill(data(x, y));
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+        for (size_t x = 0; x < data.getSizeX(); ++x) {
+          for (size_t y = 0; y < data.getSizeY(); ++y) {
+            rawHist->Fill(data(x, y));
+          }
+        }
+        if (!rawSampleFile.empty()) {
+          try {
+            rawSamples.add(data);
+          } catch (std::exception& e) {
+            cerr << e.what() << endl;
+            return 3;
+          }
         }
       }
       //Pedestal substraction
-      data.substract(pedestals);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        data.substract(pedestalValues);
+        stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
+      }
       //Common Mode correction
-      commonMode.apply(data);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::COMMONMODE);
+        commonMode.apply(data);
+        stats[DEPFET::ProcessingStats::COMMONMODE].countFrame(data);
+      }
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      stats[DEPFET::ProcessingStats::OUTPUT].countFrame(data);
       BOOST_FOREACH(double c, commonMode.getCommonModesRow()) {
         cMRHist->Fill(c);
       }
@@ -292,16 +539,44 @@ int main(int argc, char* argv[])
           double signal = data(x, y);
           //Add signal to noise map if it is below nSigma*(sigma of pedestal)
           adcHist->Fill(signal);
-          if (std::fabs(signal) > sigmaCut * pedestals(x, y).getSigma()) continue;
-          noise(x, y)->Fill(signal);
+          if (std::fabs(signal) > sigmaCut * pedestals.getSigma(x, y)) continue;
+          noise.fill(x, y, signal);
         }
       }
     }
+    ++stats[DEPFET::ProcessingStats::OUTPUT].events;
     if (showProgress(eventNr)) {
       cout << "Calculating Noise: " << eventNr << " events read" << endl;
     }
     ++eventNr;
   }
+  stats.merge(reader.getStats());
+  DEPFET::ProcessingStats::printSkipped(cerr, reader.getSkippedRanges());
+  if (!rawSampleFile.empty()) {
+    try {
+      rawSamples.close();
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+    cout << "Wrote " << rawSamples.getFrames() << " frames of raw samples to " << rawSampleFile << endl;
+  }
+
+  if (!partialFile.empty()) {
+    DEPFET::PartialCalibration partial;
+    partial.moduleNr = moduleNr;
+    partial.events = eventNr - 1;
+    partial.mask = masked;
+    partial.pedestals = pedestals;
+    partial.noise = noise;
+    try {
+      DEPFET::PartialResult::write(partialFile, partial);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+  const double outputStart = DEPFET::StageTimer::getTime();
 
   ofstream output(outputFile.c_str());
   if (!output) {
@@ -310,29 +585,23 @@ int main(int argc, char* argv[])
   }
   TFile* rootFile = new TFile("noise.root", "RECREATE");
   TCanvas* c1 = new TCanvas("c1", "c1");
-  TF1* func = new TF1("f1", "gaus");
   c1->cd();
   TH1D* pedHist = new TH1D("pedestals", "Pedestals", 256, 0, -1);
   pedHist->SetBuffer(5000);
-  boost::format canvasName("noiseFit-%02dx%02d");
   for (unsigned int col = 0; col < pedestals.getSizeX(); ++col) {
     for (unsigned int row = 0; row < pedestals.getSizeY(); ++row) {
       output << setw(6) << col << setw(6) << row << setw(2) << (int)masked(col, row) << " ";
-      dumpValue(output, pedestals(col, row).getMean(), scaleFactor);
-      if (!masked(col, row)) pedHist->Fill(pedestals(col, row).getMean());
-      noise(col, row)->Draw();
+      dumpValue(output, pedestals.getMean(col, row), scaleFactor);
+      if (!masked(col, row)) pedHist->Fill(pedestals.getMean(col, row));
       if (masked(col, row)) {
         dumpValue(output, 0, 0);
       } else {
-        noise(col, row)->BufferEmpty();
-        setRangeFraction(noise(col, row));
-        noise(col, row)->Fit(func, "Q");
-        noiseFitProb->Fill(TMath::Prob(func->GetChisquare(), func->GetNDF()));
-        dumpValue(output, func->GetParameter(2), scaleFactor);
-        //noise(col, row)->GetXaxis()->UnZoom();
-        //func->Draw("same");
-        //c1->Update();
-        //c1->Write((canvasName % col % row).str().c_str());
+        //Gaussian fit to the central 90% of the signals
+        double chi2(0);
+        int ndf(0);
+        const double sigma = noise.getNoise(col, row, 0.9, &chi2, &ndf);
+        noiseFitProb->Fill(TMath::Prob(chi2, ndf));
+        dumpValue(output, sigma, scaleFactor);
       }
       output << endl;
     }
@@ -346,13 +615,26 @@ int main(int argc, char* argv[])
   adcHist->Write();
   pedHist->Write();
 
-  boost::format rawName("raw-%02dx%02d");
-  for (size_t x = 0; x < raw.getSizeX(); ++x) {
-    for (size_t y = 0; y < raw.getSizeY(); ++y) {
-      //raw(x, y)->Write((rawName % x % y).str().c_str());
+  rootFile->Write();
+  rootFile->Close();
+  const double outputEnd = DEPFET::StageTimer::getTime();
+  stats[DEPFET::ProcessingStats::OUTPUT].time += outputEnd - outputStart;
+  DEPFET::TraceRecorder::record("output", outputStart, outputEnd);
+  if (vm.count("stats")) stats.print(cout);
+
+  if (!cacheDirectory.empty()) {
+    try {
+      cache.store(results);
+    } catch (std::exception& e) {
+      cerr << "Could not cache calibration: " << e.what() << endl;
     }
   }
 
-  rootFile->Write();
-  rootFile->Close();
+  if (!traceFile.empty()) {
+    try {
+      DEPFET::TraceRecorder::write(traceFile);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+    }
+  }
 }
@@ -0,0 +1,65 @@
+#include <DEPFETReader/CalibrationStore.h>
+
+#include <iostream>
+#include <boost/program_options.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+  vector<string> inputFiles;
+  vector<int> moduleNumbers;
+  string outputFile;
+
+  //Parse program arguments
+  po::options_description desc("Convert calibration text files to one binary calibration file.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Calibration text files, one per module")
+  ("module,m", po::value< vector<int> >(&moduleNumbers)->composing(), "Module number for each input file, in the same order")
+  ("output,o", po::value<string>(&outputFile)->default_value("calibration.bin"), "Output file")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+  if (moduleNumbers.size() != inputFiles.size()) {
+    cerr << "Need exactly one module number per input file" << endl;
+    return 2;
+  }
+
+  vector<DEPFET::ModuleCalibration> modules;
+  for (size_t i = 0; i < inputFiles.size(); ++i) {
+    DEPFET::ModuleCalibration module(moduleNumbers[i]);
+    try {
+      DEPFET::CalibrationStore::readText(inputFiles[i], module.mask, module.pedestals, module.noise);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+    cout << "Module " << module.moduleNr << ": " << module.mask.getSizeX() << "x" << module.mask.getSizeY()
+         << " pixels from " << inputFiles[i] << endl;
+    modules.push_back(module);
+  }
+
+  try {
+    DEPFET::CalibrationStore::write(outputFile, modules);
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    return 3;
+  }
+}
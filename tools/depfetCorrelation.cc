@@ -0,0 +1,282 @@
+#include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/CommonMode.h>
+#include <DEPFETReader/CalibrationStore.h>
+#include <DEPFETReader/CovarianceMatrix.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <iostream>
+#include <fstream>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+bool showProgress(int event, int minOrder = 0, int maxOrder = 3)
+{
+  int order = (event == 0) ? 1 : max(min((int)log10(event), maxOrder), minOrder);
+  int interval = static_cast<int>(pow(10., order));
+  return (event % interval == 0);
+}
+
+//Sum of correlation coefficients of a group of pixel pairs
+struct CorrelationSum {
+  CorrelationSum(): pairs(0), sum(0) {}
+  void add(double correlation) { ++pairs; sum += correlation; }
+  double mean() const { return pairs ? sum / pairs : 0; }
+  uint64_t pairs;
+  double sum;
+};
+
+ostream& operator<<(ostream& output, const CorrelationSum& correlation)
+{
+  return output << correlation.pairs << " " << correlation.mean();
+}
+
+//Return the readout group of a pixel
+inline int getGroup(int x, int y, int groupRows, int groupCols, int groupDivisions)
+{
+  return (y / groupRows) * groupDivisions + min(x / groupCols, groupDivisions - 1);
+}
+
+//Write the full correlation matrix as float32 values after a 24 byte header. Returns false on error
+bool writeMatrix(const string& filename, const DEPFET::CovarianceMatrix& covariance, const DEPFET::MaskView& mask)
+{
+  ofstream output(filename.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!output) return false;
+  const uint32_t format[4] = {1, (uint32_t)mask.getSizeX(), (uint32_t)mask.getSizeY(), 0};
+  output.write("DEPFETCV", 8);
+  output.write((const char*)format, sizeof(format));
+  const size_t nPixels = covariance.getPixels();
+  vector<float> row(nPixels);
+  for (size_t p = 0; p < nPixels; ++p) {
+    for (size_t q = 0; q < nPixels; ++q) {
+      row[q] = (mask[p] || mask[q] || !covariance.isComputed(p, q)) ?
+               numeric_limits<float>::quiet_NaN() : covariance.getCorrelation(p, q);
+    }
+    output.write((const char*)&row.front(), row.size() * sizeof(float));
+  }
+  output.close();
+  return !output.fail();
+}
+
+int main(int argc, char* argv[])
+{
+  int skipEvents(0);
+  int maxEvents(-1);
+  vector<string> inputFiles;
+  string calibrationFile;
+  string outputFile("correlation.txt");
+  string matrixFile;
+  int moduleNr(-1);
+  int frameNr(-1);
+  int band(-1);
+  int batchFrames(256);
+  int nThreads(1);
+  int groupRows(2);
+  int groupDivisions(2);
+  int maxOffset(8);
+  double sigmaCut(5.0);
+
+  //Parse program arguments
+  po::options_description desc("Calculate the correlation of the noise of all pixel pairs of one module to find out\n"
+                               "which pixels share noise, e.g. to choose the common mode correction.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("skip,s", po::value<int>(&skipEvents)->default_value(0), "Number of events to skip before reading")
+  ("nevents,n", po::value<int>(&maxEvents)->default_value(-1), "Max. number of events")
+  ("calibration,c", po::value<string>(&calibrationFile), "Calibration File")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Input files")
+  ("output,o", po::value<string>(&outputFile)->default_value(outputFile), "Write the mean correlation by pixel offset, row, column and readout group to this file")
+  ("matrix", po::value<string>(&matrixFile), "Also write the full correlation matrix as float32 values to this file, NaN for masked pixels and pairs outside the band")
+  ("module", po::value<int>(&moduleNr)->default_value(moduleNr), "Module to use, -1 for the first module found")
+  ("4fold", "If set, data is read out in 4fold mode, otherwise 2fold")
+  ("dcd", "If set, common mode corretion is set to DCD mode (4 full rows), otherwise curo topology is used (two half rows")
+  ("sigma", po::value<double>(&sigmaCut)->default_value(sigmaCut), "Sigma cut to exclude signals from the common mode correction")
+  ("common-mode", "Apply the common mode correction before calculating the correlation to see the remaining correlation")
+  ("frame,f", po::value<int>(&frameNr)->default_value(frameNr), "Set the frame number to be used: -1=all, 0=original, 1=1st tailing, ...")
+  ("band", po::value<int>(&band)->default_value(band), "Only calculate the correlation of pixels whose columns differ by at most this number, -1 for all pairs")
+  ("batch", po::value<int>(&batchFrames)->default_value(batchFrames), "Number of frames added to the covariance at once")
+  ("threads,j", po::value<int>(&nThreads)->default_value(nThreads), "Number of threads used to update the covariance")
+  ("group-rows", po::value<int>(&groupRows)->default_value(groupRows), "Number of rows of one readout group")
+  ("group-divisions", po::value<int>(&groupDivisions)->default_value(groupDivisions), "Number of readout groups per row")
+  ("max-offset", po::value<int>(&maxOffset)->default_value(maxOffset), "Largest column and row offset for the correlation by pixel offset")
+  ("recover", "Continue after corrupted data by searching for the next valid event instead of aborting")
+  ("stats", "Print time and throughput of each processing stage at the end")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+  if (batchFrames <= 0 || nThreads <= 0 || groupRows <= 0 || groupDivisions <= 0 || maxOffset < 0) {
+    cerr << "Batch size, number of threads and readout groups must be positive" << endl;
+    return 2;
+  }
+  if (calibrationFile.empty()) {
+    cerr << "No calibration file given" << endl;
+    return 4;
+  }
+
+  DEPFET::DataReader reader;
+  reader.setReadoutFold(2);
+  reader.setUseDCDBMapping(true);
+  reader.setRecovery(vm.count("recover"));
+  //Common mode correction: row wise correction using two half rows and one column
+  DEPFET::CommonMode commonMode(2, 1, 2, 1);
+  if (vm.count("4fold")) {
+    reader.setReadoutFold(4);
+  }
+  if (vm.count("dcd")) {
+    commonMode = DEPFET::CommonMode(4, 0, 1, 1);
+  }
+
+  DEPFET::CalibrationStore calibrationStore;
+  DEPFET::CalibrationView calibration;
+  DEPFET::MaskView mask;
+  DEPFET::CovarianceMatrix* covariance(0);
+  DEPFET::ProcessingStats stats;
+  int eventNr(1);
+  reader.open(inputFiles, maxEvents);
+  reader.skip(skipEvents);
+  while (reader.next()) {
+    DEPFET::Event& event = reader.getEvent();
+    BOOST_FOREACH(DEPFET::ADCValues & data, event) {
+      if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
+      if (moduleNr < 0) moduleNr = data.getModuleNr();
+      if (data.getModuleNr() != moduleNr) continue;
+      if (!covariance) {
+        try {
+          calibration.load(calibrationStore, calibrationFile, moduleNr, data.getSizeX(), data.getSizeY());
+          covariance = new DEPFET::CovarianceMatrix(data.getSizeX(), data.getSizeY(), band, batchFrames, nThreads);
+        } catch (std::exception& e) {
+          cerr << e.what() << endl;
+          return 5;
+        }
+        cout << "Module " << moduleNr << ": " << data.getSizeX() << "x" << data.getSizeY() << " pixels, keeping "
+             << covariance->getStoredValues() * sizeof(double) / (1 << 20) << " MB of covariance sums" << endl;
+        mask = calibration.getMask();
+        commonMode.setMask(mask);
+        commonMode.setNoise(sigmaCut, calibration.getNoise());
+      }
+      //Pedestal substraction
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        data.substract(calibration.getPedestals());
+        stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
+      }
+      //Common Mode correction
+      if (vm.count("common-mode")) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::COMMONMODE);
+        commonMode.apply(data);
+        stats[DEPFET::ProcessingStats::COMMONMODE].countFrame(data);
+      }
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      for (size_t i = 0; i < data.getSize(); ++i) {
+        if (mask[i]) data[i] = 0;
+      }
+      covariance->add(data);
+      stats[DEPFET::ProcessingStats::OUTPUT].countFrame(data);
+    }
+    ++stats[DEPFET::ProcessingStats::OUTPUT].events;
+    if (showProgress(eventNr)) {
+      cout << "Correlation: " << eventNr << " events read" << endl;
+    }
+    ++eventNr;
+  }
+  DEPFET::ProcessingStats::printSkipped(cerr, reader.getSkippedRanges());
+  if (!covariance) {
+    cerr << "No frames of module " << moduleNr << " found" << endl;
+    return 5;
+  }
+
+  //Average the correlation over all pairs of unmasked pixels by offset, row, column and readout group
+  const double outputStart = DEPFET::StageTimer::getTime();
+  covariance->flush();
+  const size_t sizeX = mask.getSizeX();
+  const size_t sizeY = mask.getSizeY();
+  const int groupCols = max(1, (int)sizeX / groupDivisions);
+  const int offsetRows = 2 * maxOffset + 1;
+  vector<CorrelationSum> byOffset((maxOffset + 1) * offsetRows);
+  vector<CorrelationSum> byRow(sizeY);
+  vector<CorrelationSum> byColumn(sizeX);
+  vector<CorrelationSum> byGroup(((sizeY + groupRows - 1) / groupRows) * groupDivisions);
+  CorrelationSum otherGroups;
+  CorrelationSum all;
+  for (size_t p = 0; p < covariance->getPixels(); ++p) {
+    if (mask[p]) continue;
+    const int x1 = p / sizeY, y1 = p % sizeY;
+    const int group1 = getGroup(x1, y1, groupRows, groupCols, groupDivisions);
+    for (size_t q = p + 1; q < covariance->getPixels() && covariance->isComputed(p, q); ++q) {
+      if (mask[q]) continue;
+      const double correlation = covariance->getCorrelation(p, q);
+      if (std::isnan(correlation)) continue;
+      const int x2 = q / sizeY, y2 = q % sizeY;
+      const int group2 = getGroup(x2, y2, groupRows, groupCols, groupDivisions);
+      all.add(correlation);
+      if (x2 - x1 <= maxOffset && abs(y2 - y1) <= maxOffset) byOffset[(x2 - x1) * offsetRows + y2 - y1 + maxOffset].add(correlation);
+      if (y1 == y2) byRow[y1].add(correlation);
+      if (x1 == x2) byColumn[x1].add(correlation);
+      if (group1 == group2) byGroup[group1].add(correlation);
+      else otherGroups.add(correlation);
+    }
+  }
+
+  ofstream output(outputFile.c_str());
+  if (!output) {
+    cerr << "Could not open output file " << outputFile << endl;
+    return 3;
+  }
+  output << "# Noise correlation of module " << moduleNr << " from " << covariance->getFrames() << " frames, pedestal substracted"
+         << (vm.count("common-mode") ? " and common mode corrected" : "") << endl;
+  output << "# Each line gives the number of pixel pairs and their mean correlation" << endl;
+  output << "all " << all << endl;
+  output << "# offset dx dy: pairs with the second pixel dx columns and dy rows away" << endl;
+  for (int dx = 0; dx <= maxOffset; ++dx) {
+    for (int dy = -maxOffset; dy <= maxOffset; ++dy) {
+      const CorrelationSum& sum = byOffset[dx * offsetRows + dy + maxOffset];
+      if (sum.pairs) output << "offset " << dx << " " << dy << " " << sum << endl;
+    }
+  }
+  output << "# row y: pairs in the same row" << endl;
+  for (size_t y = 0; y < sizeY; ++y) output << "row " << y << " " << byRow[y] << endl;
+  output << "# column x: pairs in the same column" << endl;
+  for (size_t x = 0; x < sizeX; ++x) output << "column " << x << " " << byColumn[x] << endl;
+  output << "# group i: pairs in the same readout group of " << groupRows << " rows and " << groupCols << " columns, "
+         << groupDivisions << " groups per row" << endl;
+  for (size_t i = 0; i < byGroup.size(); ++i) output << "group " << i << " " << byGroup[i] << endl;
+  output << "other " << otherGroups << endl;
+  output.close();
+  if (output.fail()) {
+    cerr << "Error writing output file " << outputFile << endl;
+    return 3;
+  }
+  cout << "Mean correlation: " << all.mean() << " of all pairs, " << otherGroups.mean() << " between readout groups" << endl;
+
+  if (!matrixFile.empty() && !writeMatrix(matrixFile, *covariance, mask)) {
+    cerr << "Error writing matrix file " << matrixFile << endl;
+    return 3;
+  }
+  delete covariance;
+  stats[DEPFET::ProcessingStats::OUTPUT].time += DEPFET::StageTimer::getTime() - outputStart;
+
+  if (vm.count("stats")) {
+    stats.merge(reader.getStats());
+    stats.print(cout);
+  }
+  return 0;
+}
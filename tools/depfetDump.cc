@@ -1,10 +1,16 @@
 #include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/Shard.h>
+#include <DEPFETReader/EventBuilder.h>
 #include <DEPFETReader/CommonMode.h>
 #include <DEPFETReader/IncrementalMean.h>
+#include <DEPFETReader/PedestalTracker.h>
+#include <DEPFETReader/HotPixelTracker.h>
+#include <DEPFETReader/CalibrationStore.h>
 
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <map>
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
@@ -26,7 +32,38 @@ inline void dumpValue(ostream& output, double value, double scale = 1.0)
   if (output) output << setprecision(2) << setw(8) << fixed << (value * scale) << " ";
 }
 
-typedef DEPFET::ValueMatrix<double> PixelValues;
+//Calibration and pedestal tracking of one module
+struct ModuleState {
+  DEPFET::CalibrationView calibration;
+  DEPFET::PedestalTracker pedestalTracker;
+  DEPFET::HotPixelTracker hotPixelTracker;
+};
+
+//Return the calibration for the module of a frame, loading it on first use. Returns 0 on error
+ModuleState* loadCalibration(map<int, ModuleState>& modules, DEPFET::CalibrationStore& store, const string& filename,
+                             const DEPFET::ADCValues& data, double sigmaCut, int trackInterval, int hotWindow, double hotThreshold)
+{
+  map<int, ModuleState>::iterator it = modules.find(data.getModuleNr());
+  if (it != modules.end()) return &it->second;
+
+  ModuleState& module = modules[data.getModuleNr()];
+  try {
+    module.calibration.load(store, filename, data.getModuleNr(), data.getSizeX(), data.getSizeY());
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    modules.erase(data.getModuleNr());
+    return 0;
+  }
+  //Only the values changed during the run need a private copy, the rest is read from the mapped calibration
+  if (trackInterval > 0) module.calibration.copyPedestals();
+  module.pedestalTracker = DEPFET::PedestalTracker(trackInterval);
+  module.hotPixelTracker = DEPFET::HotPixelTracker(hotWindow, hotThreshold);
+  if (hotWindow > 0) module.hotPixelTracker.setMask(&module.calibration.copyMask());
+  module.hotPixelTracker.setNoise(sigmaCut, module.calibration.getNoise());
+  module.pedestalTracker.setMask(module.calibration.getMask());
+  module.pedestalTracker.setNoise(sigmaCut, module.calibration.getNoise());
+  return &module;
+}
 
 int main(int argc, char* argv[])
 {
@@ -34,9 +71,15 @@ int main(int argc, char* argv[])
   int maxEvents(-1);
   vector<string> inputFiles;
   string outputFile;
+  string traceFile;
+  string shardSpec;
   string calibrationFile;
   double sigmaCut(5.0);
   int frameNr(-1);
+  int trackInterval(0);
+  int hotWindow(0);
+  double hotThreshold(20);
+  string hotMaskFile;
 
   //Parse program arguments
   po::options_description desc("Allowed options");
@@ -51,6 +94,15 @@ int main(int argc, char* argv[])
   ("4fold", "If set, data is read out in 4fold mode, otherwise 2fold")
   ("dcd", "If set, common mode corretion is set to DCD mode (4 full rows), otherwise curo topology is used (two half rows")
   ("frame,f", po::value<int>(&frameNr)->default_value(frameNr), "Set the frame number to be used: -1=all, 0=original, 1=1st tailing, ...")
+  ("merge", "Read the input files at the same time and merge them by trigger number, each file containing different modules")
+  ("shard", po::value<string>(&shardSpec), "Process only part i of N consecutive parts of the selected events, e.g. 0/4. Concatenating the outputs of all parts in order gives the output for all events")
+  ("recover", "Continue after corrupted data by searching for the next valid event instead of aborting")
+  ("stats", "Print time and throughput of each processing stage at the end")
+  ("trace", po::value<string>(&traceFile), "Write a timeline of the processing stages in Chrome trace format to this file")
+  ("track-pedestals", po::value<int>(&trackInterval)->default_value(trackInterval), "Follow pedestal drifts by updating the pedestals from signal free pixels every N frames, 0=disabled")
+  ("hot-pixels", po::value<int>(&hotWindow)->default_value(hotWindow), "Mask pixels which fire far more often than the median pixel, checked every N frames, 0=disabled")
+  ("hot-threshold", po::value<double>(&hotThreshold)->default_value(hotThreshold), "Factor above the median number of hits for a pixel to be hot")
+  ("hot-mask", po::value<string>(&hotMaskFile), "Write the mask including the hot pixels to this file to be used for later runs, %1% is replaced by the module number")
   ;
 
   po::variables_map vm;
@@ -69,6 +121,14 @@ int main(int argc, char* argv[])
     cerr << "No input files given" << endl;
     return 2;
   }
+  if (!shardSpec.empty() && vm.count("merge")) {
+    cerr << "Shards cannot be used when merging files" << endl;
+    return 2;
+  }
+  if (!traceFile.empty()) {
+    DEPFET::TraceRecorder::enable();
+    DEPFET::TraceRecorder::setThreadName("main");
+  }
 
   ofstream output(outputFile.c_str());
   if (!output) {
@@ -79,6 +139,8 @@ int main(int argc, char* argv[])
   DEPFET::DataReader reader;
   reader.setReadoutFold(2);
   reader.setUseDCDBMapping(true);
+  reader.setRecovery(vm.count("recover"));
+  reader.setMergeFiles(vm.count("merge"));
   //Common mode correction: row wise correction using two half rows and one column
   DEPFET::CommonMode commonMode(2, 1, 2, 1);
   if (vm.count("4fold")) {
@@ -88,6 +150,16 @@ int main(int argc, char* argv[])
     commonMode = DEPFET::CommonMode(4, 0, 1, 1);
   }
 
+  //Restrict the events to the selected part of the input
+  if (!shardSpec.empty()) {
+    try {
+      DEPFET::Shard::select(shardSpec, inputFiles, skipEvents, maxEvents, vm.count("recover"), cout);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 2;
+    }
+  }
+
   reader.open(inputFiles, maxEvents);
   if (!reader.next()) {
     cerr << "Could not read a single event from the file" << cerr;
@@ -98,51 +170,59 @@ int main(int argc, char* argv[])
     cerr << "No calibration file given" << endl;
     return 4;
   }
-  ifstream calStream(calibrationFile.c_str());
-  if (!calStream) {
-    cerr << "Could not open calibration file " << calibrationFile << endl;
-    return 5;
-  }
-
-  //Read depfet calibration from file
-  DEPFET::PixelMask mask;
-  PixelValues pedestals;
-  PixelValues noise;
 
-  DEPFET::Event& event = reader.getEvent();
-  mask.setSize(event[0]);
-  pedestals.setSize(mask);
-  noise.setSize(mask);
-
-  while (calStream) {
-    int col, row, px_masked;
-    double px_pedestal, px_noise;
-    calStream >> col >> row >> px_masked >> px_pedestal >> px_noise;
-    if (!calStream) break;
-    mask.at(col, row) = px_masked;
-    pedestals.at(col, row) = px_pedestal;
-    noise.at(col, row) = px_noise;
+  //Read depfet calibration from file, more modules are loaded when they
+  //first appear as merged files can contain several modules
+  DEPFET::CalibrationStore calibrationStore;
+  map<int, ModuleState> modules;
+  BOOST_FOREACH(const DEPFET::ADCValues & data, reader.getEvent()) {
+    if (!loadCalibration(modules, calibrationStore, calibrationFile, data, sigmaCut, trackInterval, hotWindow, hotThreshold)) return 5;
   }
 
-  commonMode.setMask(&mask);
-  commonMode.setNoise(sigmaCut, &noise);
-
   //Done reading calibration, now read the events
 
+  DEPFET::ProcessingStats stats;
   int eventNr(1);
-  reader.open(inputFiles, maxEvents);
+  //Start again with the first event instead of reopening, inputs might be streams
+  reader.putBack();
   reader.skip(skipEvents);
   while (reader.next()) {
     DEPFET::Event& event = reader.getEvent();
     output << "event " << event.getRunNumber() << " " << event.getEventNumber() << " " << event.size() << endl;
     BOOST_FOREACH(DEPFET::ADCValues & data, event) {
       if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
+      ModuleState* module = loadCalibration(modules, calibrationStore, calibrationFile, data, sigmaCut, trackInterval, hotWindow, hotThreshold);
+      if (!module) return 5;
+      const DEPFET::MaskView mask = module->calibration.getMask();
+      const DEPFET::ValueView noise = module->calibration.getNoise();
+      commonMode.setMask(mask);
+      commonMode.setNoise(sigmaCut, noise);
       output << "module " << data.getModuleNr() << " " << data.getSizeX() << " " << data.getSizeY() << endl;
       //Pedestal substraction
-      data.substract(pedestals);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        data.substract(module->calibration.getPedestals());
+        stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
+      }
       //Common Mode correction
-      commonMode.apply(data);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::COMMONMODE);
+        commonMode.apply(data);
+        stats[DEPFET::ProcessingStats::COMMONMODE].countFrame(data);
+      }
+      //Follow pedestal drifts using the signal free pixels
+      if (trackInterval > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        module->pedestalTracker.add(data, module->calibration.copyPedestals());
+      }
+      //Mask pixels firing much more often than the others
+      if (hotWindow > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        module->hotPixelTracker.add(data);
+      }
       //At this point, data(x,y) is the pixel value of column x, row y
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      ++stats[DEPFET::ProcessingStats::OUTPUT].frames;
       //Insert custom code here --->
       for (size_t y = 0; y < data.getSizeY(); ++y) {
         //Mask startgate
@@ -158,6 +238,7 @@ int main(int argc, char* argv[])
       //---> Done
     }
     if (output) output << endl;
+    ++stats[DEPFET::ProcessingStats::OUTPUT].events;
     if (showProgress(eventNr)) {
       cout << "Output: " << eventNr << " events written" << endl;
     }
@@ -165,5 +246,38 @@ int main(int argc, char* argv[])
   }
 
   //Close the output file
+  stats[DEPFET::ProcessingStats::OUTPUT].bytes = output.tellp();
   output.close();
+
+  //Write the masks including the hot pixels found
+  if (hotWindow > 0) {
+    for (map<int, ModuleState>::const_iterator it = modules.begin(); it != modules.end(); ++it) {
+      cout << "Module " << it->first << ": masked " << it->second.hotPixelTracker.getHotPixels().size() << " hot pixels" << endl;
+      if (hotMaskFile.empty()) continue;
+      boost::format filename(hotMaskFile);
+      filename.exceptions(boost::io::all_error_bits ^ boost::io::too_many_args_bit);
+      try {
+        it->second.hotPixelTracker.write((filename % it->first).str());
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        return 3;
+      }
+    }
+  }
+
+  DEPFET::ProcessingStats::printSkipped(cerr, reader.getSkippedRanges());
+  if (reader.getEventBuilder()) reader.getEventBuilder()->printSummary(cerr);
+
+  if (vm.count("stats")) {
+    stats.merge(reader.getStats());
+    stats.print(cout);
+  }
+
+  if (!traceFile.empty()) {
+    try {
+      DEPFET::TraceRecorder::write(traceFile);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+    }
+  }
 }
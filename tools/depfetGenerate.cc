@@ -0,0 +1,169 @@
+#include <DEPFETReader/DataGenerator.h>
+#include <DEPFETReader/CalibrationStore.h>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+bool showProgress(int event, int minOrder = 0, int maxOrder = 3)
+{
+  int order = (event == 0) ? 1 : max(min((int)log10(event), maxOrder), minOrder);
+  int interval = static_cast<int>(pow(10., order));
+  return (event % interval == 0);
+}
+
+int main(int argc, char* argv[])
+{
+  int nEvents(1000);
+  string outputFile;
+  string device("s3b");
+  string calibrationFile;
+  string truthFile;
+  vector<int> modules;
+  int trailingFrames(0);
+  int runNumber(1);
+  unsigned int seed(1);
+  double pedestal(-1), pedestalSpread(-1), noise(-1), noiseSpread(-1);
+  double commonMode(0);
+  double hitsPerFrame(0), signal(-1);
+  double temperature(25), temperatureDrift(0), pedestalShift(0);
+
+  //Parse program arguments
+  po::options_description desc("Write synthetic DEPFET raw data.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("nevents,n", po::value<int>(&nEvents)->default_value(nEvents), "Number of events to write")
+  ("output,o", po::value<string>(&outputFile)->default_value("generated.dat"), "Output file")
+  ("device,d", po::value<string>(&device)->default_value(device), "Device type: s3a, s3b or dcd")
+  ("4fold", "If set, data is written in 4fold mode, otherwise 2fold")
+  ("no-dcdb-mapping", "Write DCD data without DCDB mapping")
+  ("module,m", po::value< vector<int> >(&modules)->composing(), "Module numbers to write, 0-15, default is one module with number 0. The frames of all modules of an event together must not exceed 2^20-1 words")
+  ("trailing-frames,t", po::value<int>(&trailingFrames)->default_value(trailingFrames), "Number of trailing frames per event, limited by the maximum event size of 2^20-1 words")
+  ("run,r", po::value<int>(&runNumber)->default_value(runNumber), "Run number")
+  ("seed", po::value<unsigned int>(&seed)->default_value(seed), "Random seed")
+  ("calibration,c", po::value<string>(&calibrationFile), "Take pedestals and noise from this calibration file instead of generating them")
+  ("write-calibration", po::value<string>(&truthFile), "Write the pedestals and noise used for generation to this binary calibration file")
+  ("pedestal", po::value<double>(&pedestal), "Mean pedestal, default depends on device type")
+  ("pedestal-spread", po::value<double>(&pedestalSpread), "Pedestal spread between pixels, default depends on device type")
+  ("noise", po::value<double>(&noise), "Mean noise, default depends on device type")
+  ("noise-spread", po::value<double>(&noiseSpread), "Noise spread between pixels, default is 10% of the noise")
+  ("common-mode", po::value<double>(&commonMode)->default_value(commonMode), "Sigma of the common mode per row")
+  ("hits", po::value<double>(&hitsPerFrame)->default_value(hitsPerFrame), "Mean number of hits per frame")
+  ("signal", po::value<double>(&signal), "Mean hit signal, default depends on device type")
+  ("temperature", po::value<double>(&temperature)->default_value(temperature), "Temperature at the start of the run")
+  ("temperature-drift", po::value<double>(&temperatureDrift)->default_value(temperatureDrift), "Temperature change per event")
+  ("pedestal-shift", po::value<double>(&pedestalShift)->default_value(pedestalShift), "Pedestal shift per degree")
+  ("fixed-gate", "Always start readout at gate 0 instead of a random start gate")
+  ;
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments and set device dependent defaults
+  int deviceType;
+  double defaultPedestal, defaultSpread, defaultNoise, defaultSignal;
+  if (device == "s3a") {
+    deviceType = DEPFET::DEVICETYPE_DEPFET;
+    defaultPedestal = 3000; defaultSpread = 300; defaultNoise = 10; defaultSignal = 500;
+  } else if (device == "s3b") {
+    deviceType = DEPFET::DEVICETYPE_DEPFET_128;
+    defaultPedestal = 3000; defaultSpread = 300; defaultNoise = 10; defaultSignal = 500;
+  } else if (device == "dcd") {
+    deviceType = DEPFET::DEVICETYPE_DEPFET_DCD;
+    defaultPedestal = 0; defaultSpread = 20; defaultNoise = 1.5; defaultSignal = 40;
+  } else {
+    cerr << "Unknown device type " << device << endl;
+    return 2;
+  }
+  if (!vm.count("pedestal")) pedestal = defaultPedestal;
+  if (!vm.count("pedestal-spread")) pedestalSpread = defaultSpread;
+  if (!vm.count("noise")) noise = defaultNoise;
+  if (!vm.count("noise-spread")) noiseSpread = 0.1 * noise;
+  if (!vm.count("signal")) signal = defaultSignal;
+  if (modules.empty()) modules.push_back(0);
+  BOOST_FOREACH(int moduleNr, modules) {
+    if (moduleNr < 0 || moduleNr > DEPFET::RawData::MAX_MODULE_NO) {
+      cerr << "Module number " << moduleNr << " is outside of 0-" << DEPFET::RawData::MAX_MODULE_NO << endl;
+      return 2;
+    }
+  }
+  if (trailingFrames < 0) {
+    cerr << "Number of trailing frames must not be negative" << endl;
+    return 2;
+  }
+
+  DEPFET::DataGenerator generator(deviceType, vm.count("4fold") ? 4 : 2, !vm.count("no-dcdb-mapping"), seed);
+  generator.setTrailingFrames(trailingFrames);
+  generator.setCommonMode(commonMode);
+  generator.setHits(hitsPerFrame, signal);
+  generator.setTemperature(temperature, temperatureDrift, pedestalShift);
+  generator.setRotateStartGate(!vm.count("fixed-gate"));
+  generator.setRunNumber(runNumber);
+  BOOST_FOREACH(int moduleNr, modules) {
+    if (calibrationFile.empty()) {
+      generator.addModule(moduleNr, pedestal, pedestalSpread, noise, noiseSpread);
+      continue;
+    }
+    DEPFET::ModuleCalibration calibration(moduleNr);
+    try {
+      DEPFET::CalibrationStore::load(calibrationFile, moduleNr, calibration.mask, calibration.pedestals, calibration.noise);
+      generator.addModule(calibration);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 5;
+    }
+  }
+
+  //The event size is stored in a 20 bit field of the header
+  if (generator.getEventSize() > DEPFET::RawData::MAX_EVENT_SIZE) {
+    cerr << "Event size of " << generator.getEventSize() << " words exceeds the maximum of " << DEPFET::RawData::MAX_EVENT_SIZE
+         << " words, use fewer trailing frames or modules" << endl;
+    return 2;
+  }
+
+  if (!truthFile.empty()) {
+    try {
+      DEPFET::CalibrationStore::write(truthFile, generator.getModules());
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+
+  //Use a large buffer, the data is written in big blocks anyway
+  vector<char> buffer(1 << 20);
+  ofstream output;
+  output.rdbuf()->pubsetbuf(&buffer.front(), buffer.size());
+  output.open(outputFile.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!output) {
+    cerr << "Could not open output file " << outputFile << endl;
+    return 3;
+  }
+
+  cout << "Writing " << nEvents << " events of " << modules.size() << " module(s) with "
+       << generator.getSizeX() << "x" << generator.getSizeY() << " pixels, "
+       << generator.getGates() << " start gate(s)" << endl;
+  generator.writeRunHeader(output);
+  for (int eventNr = 1; eventNr <= nEvents; ++eventNr) {
+    generator.writeEvent(output);
+    if (showProgress(eventNr)) {
+      cout << "Output: " << eventNr << " events written" << endl;
+    }
+  }
+  generator.writeRunTrailer(output);
+  output.close();
+  if (!output) {
+    cerr << "Error writing output file " << outputFile << endl;
+    return 3;
+  }
+}
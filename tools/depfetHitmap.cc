@@ -1,6 +1,12 @@
 #include <DEPFETReader/DataReader.h>
+#include <DEPFETReader/Shard.h>
+#include <DEPFETReader/PartialResult.h>
 #include <DEPFETReader/CommonMode.h>
 #include <DEPFETReader/IncrementalMean.h>
+#include <DEPFETReader/PedestalTracker.h>
+#include <DEPFETReader/HotPixelTracker.h>
+#include <DEPFETReader/CalibrationStore.h>
+#include <DEPFETReader/FrameImage.h>
 
 #include <cmath>
 #include <iostream>
@@ -21,16 +27,46 @@ bool showProgress(int event, int minOrder = 0, int maxOrder = 3)
 
 typedef DEPFET::ValueMatrix<double> PixelValues;
 
+//Write the hitmap of one slice of events as image and/or to the frame stack. Returns false on error
+bool writeSlice(const PixelValues& slice, const DEPFET::MaskView& mask, int sliceNr, uint64_t firstEvent, uint32_t nEvents,
+                const string& imagePattern, double imageMax, DEPFET::FrameStack& stack, bool useStack)
+{
+  try {
+    if (!imagePattern.empty()) {
+      boost::format filename(imagePattern);
+      filename.exceptions(boost::io::all_error_bits ^ boost::io::too_many_args_bit);
+      DEPFET::writePGM((filename % sliceNr).str(), slice, mask, imageMax);
+    }
+    if (useStack) stack.write(slice, mask, firstEvent, nEvents);
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char* argv[])
 {
   int skipEvents(0);
   int maxEvents(-1);
   vector<string> inputFiles;
   string outputFile;
+  string traceFile;
+  string shardSpec;
+  string partialFile;
   string calibrationFile;
   double sigmaCut(5.0);
   bool do_normalize(false);
   int frameNr(-1);
+  int trackInterval(0);
+  int hotWindow(0);
+  double hotThreshold(20);
+  string hotMaskFile;
+  int sliceSize(0);
+  string sliceImages;
+  string sliceStack;
+  string imageFile;
+  double imageMax(0);
 
   //Parse program arguments
   po::options_description desc("Allowed options");
@@ -46,6 +82,20 @@ int main(int argc, char* argv[])
   ("dcd", "If set, common mode corretion is set to DCD mode (4 full rows), otherwise curo topology is used (two half rows")
   ("normalize", po::bool_switch(), "Divide ADC count by number of frames processed")
   ("frame,f", po::value<int>(&frameNr)->default_value(frameNr), "Set the frame number to be used: -1=all, 0=original, 1=1st tailing, ...")
+  ("shard", po::value<string>(&shardSpec), "Process only part i of N consecutive parts of the selected events, e.g. 0/4. The hitmaps of all parts add up to the hitmap of all events, except for the negative values marking masked pixels")
+  ("partial", po::value<string>(&partialFile), "Also write the hitmap sums and the number of events to this binary file, to be combined with the results of other jobs by depfetMerge")
+  ("recover", "Continue after corrupted data by searching for the next valid event instead of aborting")
+  ("stats", "Print time and throughput of each processing stage at the end")
+  ("trace", po::value<string>(&traceFile), "Write a timeline of the processing stages in Chrome trace format to this file")
+  ("track-pedestals", po::value<int>(&trackInterval)->default_value(trackInterval), "Follow pedestal drifts by updating the pedestals from signal free pixels every N frames, 0=disabled")
+  ("hot-pixels", po::value<int>(&hotWindow)->default_value(hotWindow), "Mask pixels which fire far more often than the median pixel, checked every N frames, 0=disabled")
+  ("hot-threshold", po::value<double>(&hotThreshold)->default_value(hotThreshold), "Factor above the median number of hits for a pixel to be hot")
+  ("hot-mask", po::value<string>(&hotMaskFile), "Write the mask including the hot pixels to this file to be used for later runs, %1% is replaced by the module number")
+  ("image", po::value<string>(&imageFile), "Also write the hitmap as PGM image to this file")
+  ("slice", po::value<int>(&sliceSize)->default_value(sliceSize), "Also make a hitmap of every N events, written with --slice-images or --slice-stack. Use 1 together with --frame to get single frames")
+  ("slice-images", po::value<string>(&sliceImages), "Write the hitmap of each slice as PGM image, the filename is formatted with the slice number, e.g. movie/%06d.pgm")
+  ("slice-stack", po::value<string>(&sliceStack), "Write the hitmaps of all slices to this binary file, see FrameImage.h for the format")
+  ("image-max", po::value<double>(&imageMax)->default_value(imageMax), "Value shown as white in the images, 0=scale each image to its maximum")
   ;
 
   po::variables_map vm;
@@ -64,10 +114,19 @@ int main(int argc, char* argv[])
     cerr << "No input files given" << endl;
     return 2;
   }
+  if (sliceSize > 0 && sliceImages.empty() && sliceStack.empty()) {
+    cerr << "No output for the slices given, use --slice-images or --slice-stack" << endl;
+    return 2;
+  }
+  if (!traceFile.empty()) {
+    DEPFET::TraceRecorder::enable();
+    DEPFET::TraceRecorder::setThreadName("main");
+  }
 
   DEPFET::DataReader reader;
   reader.setReadoutFold(2);
   reader.setUseDCDBMapping(true);
+  reader.setRecovery(vm.count("recover"));
   //Common mode correction: row wise correction using two half rows and one column
   DEPFET::CommonMode commonMode(2, 1, 2, 1);
   if (vm.count("4fold")) {
@@ -77,6 +136,16 @@ int main(int argc, char* argv[])
     commonMode = DEPFET::CommonMode(4, 0, 1, 1);
   }
 
+  //Restrict the events to the selected part of the input
+  if (!shardSpec.empty()) {
+    try {
+      DEPFET::Shard::select(shardSpec, inputFiles, skipEvents, maxEvents, vm.count("recover"), cout);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 2;
+    }
+  }
+
   reader.open(inputFiles, maxEvents);
   if (!reader.next()) {
     cerr << "Could not read a single event from the file" << cerr;
@@ -87,39 +156,56 @@ int main(int argc, char* argv[])
     cerr << "No calibration file given" << endl;
     return 4;
   }
-  ifstream calStream(calibrationFile.c_str());
-  if (!calStream) {
-    cerr << "Could not open calibration file " << calibrationFile << endl;
+
+  DEPFET::Event& event = reader.getEvent();
+  const int moduleNr = event[0].getModuleNr();
+  DEPFET::CalibrationStore calibrationStore;
+  DEPFET::CalibrationView calibration;
+  try {
+    calibration.load(calibrationStore, calibrationFile, moduleNr, event[0].getSizeX(), event[0].getSizeY());
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
     return 5;
   }
 
-  DEPFET::PixelMask mask;
-  PixelValues pedestals;
-  PixelValues noise;
-  PixelValues hitmap;
+  //Only the values changed during the run need a private copy, the rest is read from the mapped calibration
+  DEPFET::PedestalTracker pedestalTracker(trackInterval);
+  DEPFET::HotPixelTracker hotPixelTracker(hotWindow, hotThreshold);
+  if (trackInterval > 0) calibration.copyPedestals();
+  if (hotWindow > 0) hotPixelTracker.setMask(&calibration.copyMask());
+  const DEPFET::MaskView mask = calibration.getMask();
+  const DEPFET::ValueView pedestals = calibration.getPedestals();
+  const DEPFET::ValueView noise = calibration.getNoise();
 
-  DEPFET::Event& event = reader.getEvent();
-  mask.setSize(event[0]);
-  pedestals.setSize(mask);
-  hitmap.setSize(mask);
-  noise.setSize(mask);
+  PixelValues hitmap(mask.getSizeX(), mask.getSizeY());
+  commonMode.setMask(mask);
+  commonMode.setNoise(sigmaCut, noise);
+  pedestalTracker.setMask(mask);
+  pedestalTracker.setNoise(sigmaCut, noise);
+  hotPixelTracker.setNoise(sigmaCut, noise);
 
-  while (calStream) {
-    int col, row, px_masked;
-    double px_pedestal, px_noise;
-    calStream >> col >> row >> px_masked >> px_pedestal >> px_noise;
-    if (!calStream) break;
-    mask.at(col, row) = px_masked;
-    pedestals.at(col, row) = px_pedestal;
-    noise.at(col, row) = px_noise;
+  //Hitmap of the current slice of events
+  PixelValues slice;
+  DEPFET::FrameStack stack;
+  int sliceNr(0);
+  int sliceEvents(0);
+  if (sliceSize > 0) {
+    slice.setSize(mask.getSizeX(), mask.getSizeY());
+    if (!sliceStack.empty()) {
+      try {
+        stack.open(sliceStack, mask.getSizeX(), mask.getSizeY());
+      } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        return 3;
+      }
+    }
   }
 
-  hitmap.substract(mask, 1e4);
-  commonMode.setMask(&mask);
-  commonMode.setNoise(sigmaCut, &noise);
-
+  DEPFET::ProcessingStats stats;
   int eventNr(1);
-  reader.open(inputFiles, maxEvents);
+  uint64_t nFrames(0);
+  //Start again with the first event instead of reopening, inputs might be streams
+  reader.putBack();
   reader.skip(skipEvents);
   while (reader.next()) {
     DEPFET::Event& event = reader.getEvent();
@@ -127,10 +213,31 @@ int main(int argc, char* argv[])
       if (frameNr >= 0 && data.getFrameNr() != frameNr) continue;
       // DEPFET::ADCValues &data = event[0];
       //Pedestal substraction
-      data.substract(pedestals);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        data.substract(pedestals);
+        stats[DEPFET::ProcessingStats::PEDESTAL].countFrame(data);
+      }
       //Common Mode correction
-      commonMode.apply(data);
+      {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::COMMONMODE);
+        commonMode.apply(data);
+        stats[DEPFET::ProcessingStats::COMMONMODE].countFrame(data);
+      }
+      //Follow pedestal drifts using the signal free pixels
+      if (trackInterval > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        pedestalTracker.add(data, calibration.copyPedestals());
+      }
+      //Mask pixels firing much more often than the others
+      if (hotWindow > 0) {
+        DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::PEDESTAL);
+        hotPixelTracker.add(data);
+      }
       //At this point, data(x,y) is the pixel value of column x, row y
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      stats[DEPFET::ProcessingStats::OUTPUT].countFrame(data);
+      ++nFrames;
       for (size_t y = 0; y < data.getSizeY(); ++y) {
         //Mask startgate
         //if(y%2 == data.getStartGate()) {
@@ -139,16 +246,61 @@ int main(int argc, char* argv[])
         for (size_t x = 0; x < data.getSizeX(); ++x) {
           if (data(x, y) > sigmaCut * noise(x, y)) {
             hitmap(x, y) += data(x, y);
+            if (sliceSize > 0) slice(x, y) += data(x, y);
           }
         }
       }
     }
+    ++stats[DEPFET::ProcessingStats::OUTPUT].events;
+    //Write the hitmap of the slice once it is complete
+    if (sliceSize > 0 && ++sliceEvents == sliceSize) {
+      DEPFET::StageTimer timer(stats, DEPFET::ProcessingStats::OUTPUT);
+      if (!writeSlice(slice, mask, sliceNr++, skipEvents + eventNr - sliceEvents, sliceEvents, sliceImages, imageMax, stack,
+                      !sliceStack.empty())) return 3;
+      slice.clear();
+      sliceEvents = 0;
+    }
     if (showProgress(eventNr)) {
       cout << "Output: " << eventNr << " events written" << endl;
     }
     ++eventNr;
   }
 
+  const double outputStart = DEPFET::StageTimer::getTime();
+  if (sliceEvents > 0 && !writeSlice(slice, mask, sliceNr, skipEvents + eventNr - 1 - sliceEvents, sliceEvents, sliceImages,
+                                     imageMax, stack, !sliceStack.empty())) return 3;
+  if (!sliceStack.empty()) {
+    try {
+      stack.close();
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+  if (!imageFile.empty()) {
+    try {
+      DEPFET::writePGM(imageFile, hitmap, mask, imageMax);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+  if (!partialFile.empty()) {
+    DEPFET::PartialHitmap partial;
+    partial.events = eventNr - 1;
+    partial.frames = nFrames;
+    partial.mask.setSize(hitmap);
+    partial.mask.set(mask);
+    partial.sums = hitmap;
+    try {
+      DEPFET::PartialResult::write(partialFile, partial);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+  //Mark masked pixels
+  hitmap.substract(mask, 1e4);
   ofstream hitmapFile(outputFile.c_str());
   if (!hitmapFile) {
     cerr << "Could not open hitmap output file " << outputFile;
@@ -163,4 +315,37 @@ int main(int argc, char* argv[])
     hitmapFile << endl;
   }
   hitmapFile.close();
+  const double outputEnd = DEPFET::StageTimer::getTime();
+  stats[DEPFET::ProcessingStats::OUTPUT].time += outputEnd - outputStart;
+  DEPFET::TraceRecorder::record("output", outputStart, outputEnd);
+
+  //Write the mask including the hot pixels found
+  if (hotWindow > 0) {
+    cout << "Masked " << hotPixelTracker.getHotPixels().size() << " hot pixels" << endl;
+  }
+  if (hotWindow > 0 && !hotMaskFile.empty()) {
+    boost::format filename(hotMaskFile);
+    filename.exceptions(boost::io::all_error_bits ^ boost::io::too_many_args_bit);
+    try {
+      hotPixelTracker.write((filename % moduleNr).str());
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return 3;
+    }
+  }
+
+  DEPFET::ProcessingStats::printSkipped(cerr, reader.getSkippedRanges());
+
+  if (vm.count("stats")) {
+    stats.merge(reader.getStats());
+    stats.print(cout);
+  }
+
+  if (!traceFile.empty()) {
+    try {
+      DEPFET::TraceRecorder::write(traceFile);
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+    }
+  }
 }
@@ -0,0 +1,202 @@
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/ProcessingStats.h>
+
+#include <iostream>
+#include <set>
+#include <map>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+//Return a readable name for a device type
+string getDeviceName(int deviceType)
+{
+  switch (deviceType) {
+    case DEPFET::DEVICETYPE_DEPFET:     return "S3A";
+    case DEPFET::DEVICETYPE_DEPFET_128: return "S3B";
+    case DEPFET::DEVICETYPE_DEPFET_DCD: return "DCD";
+    case DEPFET::DEVICETYPE_BAT:        return "BAT";
+    case DEPFET::DEVICETYPE_TPLL:       return "TPLL";
+    case DEPFET::DEVICETYPE_TLU:        return "TLU";
+    default:
+      return (boost::format("unknown(%1%)") % deviceType).str();
+  }
+}
+
+//Print a range of values
+template<class T> string formatRange(const T& minimum, const T& maximum)
+{
+  if (minimum == maximum) return (boost::format("%1%") % minimum).str();
+  return (boost::format("%1% - %2%") % minimum % maximum).str();
+}
+
+//Summary of one file
+struct FileSummary {
+  FileSummary(): events(0), missing(0), gaps(0), firstTrigger(0), lastTrigger(0), minFrames(0), maxFrames(0),
+    minGate(0), maxGate(0), minTemperature(0), maxTemperature(0) {}
+
+  /** Number of events */
+  uint64_t events;
+  /** Number of missing trigger numbers */
+  uint64_t missing;
+  /** Number of gaps in the trigger numbers */
+  uint64_t gaps;
+  /** First and last trigger number */
+  unsigned int firstTrigger, lastTrigger;
+  /** Range of frames per module record */
+  int minFrames, maxFrames;
+  /** Range of start gates */
+  int minGate, maxGate;
+  /** Range of temperatures */
+  float minTemperature, maxTemperature;
+  /** Number of module records per device type */
+  map<int, uint64_t> deviceTypes;
+  /** Number of module records per module number */
+  map<int, uint64_t> modules;
+  /** Range of number of modules per event */
+  set<size_t> modulesPerEvent;
+  /** The first gaps found */
+  vector<pair<unsigned int, unsigned int> > gapList;
+};
+
+int main(int argc, char* argv[])
+{
+  vector<string> inputFiles;
+  size_t maxGaps(10);
+
+  //Parse program arguments
+  po::options_description desc("Show the contents of DEPFET raw data files by reading only the record headers.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Input files")
+  ("gaps", po::value<size_t>(&maxGaps)->default_value(maxGaps), "Maximum number of trigger gaps to list")
+  ("events", "Print one line per event with trigger number, offset, size and modules")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  try {
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+  } catch (po::error& e) {
+    cerr << e.what() << endl << endl << desc << endl;
+    return 2;
+  }
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+
+  int result(0);
+  BOOST_FOREACH(const string & filename, inputFiles) {
+    const double start = DEPFET::StageTimer::getTime();
+    DEPFET::HeaderScanner scanner;
+    FileSummary summary;
+    try {
+      scanner.open(filename);
+      while (scanner.next()) {
+        const unsigned int trigger = scanner.getTriggerNr();
+        const vector<DEPFET::ModuleHeader>& modules = scanner.getModules();
+        if (vm.count("events")) {
+          cout << boost::format("event %10d offset %14d size %9d modules") % trigger % scanner.getOffset() % scanner.getEventSize();
+          BOOST_FOREACH(const DEPFET::ModuleHeader & module, modules) {
+            cout << " " << module.moduleNr << ":" << getDeviceName(module.deviceType) << "/" << module.frames
+                 << "/g" << module.startGate;
+          }
+          cout << endl;
+        }
+
+        if (summary.events == 0) {
+          summary.firstTrigger = trigger;
+        } else if (trigger > summary.lastTrigger + 1) {
+          ++summary.gaps;
+          summary.missing += trigger - summary.lastTrigger - 1;
+          if (summary.gapList.size() < maxGaps) {
+            summary.gapList.push_back(make_pair(summary.lastTrigger + 1, trigger - 1));
+          }
+        }
+        summary.lastTrigger = trigger;
+        summary.modulesPerEvent.insert(modules.size());
+
+        BOOST_FOREACH(const DEPFET::ModuleHeader & module, modules) {
+          if (summary.deviceTypes.empty()) {
+            summary.minFrames = summary.maxFrames = module.frames;
+            summary.minGate = summary.maxGate = module.startGate;
+            summary.minTemperature = summary.maxTemperature = module.temperature;
+          }
+          ++summary.deviceTypes[module.deviceType];
+          ++summary.modules[module.moduleNr];
+          summary.minFrames = min(summary.minFrames, module.frames);
+          summary.maxFrames = max(summary.maxFrames, module.frames);
+          summary.minGate = min(summary.minGate, module.startGate);
+          summary.maxGate = max(summary.maxGate, module.startGate);
+          summary.minTemperature = min(summary.minTemperature, module.temperature);
+          summary.maxTemperature = max(summary.maxTemperature, module.temperature);
+        }
+        ++summary.events;
+      }
+    } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      result = 5;
+      continue;
+    }
+    const double elapsed = DEPFET::StageTimer::getTime() - start;
+
+    cout << "File:              " << filename << boost::format(" (%.1f MB)") % (scanner.getFileSize() / 1e6) << endl;
+    if (scanner.getRunNumber() >= 0) {
+      cout << "Run number:        " << scanner.getRunNumber() << endl;
+    } else {
+      cout << "Run number:        no run header found" << endl;
+    }
+    cout << "Run begin/end:     " << scanner.getRunBegins() << "/" << scanner.getRunEnds() << " records" << endl;
+    cout << "Events:            " << summary.events << endl;
+    if (summary.events > 0) {
+      cout << "Triggers:          " << formatRange(summary.firstTrigger, summary.lastTrigger) << ", "
+           << summary.missing << " missing in " << summary.gaps << " gaps" << endl;
+      for (size_t i = 0; i < summary.gapList.size(); ++i) {
+        cout << "  missing:         " << formatRange(summary.gapList[i].first, summary.gapList[i].second) << endl;
+      }
+      if (summary.gapList.size() < summary.gaps) {
+        cout << "  ...              " << (summary.gaps - summary.gapList.size()) << " more gaps" << endl;
+      }
+      cout << "Device types:     ";
+      for (map<int, uint64_t>::const_iterator it = summary.deviceTypes.begin(); it != summary.deviceTypes.end(); ++it) {
+        cout << " " << getDeviceName(it->first) << " (" << it->second << " records)";
+      }
+      cout << endl;
+      cout << "Modules:          ";
+      for (map<int, uint64_t>::const_iterator it = summary.modules.begin(); it != summary.modules.end(); ++it) {
+        cout << " " << it->first << " (" << it->second << " records)";
+      }
+      cout << endl;
+      cout << "Modules per event: " << formatRange(*summary.modulesPerEvent.begin(), *summary.modulesPerEvent.rbegin()) << endl;
+      cout << "Frames per module: " << formatRange(summary.minFrames, summary.maxFrames)
+           << " (1 frame + " << formatRange(summary.minFrames - 1, summary.maxFrames - 1) << " trailing)" << endl;
+      cout << "Start gates:       " << formatRange(summary.minGate, summary.maxGate) << endl;
+      cout << "Temperature:       " << formatRange(summary.minTemperature, summary.maxTemperature) << " C" << endl;
+      cout << "Readout fold:      not stored in the headers, does not change the frame size" << endl;
+    }
+    if (scanner.getOtherRecords() > 0) {
+      cout << "Other records:     " << scanner.getOtherRecords() << endl;
+    }
+    if (scanner.isDamaged()) {
+      cout << "WARNING:           invalid or incomplete record at offset " << scanner.getPosition()
+           << ", " << (scanner.getFileSize() - scanner.getPosition()) << " bytes not scanned" << endl;
+      result = 6;
+    }
+    cout << boost::format("Scan:              %.3f s, %.1f MB of headers read") % elapsed % (scanner.getBytesRead() / 1e6) << endl;
+    cout << endl;
+  }
+  return result;
+}
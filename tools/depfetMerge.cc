@@ -0,0 +1,145 @@
+#include <DEPFETReader/PartialResult.h>
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+//Output a single value to file
+inline void dumpValue(ostream& output, double value, double scale)
+{
+  if (isnan(value)) value = 0;
+  if (output) output << setprecision(2) << setw(8) << fixed << (value * scale) << " ";
+}
+
+//Write a hitmap in the same format as depfetHitmap
+bool writeHitmap(const string& filename, const DEPFET::PartialHitmap& partial, bool normalize)
+{
+  ofstream output(filename.c_str());
+  if (!output) return false;
+  DEPFET::ValueMatrix<double> hitmap = partial.sums;
+  //Mark masked pixels
+  hitmap.substract(partial.mask, 1e4);
+  output << hitmap.getSizeX() << " " << hitmap.getSizeY() << endl;
+  for (unsigned int col = 0; col < hitmap.getSizeX(); ++col) {
+    for (unsigned int row = 0; row < hitmap.getSizeY(); ++row) {
+      if (normalize && partial.events > 0) hitmap(col, row) /= partial.events;
+      output << hitmap(col, row) << " ";
+    }
+    output << endl;
+  }
+  return !output.fail();
+}
+
+//Write a calibration in the same format as depfetCalibration. The noise is
+//determined from the merged histograms the same way as in depfetCalibration
+bool writeCalibration(const string& filename, const DEPFET::PartialCalibration& partial, double scaleFactor)
+{
+  ofstream output(filename.c_str());
+  if (!output) return false;
+  const DEPFET::PixelMask& masked = partial.mask;
+  for (unsigned int col = 0; col < masked.getSizeX(); ++col) {
+    for (unsigned int row = 0; row < masked.getSizeY(); ++row) {
+      output << setw(6) << col << setw(6) << row << setw(2) << (int)masked(col, row) << " ";
+      dumpValue(output, partial.pedestals.getMean(col, row), scaleFactor);
+      if (masked(col, row)) {
+        dumpValue(output, 0, 0);
+      } else {
+        dumpValue(output, partial.noise.getNoise(col, row), scaleFactor);
+      }
+      output << endl;
+    }
+  }
+  return !output.fail();
+}
+
+int main(int argc, char* argv[])
+{
+  vector<string> inputFiles;
+  string outputFile;
+  string partialFile;
+  double scaleFactor(1.0);
+
+  //Parse program arguments
+  po::options_description desc("Combine partial results written by depfetHitmap or depfetCalibration with --partial.\n"
+                               "All input files have to contain the same kind of result. The combined result can be\n"
+                               "written as final output and as partial result again, so more data can be added later.\n"
+                               "Allowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Partial result files")
+  ("output,o", po::value<string>(&outputFile), "Final output file, in the format of depfetHitmap or depfetCalibration")
+  ("partial,p", po::value<string>(&partialFile), "Write the combined partial result to this file")
+  ("normalize", "Hitmaps only: divide the sums by the number of events")
+  ("scale", po::value<double>(&scaleFactor)->default_value(1.0), "Calibrations only: scaling factor for ADC values")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  try {
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+  } catch (po::error& e) {
+    cerr << e.what() << endl << endl << desc << endl;
+    return 2;
+  }
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+  if (outputFile.empty() && partialFile.empty()) {
+    cerr << "No output file given" << endl;
+    return 2;
+  }
+
+  try {
+    const DEPFET::PartialResult::Type type = DEPFET::PartialResult::getType(inputFiles[0]);
+    if (type == DEPFET::PartialResult::HITMAP) {
+      DEPFET::PartialHitmap hitmap;
+      BOOST_FOREACH(const string & filename, inputFiles) {
+        DEPFET::PartialHitmap partial;
+        DEPFET::PartialResult::read(filename, partial);
+        hitmap.merge(partial);
+      }
+      cout << "Hitmap: " << inputFiles.size() << " files, " << hitmap.events << " events, " << hitmap.frames << " frames" << endl;
+      if (!partialFile.empty()) DEPFET::PartialResult::write(partialFile, hitmap);
+      if (!outputFile.empty() && !writeHitmap(outputFile, hitmap, vm.count("normalize"))) {
+        cerr << "Could not write output file " << outputFile << endl;
+        return 3;
+      }
+    } else if (type == DEPFET::PartialResult::CALIBRATION) {
+      DEPFET::PartialCalibration calibration;
+      BOOST_FOREACH(const string & filename, inputFiles) {
+        DEPFET::PartialCalibration partial;
+        DEPFET::PartialResult::read(filename, partial);
+        calibration.merge(partial);
+      }
+      cout << "Calibration of module " << calibration.moduleNr << ": " << inputFiles.size() << " files, "
+           << calibration.events << " events" << endl;
+      if (!partialFile.empty()) DEPFET::PartialResult::write(partialFile, calibration);
+      if (!outputFile.empty() && !writeCalibration(outputFile, calibration, scaleFactor)) {
+        cerr << "Could not write output file " << outputFile << endl;
+        return 3;
+      }
+    } else {
+      cerr << inputFiles[0] << " is not a partial result file" << endl;
+      return 5;
+    }
+  } catch (std::exception& e) {
+    cerr << e.what() << endl;
+    return 5;
+  }
+}
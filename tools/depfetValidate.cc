@@ -0,0 +1,119 @@
+#include <DEPFETReader/HeaderScanner.h>
+#include <DEPFETReader/DataReader.h>
+
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+  vector<string> inputFiles;
+
+  //Parse program arguments
+  po::options_description desc("Check the structure of DEPFET raw data files.\n"
+                               "All record headers are checked for consistency and the corrupted parts of each file are listed.\n"
+                               "Returns 0 if all files are valid, 6 otherwise.\nAllowed options");
+  desc.add_options()
+  ("help,h", "Show help message")
+  ("input,i", po::value< vector<string> >(&inputFiles)->composing(), "Input files")
+  ("decode", "Additionally read and convert all events, which reads the whole file")
+  ("4fold", "If set, data is decoded in 4fold mode, otherwise 2fold")
+  ("quiet,q", "Only print files with problems")
+  ;
+
+  po::variables_map vm;
+  po::positional_options_description p;
+  p.add("input", -1);
+
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 1;
+  }
+
+  //check program arguments
+  if (inputFiles.empty()) {
+    cerr << "No input files given" << endl;
+    return 2;
+  }
+
+  int result(0);
+  BOOST_FOREACH(const string & filename, inputFiles) {
+    const double start = DEPFET::StageTimer::getTime();
+    DEPFET::HeaderScanner scanner;
+    scanner.setRecovery(true);
+    uint64_t events(0), unordered(0), skippedBytes(0);
+    unsigned int lastTrigger(0);
+    try {
+      scanner.open(filename);
+      while (scanner.next()) {
+        if (events > 0 && scanner.getTriggerNr() <= lastTrigger) ++unordered;
+        lastTrigger = scanner.getTriggerNr();
+        ++events;
+      }
+    } catch (std::exception& e) {
+      cout << filename << ": ERROR, " << e.what() << endl;
+      result = 6;
+      continue;
+    }
+    const vector<DEPFET::SkippedRange>& skipped = scanner.getSkippedRanges();
+    BOOST_FOREACH(const DEPFET::SkippedRange & range, skipped) {
+      skippedBytes += range.size;
+    }
+
+    //Optionally decode all events to check that the data can be converted
+    int decoded(-1);
+    vector<DEPFET::SkippedRange> decodeSkipped;
+    string decodeError;
+    if (vm.count("decode")) {
+      DEPFET::DataReader reader;
+      reader.setReadoutFold(vm.count("4fold") ? 4 : 2);
+      reader.setUseDCDBMapping(true);
+      reader.setRecovery(true);
+      try {
+        reader.open(vector<string>(1, filename));
+        decoded = 0;
+        while (reader.next()) ++decoded;
+        decodeSkipped = reader.getSkippedRanges();
+      } catch (std::exception& e) {
+        decodeError = e.what();
+      }
+    }
+    const double elapsed = DEPFET::StageTimer::getTime() - start;
+
+    const bool valid = skipped.empty() && decodeSkipped.empty() && decodeError.empty() &&
+                       (decoded < 0 || (uint64_t) decoded == events);
+    if (!valid) result = 6;
+    if (valid && vm.count("quiet")) continue;
+
+    cout << filename << ": " << (valid ? "OK" : "DAMAGED") << ", " << events << " events, "
+         << boost::format("%.1f MB in %.2f s") % (scanner.getFileSize() / 1e6) % elapsed << endl;
+    if (!skipped.empty()) {
+      cout << "  " << skipped.size() << " corrupted regions, " << skippedBytes << " bytes skipped" << endl;
+    }
+    BOOST_FOREACH(const DEPFET::SkippedRange & range, skipped) {
+      cout << "  corrupted: offset " << range.offset << ", " << range.size << " bytes" << endl;
+    }
+    if (unordered > 0) {
+      cout << "  " << unordered << " events with trigger number not larger than the previous one" << endl;
+    }
+    if (scanner.getRunEnds() == 0) {
+      cout << "  no run end record, the file might be incomplete" << endl;
+    }
+    if (decoded >= 0 && (uint64_t) decoded != events) {
+      cout << "  " << decoded << " events could be decoded" << endl;
+    }
+    BOOST_FOREACH(const DEPFET::SkippedRange & range, decodeSkipped) {
+      cout << "  not decodable: offset " << range.offset << ", " << range.size << " bytes" << endl;
+    }
+    if (!decodeError.empty()) {
+      cout << "  decoding failed: " << decodeError << endl;
+    }
+  }
+  return result;
+}